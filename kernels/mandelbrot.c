@@ -0,0 +1,114 @@
+/*
+ * Native version of shaders/mandelbrot.frag, computing 8 pixels at a
+ * time with GCC vector extensions, which compile to SSE, AVX or NEON
+ * depending on the target.
+ *
+ * Build it as a shared library and use it as a buffer pass:
+ *
+ *     shadertool --pass "fractal build/mandelbrot_kernel.so" \
+ *         --inputs fractal shaders/copy_screen.frag
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kernel_api.h"
+
+#ifndef MAX_ITERATIONS
+#define MAX_ITERATIONS 1000
+#endif
+
+#define LANES 8 /**< Pixels computed together. */
+
+typedef float vfloat __attribute__((vector_size(LANES * sizeof(float))));
+typedef int32_t vint __attribute__((vector_size(LANES * sizeof(int32_t))));
+
+const int shadertool_kernel_version = SHADERTOOL_KERNEL_VERSION;
+
+/**
+ * @brief Check whether any lane of a mask is set.
+ *
+ * @param mask The mask, with lanes of 0 or -1.
+ * @return `true` if a lane is set.
+ */
+static int any(const vint *mask) {
+  int32_t lanes[LANES];
+  memcpy(lanes, mask, sizeof(lanes));
+  int32_t result = 0;
+  for (int i = 0; i < LANES; ++i) {
+    result |= lanes[i];
+  }
+  return result != 0;
+}
+
+/**
+ * @brief MATLAB jet colormap, as in shaders/colormap.glsl.
+ *
+ * @param x The value to map, between 0 and 1.
+ * @param rgba The colour, written as 8-bit RGBA.
+ */
+static void colormap(float x, unsigned char *rgba) {
+  float r = x < 0.7f ? 4.0f * x - 1.5f : -4.0f * x + 4.5f;
+  float g = x < 0.5f ? 4.0f * x - 0.5f : -4.0f * x + 3.5f;
+  float b = x < 0.3f ? 4.0f * x + 0.5f : -4.0f * x + 2.5f;
+  float channels[3] = {r, g, b};
+  for (int i = 0; i < 3; ++i) {
+    float c = channels[i] < 0.0f ? 0.0f : channels[i];
+    c = c > 1.0f ? 1.0f : c;
+    rgba[i] = (unsigned char)(c * 255.0f + 0.5f);
+  }
+  rgba[3] = 255;
+}
+
+/**
+ * @brief Colour of a pixel from its number of iterations.
+ *
+ * @param iterations The number of iterations before escaping.
+ * @param rgba The colour, written as 8-bit RGBA.
+ */
+static void shade(int32_t iterations, unsigned char *rgba) {
+  if (iterations == MAX_ITERATIONS) {
+    rgba[0] = rgba[1] = rgba[2] = 0;
+    rgba[3] = 255;
+    return;
+  }
+  /* smoothstep(0.0, 23.0, i) */
+  float t = iterations / 23.0f;
+  t = t > 1.0f ? 1.0f : t;
+  colormap(t * t * (3.0f - 2.0f * t), rgba);
+}
+
+void shadertool_kernel(const struct shadertool_frame *frame,
+                       const struct shadertool_tile *tile) {
+  const vfloat lane = {0, 1, 2, 3, 4, 5, 6, 7};
+  for (int row = 0; row < tile->height; ++row) {
+    unsigned char *pixels = tile->pixels + row * tile->stride;
+    float y = tile->y + row + 0.5f;
+    vfloat cy = (vfloat){0} + (y / frame->resolution[1] * 2.6f - 1.3f);
+    for (int column = 0; column < tile->width; column += LANES) {
+      vfloat x = lane + (tile->x + column + 0.5f);
+      vfloat cx = x / frame->resolution[0] * 2.6f - 2.0f;
+
+      vfloat zx = {0}, zy = {0};
+      vint iterations = {0};
+      vint active = ~(vint){0};
+      for (int i = 0; i < MAX_ITERATIONS; ++i) {
+        vfloat x2 = zx * zx, y2 = zy * zy;
+        active &= x2 + y2 <= 4.0f;
+        if (!any(&active)) {
+          break;
+        }
+        iterations -= active;
+        zy = 2.0f * zx * zy + cy;
+        zx = x2 - y2 + cx;
+      }
+
+      int32_t counts[LANES];
+      memcpy(counts, &iterations, sizeof(counts));
+      int lanes = tile->width - column < LANES ? tile->width - column : LANES;
+      for (int i = 0; i < lanes; ++i) {
+        shade(counts[i], pixels + (column + i) * 4);
+      }
+    }
+  }
+}
@@ -0,0 +1,8 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D u_texture;
+
+void main() {
+  FragColor = texelFetch(u_texture, ivec2(gl_FragCoord), 0);
+}
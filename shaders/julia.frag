@@ -7,38 +7,12 @@ uniform uint u_frame;
 uniform vec2 u_resolution;
 uniform vec2 u_mouse;
 
-// Source:
-// https://github.com/kbinani/colormap-shaders/blob/master/shaders/glsl/MATLAB_jet.frag
-float colormap_red(float x) {
-  if (x < 0.7) {
-    return 4.0 * x - 1.5;
-  } else {
-    return -4.0 * x + 4.5;
-  }
-}
-
-float colormap_green(float x) {
-  if (x < 0.5) {
-    return 4.0 * x - 0.5;
-  } else {
-    return -4.0 * x + 3.5;
-  }
-}
-
-float colormap_blue(float x) {
-  if (x < 0.3) {
-    return 4.0 * x + 0.5;
-  } else {
-    return -4.0 * x + 2.5;
-  }
-}
+#include "colormap.glsl"
 
-vec4 colormap(float x) {
-  float r = clamp(colormap_red(x), 0.0, 1.0);
-  float g = clamp(colormap_green(x), 0.0, 1.0);
-  float b = clamp(colormap_blue(x), 0.0, 1.0);
-  return vec4(r, g, b, 1.0);
-}
+// Iteration limit, override with -D MAX_ITERATIONS=N
+#ifndef MAX_ITERATIONS
+#define MAX_ITERATIONS 1000
+#endif
 
 // Julia
 vec2 f(vec2 z, vec2 c) {
@@ -57,11 +31,11 @@ void main() {
 
   vec2 z = gl_FragCoord.xy / u_resolution.xy * 3.0 - vec2(1.5, 1.5);
   int i = 0;
-  while (length(z) <= 2 && i < 1000) {
+  while (length(z) <= 2 && i < MAX_ITERATIONS) {
     z = f(z, c);
     i++;
   }
-  if (i == 1000) {
+  if (i == MAX_ITERATIONS) {
     fragColor = vec4(vec3(0.0), 1.0);
   } else {
     fragColor = colormap(smoothstep(0.0, 20.0, i));
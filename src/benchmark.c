@@ -0,0 +1,219 @@
+#include <GL/glew.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "log.h"
+#include "profile.h"
+#include "timing.h"
+
+/**
+ * @brief Parse the name of a benchmark report format.
+ *
+ * @param name One of "human", "json", or "csv".
+ * @return The report format, or `BENCHMARK_NONE` if the name is
+ * unknown.
+ */
+enum benchmark_format benchmark_format_from_string(const char *name) {
+  if (!strcmp(name, "human") || !strcmp(name, "text")) {
+    return BENCHMARK_HUMAN;
+  } else if (!strcmp(name, "json")) {
+    return BENCHMARK_JSON;
+  } else if (!strcmp(name, "csv")) {
+    return BENCHMARK_CSV;
+  }
+  return BENCHMARK_NONE;
+}
+
+/**
+ * @brief Start measuring, at the end of the warm-up.
+ *
+ * Waits for the warm-up frames to complete on the GPU, then forgets
+ * all the timings recorded so far.
+ *
+ * @param benchmark The benchmark.
+ * @param state The renderer state.
+ */
+void benchmark_start(struct benchmark_state *benchmark,
+                     struct renderer_state *state) {
+  glFinish();
+  struct render_graph *graph = &state->graph;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    struct gpu_timer *timer = &graph->passes[graph->order[k]].shader.timer;
+    gpu_timer_collect(timer);
+    timing_stats_reset(&timer->stats);
+  }
+  timing_stats_reset(&state->cpu_frame);
+  profile_reset(&state->profile);
+  log_debug("Warm-up done after %zu frames", benchmark->warmup);
+  benchmark->start = timing_now();
+}
+
+/**
+ * @brief Stop measuring, once all the frames are submitted.
+ *
+ * Waits for the GPU to finish rendering, so that the elapsed time
+ * covers the whole work of the measured frames.
+ *
+ * @param benchmark The benchmark.
+ */
+void benchmark_stop(struct benchmark_state *benchmark) {
+  glFinish();
+  benchmark->elapsed = timing_now() - benchmark->start;
+}
+
+/**
+ * @brief Write a string as a JSON string literal.
+ *
+ * @param stream The output stream.
+ * @param string The string to write, or NULL for `null`.
+ */
+static void write_json_string(FILE *stream, const char *string) {
+  if (string == NULL) {
+    fputs("null", stream);
+    return;
+  }
+  fputc('"', stream);
+  for (const char *c = string; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(stream, "\\%c", *c);
+    } else if ((unsigned char)*c < 0x20) {
+      fprintf(stream, "\\u%04x", *c);
+    } else {
+      fputc(*c, stream);
+    }
+  }
+  fputc('"', stream);
+}
+
+/**
+ * @brief Write a string as a CSV field, quoted if needed.
+ *
+ * @param stream The output stream.
+ * @param string The string to write, or NULL for an empty field.
+ */
+static void write_csv_field(FILE *stream, const char *string) {
+  if (string == NULL) {
+    return;
+  }
+  if (strpbrk(string, ",\"\n") == NULL) {
+    fputs(string, stream);
+    return;
+  }
+  fputc('"', stream);
+  for (const char *c = string; *c; ++c) {
+    if (*c == '"') {
+      fputc('"', stream);
+    }
+    fputc(*c, stream);
+  }
+  fputc('"', stream);
+}
+
+/**
+ * @brief Write the results of the benchmark.
+ *
+ * The mean frame time is the elapsed time divided by the number of
+ * measured frames, which includes the GPU work. The percentiles are
+ * computed over the intervals between the starts of consecutive
+ * frames. The GPU time is reported for each active pass, in execution
+ * order.
+ *
+ * @param benchmark The finished benchmark.
+ * @param state The renderer state.
+ * @param stream The output stream.
+ * @return 0 on success, 1 on failure.
+ */
+int benchmark_report(const struct benchmark_state *benchmark,
+                     const struct renderer_state *state, FILE *stream) {
+  int viewport[4] = {0};
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  struct frame_time_summary summary;
+  profile_summarize(&state->profile, &summary);
+  double mean = benchmark->frames ? benchmark->elapsed / benchmark->frames : 0;
+  double fps = mean > 0 ? 1e3 / mean : 0;
+  double cpu = timing_stats_mean(&state->cpu_frame);
+  const struct render_graph *graph = &state->graph;
+  const struct render_pass *screen =
+      &graph->passes[graph->order[graph->num_active - 1]];
+  double gpu = 0;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    const struct render_pass *pass = &graph->passes[graph->order[k]];
+    gpu += timing_stats_mean(&pass->shader.timer.stats);
+  }
+
+  switch (benchmark->format) {
+  case BENCHMARK_HUMAN:
+    fprintf(stream, "shader:      %s\n", screen->filename);
+    fprintf(stream, "resolution:  %dx%d\n", viewport[2], viewport[3]);
+    fprintf(stream, "frames:      %zu (after %zu warm-up frames)\n",
+            benchmark->frames, benchmark->warmup);
+    fprintf(stream, "mean:        %.3f ms/frame (%.1f fps)\n", mean, fps);
+    fprintf(stream,
+            "frame time:  min %.3f, p50 %.3f, p95 %.3f, p99 %.3f, "
+            "max %.3f ms\n",
+            summary.min, summary.p50, summary.p95, summary.p99, summary.max);
+    fprintf(stream, "cpu:         %.3f ms/frame\n", cpu);
+    fprintf(stream, "gpu:         %.3f ms/frame\n", gpu);
+    for (size_t k = 0; k < graph->num_active; ++k) {
+      const struct render_pass *pass = &graph->passes[graph->order[k]];
+      fprintf(stream, "  %-10s %.3f ms/frame (%s)\n", pass->name,
+              timing_stats_mean(&pass->shader.timer.stats), pass->filename);
+    }
+    break;
+
+  case BENCHMARK_JSON:
+    fputs("{\"shader\": ", stream);
+    write_json_string(stream, screen->filename);
+    fprintf(stream,
+            ", \"width\": %d, \"height\": %d, \"warmup\": %zu, "
+            "\"frames\": %zu, \"elapsed_ms\": %.3f, \"mean_ms\": %.3f, "
+            "\"fps\": %.3f, \"min_ms\": %.3f, \"p50_ms\": %.3f, "
+            "\"p95_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+            "\"cpu_ms\": %.3f, \"gpu_ms\": %.3f, \"passes\": [",
+            viewport[2], viewport[3], benchmark->warmup, benchmark->frames,
+            benchmark->elapsed, mean, fps, summary.min, summary.p50,
+            summary.p95, summary.p99, summary.max, cpu, gpu);
+    for (size_t k = 0; k < graph->num_active; ++k) {
+      const struct render_pass *pass = &graph->passes[graph->order[k]];
+      fputs(k > 0 ? ", {\"name\": " : "{\"name\": ", stream);
+      write_json_string(stream, pass->name);
+      fputs(", \"file\": ", stream);
+      write_json_string(stream, pass->filename);
+      fprintf(stream, ", \"gpu_ms\": %.3f}",
+              timing_stats_mean(&pass->shader.timer.stats));
+    }
+    fputs("]}\n", stream);
+    break;
+
+  case BENCHMARK_CSV:
+    fputs("shader,width,height,warmup,frames,elapsed_ms,mean_ms,fps,"
+          "min_ms,p50_ms,p95_ms,p99_ms,max_ms,cpu_ms,gpu_ms,passes\n",
+          stream);
+    write_csv_field(stream, screen->filename);
+    fprintf(stream,
+            ",%d,%d,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+            "%.3f,",
+            viewport[2], viewport[3], benchmark->warmup, benchmark->frames,
+            benchmark->elapsed, mean, fps, summary.min, summary.p50,
+            summary.p95, summary.p99, summary.max, cpu, gpu);
+    /* GPU time of each pass, as name=ms separated by semicolons */
+    for (size_t k = 0; k < graph->num_active; ++k) {
+      const struct render_pass *pass = &graph->passes[graph->order[k]];
+      fprintf(stream, "%s%s=%.3f", k > 0 ? ";" : "", pass->name,
+              timing_stats_mean(&pass->shader.timer.stats));
+    }
+    fputc('\n', stream);
+    break;
+
+  default:
+    log_error("Unknown benchmark report format");
+    return 1;
+  }
+
+  if (fflush(stream)) {
+    log_error("Could not write the benchmark report");
+    return 1;
+  }
+  return 0;
+}
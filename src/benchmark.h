@@ -0,0 +1,40 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "renderer.h"
+
+#define BENCHMARK_WARMUP 30 /**< Frames rendered before measuring. */
+
+/**
+ * Output format of the benchmark report.
+ */
+enum benchmark_format {
+  BENCHMARK_NONE,  /**< Unknown format. */
+  BENCHMARK_HUMAN, /**< Human-readable summary. */
+  BENCHMARK_JSON,  /**< JSON object. */
+  BENCHMARK_CSV,   /**< CSV header and row. */
+};
+
+/**
+ * State of a benchmark run.
+ */
+struct benchmark_state {
+  size_t frames;                /**< Number of measured frames. */
+  size_t warmup;                /**< Number of frames before measuring. */
+  enum benchmark_format format; /**< Output format of the report. */
+  double start;                 /**< Start of the measurements, in ms. */
+  double elapsed;               /**< Duration of the measurements, in ms. */
+};
+
+enum benchmark_format benchmark_format_from_string(const char *name);
+void benchmark_start(struct benchmark_state *benchmark,
+                     struct renderer_state *state);
+void benchmark_stop(struct benchmark_state *benchmark);
+int benchmark_report(const struct benchmark_state *benchmark,
+                     const struct renderer_state *state, FILE *stream);
+
+#endif /* BENCHMARK_H */
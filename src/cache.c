@@ -0,0 +1,584 @@
+#include <GL/glew.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "log.h"
+
+#define PROGRAM_CACHE_MAGIC 0x42505453 /**< "STPB" in little endian. */
+#define PROGRAM_CACHE_VERSION 1
+#define TEXTURE_CACHE_MAGIC 0x58545453 /**< "STTX" in little endian. */
+#define TEXTURE_CACHE_VERSION 1
+#define TEXTURE_CACHE_OFFSET 4096 /**< Offset of the pixels in the files,
+                                     so that they start on a page. */
+#define TEXTURE_CACHE_NAME_SIZE 32 /**< Size of the file names. */
+
+/**
+ * Header of a program binary file in the cache.
+ */
+struct program_cache_header {
+  uint32_t magic;   /**< PROGRAM_CACHE_MAGIC */
+  uint32_t version; /**< PROGRAM_CACHE_VERSION */
+  uint32_t format;  /**< Binary format returned by the driver. */
+  uint32_t length;  /**< Length of the binary in bytes. */
+};
+
+/**
+ * Header of a decoded image file in the cache, followed by the pixels
+ * at TEXTURE_CACHE_OFFSET.
+ */
+struct texture_cache_header {
+  uint32_t magic;   /**< TEXTURE_CACHE_MAGIC */
+  uint32_t version; /**< TEXTURE_CACHE_VERSION */
+  uint64_t key;     /**< Cache key, also in the file name. */
+  uint32_t width;   /**< Width of the image. */
+  uint32_t height;  /**< Height of the image. */
+};
+
+/**
+ * File of the decoded image cache, considered for eviction.
+ */
+struct texture_cache_file {
+  char name[TEXTURE_CACHE_NAME_SIZE]; /**< File name. */
+  struct timespec used; /**< Last time the file was written or loaded. */
+  size_t size;          /**< Size of the file. */
+};
+
+/** Directory of the program binary cache, empty if disabled. */
+static char program_cache_dir[PATH_MAX];
+/** Hash of the driver identification strings. */
+static uint64_t driver_hash;
+/** Directory of the decoded image cache, empty if disabled. */
+static char texture_cache_dir[PATH_MAX];
+/** Size limit of the decoded image cache, in bytes. */
+static size_t texture_cache_limit;
+/** Serializes the evictions of concurrent decoder threads. */
+static pthread_mutex_t texture_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Update a 64-bit FNV-1a hash with a block of bytes.
+ *
+ * @param hash The current hash, or `HASH_SEED` to start a new one.
+ * @param data The bytes to hash.
+ * @param size The number of bytes.
+ * @return The updated hash.
+ */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/**
+ * @brief Update a hash with a string, including its terminating null
+ * byte so that consecutive strings cannot be confused.
+ *
+ * @param hash The current hash.
+ * @param string The string to hash, `NULL` is hashed as an empty
+ * string.
+ * @return The updated hash.
+ */
+uint64_t hash_string(uint64_t hash, const char *string) {
+  if (string == NULL) {
+    string = "";
+  }
+  return hash_bytes(hash, string, strlen(string) + 1);
+}
+
+/**
+ * @brief Get the default cache directory of ShaderTool, following
+ * the XDG base directory specification.
+ *
+ * @param dir The buffer where the directory is written.
+ * @param size The size of the buffer.
+ * @return 0 on success, 1 if neither `XDG_CACHE_HOME` nor `HOME` is
+ * set.
+ */
+int default_cache_dir(char *dir, size_t size) {
+  const char *xdg_cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg_cache && xdg_cache[0]) {
+    snprintf(dir, size, "%s/shadertool", xdg_cache);
+  } else if (home && home[0]) {
+    snprintf(dir, size, "%s/.cache/shadertool", home);
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Create a directory and its missing parents, like `mkdir -p`.
+ *
+ * @param path The directory to create.
+ * @return 0 on success, 1 on failure.
+ */
+int make_directories(const char *path) {
+  char buf[PATH_MAX];
+  if (snprintf(buf, sizeof(buf), "%s", path) >= (int)sizeof(buf)) {
+    return 1;
+  }
+  for (char *c = buf + 1; *c; ++c) {
+    if (*c == '/') {
+      *c = '\0';
+      if (mkdir(buf, 0755) == -1 && errno != EEXIST) {
+        return 1;
+      }
+      *c = '/';
+    }
+  }
+  if (mkdir(buf, 0755) == -1 && errno != EEXIST) {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Enable the on-disk cache of linked program binaries.
+ *
+ * Must be called with a current OpenGL context, since the driver
+ * identification is part of the cache keys.
+ *
+ * @param dir The cache directory, or `NULL` to disable the cache.
+ * @return 0 on success, 1 if the cache is disabled.
+ */
+int program_cache_init(const char *dir) {
+  program_cache_dir[0] = '\0';
+  driver_hash = HASH_SEED;
+  driver_hash = hash_string(driver_hash, (const char *)glGetString(GL_VENDOR));
+  driver_hash =
+      hash_string(driver_hash, (const char *)glGetString(GL_RENDERER));
+  driver_hash =
+      hash_string(driver_hash, (const char *)glGetString(GL_VERSION));
+
+  if (dir == NULL) {
+    return 1;
+  }
+  int num_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  if (num_formats < 1) {
+    log_debug("[cache] The driver does not support program binaries");
+    return 1;
+  }
+  char programs_dir[PATH_MAX];
+  snprintf(programs_dir, sizeof(programs_dir), "%s/programs", dir);
+  if (make_directories(programs_dir)) {
+    log_warn("[cache] Cannot create the cache directory %s", programs_dir);
+    return 1;
+  }
+  snprintf(program_cache_dir, sizeof(program_cache_dir), "%s", programs_dir);
+  log_debug("[cache] Program binaries cached in %s", program_cache_dir);
+  return 0;
+}
+
+/**
+ * @brief Compute the cache key of a program from the complete
+ * sources of its shaders and the driver identification.
+ *
+ * @param sources The sources of the shaders, in a fixed order.
+ * @param count The number of sources.
+ * @return The cache key.
+ */
+uint64_t program_cache_key(const char *const *sources, size_t count) {
+  uint64_t hash = driver_hash;
+  for (size_t i = 0; i < count; ++i) {
+    hash = hash_string(hash, sources[i]);
+  }
+  return hash;
+}
+
+/**
+ * @brief Get the path of the cache file of a key.
+ *
+ * @param key The cache key.
+ * @param path The buffer where the path is written.
+ * @param size The size of the buffer.
+ * @return 0 on success, 1 if the path is too long.
+ */
+static int program_cache_path(uint64_t key, char *path, size_t size) {
+  int length = snprintf(path, size, "%s/%016llx.bin", program_cache_dir,
+                        (unsigned long long)key);
+  return length < 0 || (size_t)length >= size;
+}
+
+/**
+ * @brief Load a program binary from the cache.
+ *
+ * @param key The cache key of the program.
+ * @param program The program object receiving the binary.
+ * @return `true` if the binary was found and accepted by the driver.
+ */
+bool program_cache_load(uint64_t key, unsigned int program) {
+  if (!program_cache_dir[0]) {
+    return false;
+  }
+  char path[PATH_MAX];
+  if (program_cache_path(key, path, sizeof(path))) {
+    return false;
+  }
+  FILE *fd = fopen(path, "rb");
+  if (fd == NULL) {
+    return false;
+  }
+
+  struct program_cache_header header = {0};
+  void *binary = NULL;
+  bool loaded = false;
+  if (fread(&header, sizeof(header), 1, fd) == 1 &&
+      header.magic == PROGRAM_CACHE_MAGIC &&
+      header.version == PROGRAM_CACHE_VERSION && header.length > 0 &&
+      (binary = malloc(header.length)) != NULL &&
+      fread(binary, 1, header.length, fd) == header.length) {
+    glProgramBinary(program, header.format, binary, header.length);
+    int success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    loaded = success;
+  }
+  free(binary);
+  fclose(fd);
+
+  if (loaded) {
+    log_debug("[cache] Loaded program binary %016llx",
+              (unsigned long long)key);
+  } else {
+    /* Stale or corrupted entry, it will be replaced after the link */
+    log_debug("[cache] Rejected program binary %016llx",
+              (unsigned long long)key);
+  }
+  return loaded;
+}
+
+/**
+ * @brief Write the binary of a linked program to the cache.
+ *
+ * The binary is written to a temporary file and renamed, so that
+ * concurrent instances never read a partial file.
+ *
+ * @param key The cache key of the program.
+ * @param program The linked program.
+ */
+void program_cache_store(uint64_t key, unsigned int program) {
+  if (!program_cache_dir[0]) {
+    return;
+  }
+  int length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  void *binary = malloc(length);
+  if (binary == NULL) {
+    return;
+  }
+  struct program_cache_header header = {
+      .magic = PROGRAM_CACHE_MAGIC,
+      .version = PROGRAM_CACHE_VERSION,
+  };
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary);
+  header.format = format;
+  header.length = length;
+
+  char path[PATH_MAX], tmp_path[PATH_MAX + 16];
+  if (program_cache_path(key, path, sizeof(path))) {
+    free(binary);
+    return;
+  }
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+  FILE *fd = fopen(tmp_path, "wb");
+  bool written = fd && length > 0 &&
+                 fwrite(&header, sizeof(header), 1, fd) == 1 &&
+                 fwrite(binary, 1, length, fd) == (size_t)length;
+  if (fd && fclose(fd) != 0) {
+    written = false;
+  }
+  if (written && rename(tmp_path, path) == 0) {
+    log_debug("[cache] Stored program binary %016llx (%d bytes)",
+              (unsigned long long)key, length);
+  } else {
+    log_warn("[cache] Failed to store program binary in %s", path);
+    unlink(tmp_path);
+  }
+  free(binary);
+}
+
+/**
+ * @brief Compare the last use of two cache files, for qsort().
+ *
+ * @param a The first file.
+ * @param b The second file.
+ * @return A negative value if the first file was used earlier.
+ */
+static int compare_texture_cache_files(const void *a, const void *b) {
+  const struct timespec *ta = &((const struct texture_cache_file *)a)->used;
+  const struct timespec *tb = &((const struct texture_cache_file *)b)->used;
+  if (ta->tv_sec != tb->tv_sec) {
+    return ta->tv_sec < tb->tv_sec ? -1 : 1;
+  }
+  return (ta->tv_nsec > tb->tv_nsec) - (ta->tv_nsec < tb->tv_nsec);
+}
+
+/**
+ * @brief Remove the least recently used decoded images until the cache
+ * fits in its size limit.
+ *
+ * Entries of images that changed are never loaded again, so they are
+ * the first to go.
+ */
+static void texture_cache_evict(void) {
+  pthread_mutex_lock(&texture_cache_lock);
+  DIR *dir = opendir(texture_cache_dir);
+  if (dir == NULL) {
+    pthread_mutex_unlock(&texture_cache_lock);
+    return;
+  }
+  struct texture_cache_file *files = NULL;
+  size_t count = 0, capacity = 0, total = 0;
+  struct dirent *entry = NULL;
+  while ((entry = readdir(dir))) {
+    size_t length = strlen(entry->d_name);
+    /* Skip the temporary files being written */
+    if (length < 4 || length >= TEXTURE_CACHE_NAME_SIZE ||
+        strcmp(entry->d_name + length - 4, ".tex") != 0) {
+      continue;
+    }
+    struct stat st;
+    if (fstatat(dirfd(dir), entry->d_name, &st, 0) == -1) {
+      continue;
+    }
+    if (count == capacity) {
+      size_t new_capacity = capacity ? 2 * capacity : 64;
+      struct texture_cache_file *new_files =
+          realloc(files, new_capacity * sizeof(*files));
+      if (new_files == NULL) {
+        break;
+      }
+      files = new_files;
+      capacity = new_capacity;
+    }
+    snprintf(files[count].name, TEXTURE_CACHE_NAME_SIZE, "%s", entry->d_name);
+    files[count].used = st.st_mtim;
+    files[count].size = st.st_size;
+    total += st.st_size;
+    count++;
+  }
+  closedir(dir);
+
+  if (total > texture_cache_limit) {
+    qsort(files, count, sizeof(*files), compare_texture_cache_files);
+  }
+  for (size_t i = 0; i < count && total > texture_cache_limit; ++i) {
+    char path[PATH_MAX + TEXTURE_CACHE_NAME_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", texture_cache_dir, files[i].name);
+    /* Mapped entries stay readable until they are unmapped */
+    if (unlink(path) == 0 || errno == ENOENT) {
+      log_debug("[cache] Evicted decoded image %s", files[i].name);
+      total -= files[i].size;
+    }
+  }
+  free(files);
+  pthread_mutex_unlock(&texture_cache_lock);
+}
+
+/**
+ * @brief Enable the on-disk cache of decoded images.
+ *
+ * Must be called before the image decoder threads start.
+ *
+ * @param dir The cache directory, or `NULL` to disable the cache.
+ * @param limit The size limit of the cache in bytes, 0 to disable it.
+ * @return 0 on success, 1 if the cache is disabled.
+ */
+int texture_cache_init(const char *dir, size_t limit) {
+  texture_cache_dir[0] = '\0';
+  texture_cache_limit = limit;
+  if (dir == NULL || limit == 0) {
+    return 1;
+  }
+  char textures_dir[PATH_MAX];
+  snprintf(textures_dir, sizeof(textures_dir), "%s/textures", dir);
+  if (make_directories(textures_dir)) {
+    log_warn("[cache] Cannot create the cache directory %s", textures_dir);
+    return 1;
+  }
+  snprintf(texture_cache_dir, sizeof(texture_cache_dir), "%s", textures_dir);
+  log_debug("[cache] Decoded images cached in %s", texture_cache_dir);
+  /* The limit may be lower than in the previous run */
+  texture_cache_evict();
+  return 0;
+}
+
+/**
+ * @brief Compute the cache key of an image from its absolute path, its
+ * modification time and its size.
+ *
+ * @param filename The image file.
+ * @return The cache key, or 0 if the cache is disabled or the file
+ * cannot be read.
+ */
+uint64_t texture_cache_key(const char *filename) {
+  if (!texture_cache_dir[0]) {
+    return 0;
+  }
+  char path[PATH_MAX];
+  struct stat st;
+  if (realpath(filename, path) == NULL || stat(path, &st) == -1) {
+    return 0;
+  }
+  int64_t stamp[3] = {st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_size};
+  uint64_t hash = hash_string(HASH_SEED, path);
+  hash = hash_bytes(hash, stamp, sizeof(stamp));
+  return hash ? hash : 1;
+}
+
+/**
+ * @brief Get the path of the decoded image file of a key.
+ *
+ * @param key The cache key.
+ * @param path The buffer where the path is written.
+ * @param size The size of the buffer.
+ * @return 0 on success, 1 if the path is too long.
+ */
+static int texture_cache_path(uint64_t key, char *path, size_t size) {
+  int length = snprintf(path, size, "%s/%016llx.tex", texture_cache_dir,
+                        (unsigned long long)key);
+  return length < 0 || (size_t)length >= size;
+}
+
+/**
+ * @brief Map a decoded image from the cache.
+ *
+ * The whole file is read into the page cache by the calling thread,
+ * so that uploading the pixels straight from the mapping never waits
+ * for the disk. The entry is marked as recently used.
+ *
+ * @param key The cache key of the image.
+ * @param entry The mapped image, to release with texture_cache_release().
+ * @return `true` if the image was found.
+ */
+bool texture_cache_load(uint64_t key, struct texture_cache_entry *entry) {
+  memset(entry, 0, sizeof(*entry));
+  char path[PATH_MAX];
+  if (!key || texture_cache_path(key, path, sizeof(path))) {
+    return false;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > TEXTURE_CACHE_OFFSET) {
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                   fd, 0);
+  }
+  if (mapping != MAP_FAILED) {
+    futimens(fd, NULL);
+  }
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  const struct texture_cache_header *header = mapping;
+  size_t data_size = st.st_size - TEXTURE_CACHE_OFFSET;
+  if (header->magic != TEXTURE_CACHE_MAGIC ||
+      header->version != TEXTURE_CACHE_VERSION || header->key != key ||
+      header->width == 0 || header->height == 0 ||
+      header->width > INT_MAX / 4 || header->height > INT_MAX ||
+      (uint64_t)header->width * header->height * 4 > data_size) {
+    /* Corrupted entry, it will be replaced after the decode */
+    log_debug("[cache] Rejected decoded image %016llx",
+              (unsigned long long)key);
+    munmap(mapping, st.st_size);
+    return false;
+  }
+  entry->mapping = mapping;
+  entry->size = st.st_size;
+  entry->pixels = (const unsigned char *)mapping + TEXTURE_CACHE_OFFSET;
+  entry->width = header->width;
+  entry->height = header->height;
+  log_debug("[cache] Loaded decoded image %016llx", (unsigned long long)key);
+  return true;
+}
+
+/**
+ * @brief Write a decoded image to the cache, and evict the least
+ * recently used images if the cache exceeds its size limit.
+ *
+ * The image is written to a temporary file and renamed, so that other
+ * threads and instances never map a partial file.
+ *
+ * @param key The cache key of the image.
+ * @param pixels The BGRA pixels, bottom row first.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ */
+void texture_cache_store(uint64_t key, const unsigned char *pixels, int width,
+                         int height) {
+  size_t data_size = (size_t)width * height * 4;
+  char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+  if (!key || !texture_cache_dir[0] ||
+      TEXTURE_CACHE_OFFSET + data_size > texture_cache_limit ||
+      texture_cache_path(key, path, sizeof(path))) {
+    return;
+  }
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+  int tmp_fd = mkstemp(tmp_path);
+  if (tmp_fd == -1) {
+    log_warn("[cache] Failed to store decoded image in %s", path);
+    return;
+  }
+  /* mkstemp() creates files readable by their owner only */
+  fchmod(tmp_fd, 0644);
+  unsigned char block[TEXTURE_CACHE_OFFSET] = {0};
+  struct texture_cache_header header = {
+      .magic = TEXTURE_CACHE_MAGIC,
+      .version = TEXTURE_CACHE_VERSION,
+      .key = key,
+      .width = width,
+      .height = height,
+  };
+  memcpy(block, &header, sizeof(header));
+
+  FILE *fd = fdopen(tmp_fd, "wb");
+  bool written = fd && fwrite(block, sizeof(block), 1, fd) == 1 &&
+                 fwrite(pixels, 1, data_size, fd) == data_size;
+  if (fd == NULL) {
+    close(tmp_fd);
+  } else if (fclose(fd) != 0) {
+    written = false;
+  }
+  if (written && rename(tmp_path, path) == 0) {
+    log_debug("[cache] Stored decoded image %016llx (%zu bytes)",
+              (unsigned long long)key, TEXTURE_CACHE_OFFSET + data_size);
+    texture_cache_evict();
+  } else {
+    log_warn("[cache] Failed to store decoded image in %s", path);
+    unlink(tmp_path);
+  }
+}
+
+/**
+ * @brief Unmap a decoded image loaded from the cache.
+ *
+ * @param entry The image, which may not have been loaded.
+ */
+void texture_cache_release(struct texture_cache_entry *entry) {
+  if (entry->mapping) {
+    munmap(entry->mapping, entry->size);
+  }
+  memset(entry, 0, sizeof(*entry));
+}
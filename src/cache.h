@@ -0,0 +1,40 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_SEED 0xcbf29ce484222325ull /**< Initial value of hashes. */
+#define TEXTURE_CACHE_SIZE 1024 /**< Default size limit of the decoded
+                                   image cache, in MiB. */
+
+/**
+ * Decoded image mapped from the cache.
+ */
+struct texture_cache_entry {
+  void *mapping;  /**< Mapping of the cache file, or NULL. */
+  size_t size;    /**< Size of the mapping. */
+  const unsigned char *pixels; /**< BGRA pixels, bottom row first. */
+  int width;      /**< Width of the image. */
+  int height;     /**< Height of the image. */
+};
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size);
+uint64_t hash_string(uint64_t hash, const char *string);
+int default_cache_dir(char *dir, size_t size);
+int make_directories(const char *path);
+
+int program_cache_init(const char *dir);
+uint64_t program_cache_key(const char *const *sources, size_t count);
+bool program_cache_load(uint64_t key, unsigned int program);
+void program_cache_store(uint64_t key, unsigned int program);
+
+int texture_cache_init(const char *dir, size_t limit);
+uint64_t texture_cache_key(const char *filename);
+bool texture_cache_load(uint64_t key, struct texture_cache_entry *entry);
+void texture_cache_store(uint64_t key, const unsigned char *pixels, int width,
+                         int height);
+void texture_cache_release(struct texture_cache_entry *entry);
+
+#endif /* CACHE_H */
@@ -0,0 +1,296 @@
+#include <FreeImage.h>
+#include <GL/glew.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "log.h"
+#include "queue.h"
+
+/**
+ * @brief Size in bytes of a row of BGR pixels read with the default
+ * pack alignment of 4 bytes.
+ *
+ * @param width The width of the image in pixels.
+ * @return The size of a row in bytes.
+ */
+size_t readback_pitch(int width) { return ((size_t)width * 3 + 3) & ~3u; }
+
+/**
+ * @brief Initialize an empty readback ring.
+ *
+ * The pixel buffers are allocated lazily, at the size of the first
+ * read that uses them.
+ *
+ * @param ring The ring to initialize.
+ */
+void readback_init(struct readback_ring *ring) {
+  memset(ring, 0, sizeof(*ring));
+  for (size_t i = 0; i < READBACK_SLOTS; ++i) {
+    glGenBuffers(1, &ring->slots[i].pbo);
+  }
+}
+
+/**
+ * @brief Map a completed pixel buffer and hand a copy of its pixels
+ * to the callback.
+ *
+ * @param slot The slot to complete.
+ * @param callback The callback receiving the pixels.
+ * @param data Data passed to the callback.
+ */
+static void readback_complete(struct readback_slot *slot,
+                              readback_callback callback, void *data) {
+  size_t pitch = readback_pitch(slot->width);
+  size_t size = pitch * slot->height;
+  struct frame_pixels *pixels = malloc(sizeof(struct frame_pixels));
+  unsigned char *copy = malloc(size);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+  void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+                                  GL_MAP_READ_BIT);
+  if (pixels == NULL || copy == NULL || mapped == NULL) {
+    log_error("Failed to read back %dx%d pixels", slot->width,
+              slot->height);
+    free(pixels);
+    free(copy);
+    free(slot->userdata);
+  } else {
+    memcpy(copy, mapped, size);
+    pixels->data = copy;
+    pixels->width = slot->width;
+    pixels->height = slot->height;
+    pixels->pitch = pitch;
+    pixels->userdata = slot->userdata;
+    callback(pixels, data);
+  }
+  if (mapped) {
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  glDeleteSync(slot->fence);
+  slot->fence = NULL;
+  slot->userdata = NULL;
+}
+
+/**
+ * @brief Start reading the current read framebuffer into the next
+ * pixel buffer of the ring.
+ *
+ * The copy is queued on the GPU and this function returns
+ * immediately. If all the pixel buffers are still pending, the oldest
+ * one is completed first, which may wait for the GPU.
+ *
+ * @param ring The readback ring.
+ * @param width The width of the area to read, from the origin.
+ * @param height The height of the area to read, from the origin.
+ * @param userdata Data attached to the pixels, owned by the ring
+ * until the callback receives it.
+ * @param callback The callback receiving the pixels of the oldest
+ * slot if it has to be completed now.
+ * @param data Data passed to the callback.
+ */
+void readback_request(struct readback_ring *ring, int width, int height,
+                      void *userdata, readback_callback callback,
+                      void *data) {
+  struct readback_slot *slot = &ring->slots[ring->next];
+  if (slot->fence) {
+    /* The ring is full, so this slot holds the oldest read */
+    log_debug("Readback ring full, waiting for the oldest read");
+    glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                     GL_TIMEOUT_IGNORED);
+    readback_complete(slot, callback, data);
+    ring->first = (ring->next + 1) % READBACK_SLOTS;
+  }
+
+  size_t size = readback_pitch(width) * height;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+  if (slot->size != size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    slot->size = size;
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot->width = width;
+  slot->height = height;
+  slot->userdata = userdata;
+  ring->next = (ring->next + 1) % READBACK_SLOTS;
+}
+
+/**
+ * @brief Complete the pending reads of the ring, oldest first.
+ *
+ * @param ring The readback ring.
+ * @param wait If `true`, wait for all the pending reads. Otherwise,
+ * stop at the first read the GPU has not finished yet.
+ * @param callback The callback receiving the pixels.
+ * @param data Data passed to the callback.
+ */
+void readback_poll(struct readback_ring *ring, bool wait,
+                   readback_callback callback, void *data) {
+  for (size_t i = 0; i < READBACK_SLOTS; ++i) {
+    struct readback_slot *slot = &ring->slots[ring->first];
+    if (!slot->fence) {
+      if (ring->first == ring->next) {
+        break;
+      }
+      ring->first = (ring->first + 1) % READBACK_SLOTS;
+      continue;
+    }
+    GLenum status =
+        glClientWaitSync(slot->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                         wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      break;
+    }
+    readback_complete(slot, callback, data);
+    ring->first = (ring->first + 1) % READBACK_SLOTS;
+  }
+}
+
+/**
+ * @brief Free the pixel buffers of the ring. Pending reads are
+ * dropped.
+ *
+ * @param ring The readback ring.
+ */
+void readback_destroy(struct readback_ring *ring) {
+  for (size_t i = 0; i < READBACK_SLOTS; ++i) {
+    struct readback_slot *slot = &ring->slots[i];
+    if (slot->fence) {
+      glDeleteSync(slot->fence);
+      free(slot->userdata);
+    }
+    glDeleteBuffers(1, &slot->pbo);
+  }
+  memset(ring, 0, sizeof(*ring));
+}
+
+/**
+ * @brief Encode screenshots to PNG files until the queue is closed.
+ *
+ * @param arg The job queue.
+ * @return `NULL`.
+ */
+static void *encoder_thread(void *arg) {
+  struct queue *jobs = arg;
+  struct frame_pixels *pixels = NULL;
+  while ((pixels = queue_pop(jobs))) {
+    const char *filename = pixels->userdata;
+    FIBITMAP *image = FreeImage_ConvertFromRawBits(
+        pixels->data, pixels->width, pixels->height, pixels->pitch, 24,
+        FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, false);
+    if (image && FreeImage_Save(FIF_PNG, image, filename, 0)) {
+      log_info("Image saved to %s", filename);
+    } else {
+      log_error("Failed to save image to %s", filename);
+    }
+    FreeImage_Unload(image);
+    free(pixels->userdata);
+    free(pixels->data);
+    free(pixels);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Hand the pixels of a completed screenshot to the encoders.
+ *
+ * @param pixels The pixels, with the file name as user data.
+ * @param data The capture state.
+ */
+static void enqueue_screenshot(struct frame_pixels *pixels, void *data) {
+  struct capture_state *capture = data;
+  if (!queue_push(&capture->jobs, pixels)) {
+    free(pixels->userdata);
+    free(pixels->data);
+    free(pixels);
+  }
+}
+
+/**
+ * @brief Initialize the readback ring and start the encoder threads.
+ *
+ * @param capture The capture state to initialize.
+ * @return 0 on success, 1 on failure.
+ */
+int capture_init(struct capture_state *capture) {
+  if (queue_init(&capture->jobs, CAPTURE_QUEUE_SIZE)) {
+    return 1;
+  }
+  readback_init(&capture->ring);
+  for (size_t i = 0; i < CAPTURE_ENCODERS; ++i) {
+    if (pthread_create(&capture->encoders[i], NULL, encoder_thread,
+                       &capture->jobs)) {
+      log_error("Failed to start screenshot encoder thread");
+      queue_close(&capture->jobs);
+      for (size_t j = 0; j < i; ++j) {
+        pthread_join(capture->encoders[j], NULL);
+      }
+      readback_destroy(&capture->ring);
+      queue_destroy(&capture->jobs);
+      return 1;
+    }
+  }
+  capture->initialized = true;
+  log_debug("Screenshot capture initialized");
+  return 0;
+}
+
+/**
+ * @brief Start capturing the current read framebuffer to a PNG file.
+ *
+ * The pixels are copied to a pixel buffer object without waiting for
+ * the GPU, then mapped by capture_poll() once the copy is done, and
+ * encoded in a background thread.
+ *
+ * @param capture The capture state.
+ * @param filename The name of the image file to write.
+ */
+void capture_request(struct capture_state *capture, const char *filename) {
+  if (!capture->initialized) {
+    log_error("Screenshot capture is not initialized");
+    return;
+  }
+  int viewport[4] = {0};
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  readback_request(&capture->ring, viewport[2], viewport[3],
+                   strdup(filename), enqueue_screenshot, capture);
+}
+
+/**
+ * @brief Send the screenshots the GPU has finished copying to the
+ * encoder threads, without waiting.
+ *
+ * @param capture The capture state.
+ */
+void capture_poll(struct capture_state *capture) {
+  if (capture->initialized) {
+    readback_poll(&capture->ring, false, enqueue_screenshot, capture);
+  }
+}
+
+/**
+ * @brief Wait for all the pending screenshots to be written, and stop
+ * the encoder threads.
+ *
+ * @param capture The capture state.
+ */
+void capture_finish(struct capture_state *capture) {
+  if (!capture->initialized) {
+    return;
+  }
+  readback_poll(&capture->ring, true, enqueue_screenshot, capture);
+  queue_close(&capture->jobs);
+  for (size_t i = 0; i < CAPTURE_ENCODERS; ++i) {
+    pthread_join(capture->encoders[i], NULL);
+  }
+  readback_destroy(&capture->ring);
+  queue_destroy(&capture->jobs);
+  capture->initialized = false;
+}
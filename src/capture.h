@@ -0,0 +1,79 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <GL/glew.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+#define READBACK_SLOTS 3    /**< Number of pixel buffers in a readback ring. */
+#define CAPTURE_ENCODERS 2  /**< Number of screenshot encoder threads. */
+#define CAPTURE_QUEUE_SIZE 16 /**< Maximum number of pending encodings. */
+
+/**
+ * Pixels read back from the GPU, in BGR order, bottom row first.
+ */
+struct frame_pixels {
+  unsigned char *data; /**< Pixel data. */
+  int width;           /**< Width in pixels. */
+  int height;          /**< Height in pixels. */
+  size_t pitch;        /**< Size of a row in bytes, including padding. */
+  void *userdata;      /**< Data attached to the readback request. */
+};
+
+/**
+ * Pixel buffer object of a readback ring, waiting for the GPU.
+ */
+struct readback_slot {
+  unsigned int pbo; /**< Pixel buffer object ID. */
+  size_t size;      /**< Allocated size of the pixel buffer. */
+  GLsync fence;     /**< Fence signaled when the copy is done, or `NULL` if
+                       the slot is free. */
+  int width;        /**< Width of the pending read. */
+  int height;       /**< Height of the pending read. */
+  void *userdata;   /**< Data attached to the pending read. */
+};
+
+/**
+ * Ring of pixel buffer objects, used to read the framebuffer back
+ * asynchronously.
+ */
+struct readback_ring {
+  struct readback_slot slots[READBACK_SLOTS]; /**< Pixel buffers. */
+  size_t next;  /**< Index of the next slot to use. */
+  size_t first; /**< Index of the oldest pending slot. */
+};
+
+/**
+ * Callback receiving the pixels of a completed readback. The callback
+ * takes ownership of the pixel data.
+ */
+typedef void (*readback_callback)(struct frame_pixels *pixels, void *data);
+
+/**
+ * State of the asynchronous screenshot capture.
+ */
+struct capture_state {
+  struct readback_ring ring; /**< Pixel buffers of pending screenshots. */
+  struct queue jobs;         /**< Screenshots waiting to be encoded. */
+  pthread_t encoders[CAPTURE_ENCODERS]; /**< Encoder threads. */
+  bool initialized; /**< The encoder threads are running. */
+};
+
+void readback_init(struct readback_ring *ring);
+void readback_request(struct readback_ring *ring, int width, int height,
+                      void *userdata, readback_callback callback,
+                      void *data);
+void readback_poll(struct readback_ring *ring, bool wait,
+                   readback_callback callback, void *data);
+void readback_destroy(struct readback_ring *ring);
+size_t readback_pitch(int width);
+
+int capture_init(struct capture_state *capture);
+void capture_request(struct capture_state *capture, const char *filename);
+void capture_poll(struct capture_state *capture);
+void capture_finish(struct capture_state *capture);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,608 @@
+#include <GL/glew.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "log.h"
+#include "timing.h"
+
+#define CONTROL_POLL_MS 100   /**< Milliseconds between checks for exit. */
+#define CONTROL_LINE_SIZE 256 /**< Maximum length of a command line. */
+#define CONTROL_REPLY_SIZE 256 /**< Maximum length of a reply. */
+
+/**
+ * Client connected to the control socket.
+ */
+struct control_client {
+  int fd; /**< Connected socket, or -1. */
+  char line[CONTROL_LINE_SIZE]; /**< Command line being received. */
+  size_t length;  /**< Length of the line so far. */
+  bool overflow;  /**< The line is too long, and is skipped. */
+};
+
+/**
+ * @brief Read the statistics last published by the render thread.
+ *
+ * Retries while the render thread is writing them, instead of making
+ * it wait.
+ *
+ * @param control The control socket.
+ * @param stats The statistics.
+ */
+static void read_stats(struct control_state *control,
+                       struct control_stats *stats) {
+  uint64_t words[CONTROL_STATS_WORDS];
+  unsigned int before = 0, after = 0;
+  do {
+    before = atomic_load_explicit(&control->sequence, memory_order_acquire);
+    for (size_t i = 0; i < CONTROL_STATS_WORDS; ++i) {
+      words[i] =
+          atomic_load_explicit(&control->stats[i], memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&control->sequence, memory_order_relaxed);
+  } while ((before & 1) || before != after);
+  memcpy(stats, words, sizeof(*stats));
+}
+
+/**
+ * @brief Check that a command has no arguments left.
+ *
+ * @param saveptr The state of strtok_r() after the last argument.
+ * @param reply The buffer where the error is written.
+ * @param size The size of the buffer.
+ * @return `true` if there are no more arguments.
+ */
+static bool no_more_arguments(char **saveptr, char *reply, size_t size) {
+  const char *word = strtok_r(NULL, " \t\r", saveptr);
+  if (word) {
+    snprintf(reply, size, "error unexpected argument '%s'", word);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Parse the arguments of a `set NAME V1 [V2 V3 V4]` command.
+ *
+ * @param command The command receiving the name and the values.
+ * @param saveptr The state of strtok_r() after the command name.
+ * @param reply The buffer where an error is written.
+ * @param size The size of the buffer.
+ * @return 0 on success, 1 on failure.
+ */
+static int parse_set(struct control_command *command, char **saveptr,
+                     char *reply, size_t size) {
+  const char *name = strtok_r(NULL, " \t\r", saveptr);
+  if (name == NULL || strlen(name) >= UNIFORM_NAME_SIZE) {
+    snprintf(reply, size, "error expected set NAME V1 [V2 V3 V4]");
+    return 1;
+  }
+  for (const char *c = name; *c; ++c) {
+    if (!isalnum((unsigned char)*c) && *c != '_') {
+      snprintf(reply, size, "error invalid uniform name '%s'", name);
+      return 1;
+    }
+  }
+  strcpy(command->name, name);
+  const char *word = NULL;
+  while ((word = strtok_r(NULL, " \t\r", saveptr))) {
+    char *end = NULL;
+    float value = strtof(word, &end);
+    if (end == word || *end || command->count == 4) {
+      snprintf(reply, size, "error invalid value '%s'", word);
+      return 1;
+    }
+    command->values[command->count++] = value;
+  }
+  if (command->count == 0) {
+    snprintf(reply, size, "error expected set NAME V1 [V2 V3 V4]");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Parse the arguments of a `reload [PASS]` command.
+ *
+ * @param control The control socket, with the names of the passes.
+ * @param command The command receiving the pass name.
+ * @param saveptr The state of strtok_r() after the command name.
+ * @param reply The buffer where an error is written.
+ * @param size The size of the buffer.
+ * @return 0 on success, 1 on failure.
+ */
+static int parse_reload(const struct control_state *control,
+                        struct control_command *command, char **saveptr,
+                        char *reply, size_t size) {
+  const char *name = strtok_r(NULL, " \t\r", saveptr);
+  if (name == NULL) {
+    return 0;
+  }
+  for (size_t i = 0; i < control->num_passes; ++i) {
+    if (!strcmp(control->pass_names[i], name)) {
+      strcpy(command->name, name);
+      return !no_more_arguments(saveptr, reply, size);
+    }
+  }
+  snprintf(reply, size, "error unknown pass '%s'", name);
+  return 1;
+}
+
+/**
+ * @brief Parse the arguments of a `step [N]` command.
+ *
+ * @param command The command receiving the number of frames.
+ * @param saveptr The state of strtok_r() after the command name.
+ * @param reply The buffer where an error is written.
+ * @param size The size of the buffer.
+ * @return 0 on success, 1 on failure.
+ */
+static int parse_step(struct control_command *command, char **saveptr,
+                      char *reply, size_t size) {
+  const char *word = strtok_r(NULL, " \t\r", saveptr);
+  command->count = 1;
+  if (word == NULL) {
+    return 0;
+  }
+  char *end = NULL;
+  long frames = strtol(word, &end, 10);
+  if (end == word || *end || frames < 1 || frames > CONTROL_MAX_STEPS) {
+    snprintf(reply, size, "error expected step [N], with N from 1 to %d",
+             CONTROL_MAX_STEPS);
+    return 1;
+  }
+  command->count = frames;
+  return !no_more_arguments(saveptr, reply, size);
+}
+
+/**
+ * @brief Run a command line received from a client.
+ *
+ * Statistics are answered right away, other commands are queued for
+ * the render loop and acknowledged once queued.
+ *
+ * @param control The control socket.
+ * @param line The command line, modified by the parser.
+ * @param reply The buffer where the reply is written.
+ * @param size The size of the buffer.
+ * @return `false` if the line is empty and has no reply.
+ */
+static bool handle_line(struct control_state *control, char *line,
+                        char *reply, size_t size) {
+  char *saveptr = NULL;
+  const char *word = strtok_r(line, " \t\r", &saveptr);
+  if (word == NULL) {
+    return false;
+  }
+
+  if (!strcmp(word, "stats")) {
+    if (no_more_arguments(&saveptr, reply, size)) {
+      struct control_stats stats;
+      read_stats(control, &stats);
+      snprintf(reply, size,
+               "ok frame=%llu time=%.3f fps=%.1f cpu_ms=%.3f gpu_ms=%.3f "
+               "scale=%.2f paused=%d",
+               (unsigned long long)stats.frame, stats.time, stats.fps,
+               stats.cpu_ms, stats.gpu_ms, stats.scale, stats.paused);
+    }
+    return true;
+  }
+
+  struct control_command command = {0};
+  int err = 0;
+  if (!strcmp(word, "set")) {
+    command.type = CONTROL_SET;
+    err = parse_set(&command, &saveptr, reply, size);
+  } else if (!strcmp(word, "reload")) {
+    command.type = CONTROL_RELOAD;
+    err = parse_reload(control, &command, &saveptr, reply, size);
+  } else if (!strcmp(word, "step")) {
+    command.type = CONTROL_STEP;
+    err = parse_step(&command, &saveptr, reply, size);
+  } else if (!strcmp(word, "capture")) {
+    command.type = CONTROL_CAPTURE;
+    err = !no_more_arguments(&saveptr, reply, size);
+  } else if (!strcmp(word, "pause")) {
+    command.type = CONTROL_PAUSE;
+    err = !no_more_arguments(&saveptr, reply, size);
+  } else if (!strcmp(word, "resume")) {
+    command.type = CONTROL_RESUME;
+    err = !no_more_arguments(&saveptr, reply, size);
+  } else if (!strcmp(word, "quit")) {
+    command.type = CONTROL_QUIT;
+    err = !no_more_arguments(&saveptr, reply, size);
+  } else {
+    snprintf(reply, size, "error unknown command '%s'", word);
+    err = 1;
+  }
+  if (err) {
+    return true;
+  }
+
+  if (!spsc_push(&control->commands, &command)) {
+    snprintf(reply, size, "error too many pending commands");
+    return true;
+  }
+  if (control->notify) {
+    control->notify();
+  }
+  snprintf(reply, size, "ok");
+  return true;
+}
+
+/**
+ * @brief Disconnect a client.
+ *
+ * @param client The client.
+ */
+static void drop_client(struct control_client *client) {
+  close(client->fd);
+  client->fd = -1;
+}
+
+/**
+ * @brief Send a reply line to a client, disconnecting it if it does
+ * not read its replies.
+ *
+ * @param client The client.
+ * @param reply The reply, without the newline.
+ */
+static void send_reply(struct control_client *client, const char *reply) {
+  char line[CONTROL_REPLY_SIZE + 1];
+  int length = snprintf(line, sizeof(line), "%s\n", reply);
+  if (send(client->fd, line, length, MSG_NOSIGNAL | MSG_DONTWAIT) !=
+      length) {
+    drop_client(client);
+  }
+}
+
+/**
+ * @brief Read the data sent by a client, and run its complete command
+ * lines.
+ *
+ * @param control The control socket.
+ * @param client The client.
+ */
+static void serve_client(struct control_state *control,
+                         struct control_client *client) {
+  char buffer[CONTROL_LINE_SIZE];
+  ssize_t n = read(client->fd, buffer, sizeof(buffer));
+  if (n <= 0) {
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      drop_client(client);
+    }
+    return;
+  }
+  for (ssize_t i = 0; i < n && client->fd != -1; ++i) {
+    if (buffer[i] != '\n') {
+      if (client->length + 1 < CONTROL_LINE_SIZE) {
+        client->line[client->length++] = buffer[i];
+      } else {
+        client->overflow = true;
+      }
+      continue;
+    }
+    char reply[CONTROL_REPLY_SIZE] = {0};
+    client->line[client->length] = '\0';
+    if (client->overflow) {
+      send_reply(client, "error line too long");
+    } else if (handle_line(control, client->line, reply, sizeof(reply))) {
+      send_reply(client, reply);
+    }
+    client->length = 0;
+    client->overflow = false;
+  }
+}
+
+/**
+ * @brief Control thread: accept clients and serve their commands until
+ * the socket is closed.
+ *
+ * @param arg The control socket.
+ * @return `NULL`.
+ */
+static void *listener_thread(void *arg) {
+  struct control_state *control = arg;
+  struct control_client clients[CONTROL_MAX_CLIENTS];
+  for (size_t i = 0; i < CONTROL_MAX_CLIENTS; ++i) {
+    clients[i].fd = -1;
+  }
+
+  while (!atomic_load(&control->stop)) {
+    struct pollfd fds[1 + CONTROL_MAX_CLIENTS] = {{0}};
+    size_t owners[1 + CONTROL_MAX_CLIENTS] = {0};
+    size_t count = 0;
+    fds[count++] = (struct pollfd){.fd = control->fd, .events = POLLIN};
+    for (size_t i = 0; i < CONTROL_MAX_CLIENTS; ++i) {
+      if (clients[i].fd != -1) {
+        owners[count] = i;
+        fds[count++] = (struct pollfd){.fd = clients[i].fd, .events = POLLIN};
+      }
+    }
+    if (poll(fds, count, CONTROL_POLL_MS) <= 0) {
+      continue;
+    }
+
+    for (size_t k = 1; k < count; ++k) {
+      if (fds[k].revents) {
+        serve_client(control, &clients[owners[k]]);
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(control->fd, NULL, NULL);
+      struct control_client *client = NULL;
+      for (size_t i = 0; i < CONTROL_MAX_CLIENTS && !client; ++i) {
+        client = clients[i].fd == -1 ? &clients[i] : NULL;
+      }
+      if (fd != -1 && client == NULL) {
+        const char *busy = "error too many clients\n";
+        send(fd, busy, strlen(busy), MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(fd);
+      } else if (fd != -1) {
+        client->fd = fd;
+        client->length = 0;
+        client->overflow = false;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < CONTROL_MAX_CLIENTS; ++i) {
+    if (clients[i].fd != -1) {
+      drop_client(&clients[i]);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Create a Unix socket listening at a path, replacing the
+ * socket left over by an instance that exited without removing it.
+ *
+ * @param path The path of the socket.
+ * @return The listening socket, or -1 on failure.
+ */
+static int listen_socket(const char *path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    log_error("Control socket path %s is too long", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    log_error("Failed to create the control socket: %s", strerror(errno));
+    return -1;
+  }
+
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      log_error("Cannot create the control socket, %s already exists", path);
+      close(fd);
+      return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+      log_error("Control socket %s is used by another instance", path);
+      close(fd);
+      return -1;
+    }
+    unlink(path);
+  }
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+      listen(fd, CONTROL_MAX_CLIENTS) == -1) {
+    log_error("Failed to listen on %s: %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Open the control socket, and start serving its clients.
+ *
+ * @param control The control socket to initialize.
+ * @param path The path of the socket.
+ * @param graph The render graph, whose passes can be reloaded.
+ * @param notify Function waking up the render loop when a command is
+ * queued, or NULL.
+ * @return 0 on success, 1 on failure.
+ */
+int control_init(struct control_state *control, const char *path,
+                 const struct render_graph *graph, void (*notify)(void)) {
+  control->running = false;
+  control->num_uniforms = 0;
+  control->last_publish = 0;
+  control->frame_interval = 0;
+  control->notify = notify;
+  atomic_init(&control->stop, false);
+  atomic_init(&control->sequence, 0);
+  for (size_t i = 0; i < CONTROL_STATS_WORDS; ++i) {
+    atomic_init(&control->stats[i], 0);
+  }
+  control->num_passes = graph->num_passes;
+  for (size_t i = 0; i < graph->num_passes; ++i) {
+    strcpy(control->pass_names[i], graph->passes[i].name);
+  }
+  snprintf(control->path, sizeof(control->path), "%s", path);
+
+  control->fd = listen_socket(path);
+  if (control->fd == -1) {
+    return 1;
+  }
+  if (spsc_init(&control->commands, CONTROL_QUEUE_SIZE,
+                sizeof(struct control_command))) {
+    close(control->fd);
+    unlink(path);
+    return 1;
+  }
+  if (pthread_create(&control->listener, NULL, listener_thread, control)) {
+    log_error("Failed to start the control thread");
+    spsc_destroy(&control->commands);
+    close(control->fd);
+    unlink(path);
+    return 1;
+  }
+  control->running = true;
+  log_info("Listening for commands on %s", path);
+  return 0;
+}
+
+/**
+ * @brief Take the next command sent through the control socket,
+ * without waiting.
+ *
+ * @param control The control socket, which may not be open.
+ * @param command The command.
+ * @return `true` if a command was pending.
+ */
+bool control_pop(struct control_state *control,
+                 struct control_command *command) {
+  return control->running && spsc_pop(&control->commands, command);
+}
+
+/**
+ * @brief Record the value of a uniform, applied to the passes from
+ * the next frame on.
+ *
+ * @param control The control socket.
+ * @param command The `set` command.
+ * @return 0 on success, 1 if too many uniforms are set.
+ */
+int control_set_uniform(struct control_state *control,
+                        const struct control_command *command) {
+  struct control_uniform *uniform = NULL;
+  for (size_t i = 0; i < control->num_uniforms && !uniform; ++i) {
+    if (!strcmp(control->uniforms[i].name, command->name)) {
+      uniform = &control->uniforms[i];
+    }
+  }
+  if (uniform == NULL) {
+    if (control->num_uniforms == CONTROL_MAX_UNIFORMS) {
+      log_warn("Cannot set %s, at most %d uniforms can be set",
+               command->name, CONTROL_MAX_UNIFORMS);
+      return 1;
+    }
+    uniform = &control->uniforms[control->num_uniforms++];
+    strcpy(uniform->name, command->name);
+  }
+  memcpy(uniform->values, command->values, sizeof(uniform->values));
+  uniform->count = command->count;
+  return 0;
+}
+
+/**
+ * @brief Set the uniforms received through the control socket in a
+ * program.
+ *
+ * Float scalars and vectors, integers and booleans are supported;
+ * missing components are zero. The program must be in use.
+ *
+ * @param control The control socket.
+ * @param cache The active uniforms of the program.
+ */
+void control_apply_uniforms(const struct control_state *control,
+                            const struct uniform_cache *cache) {
+  for (size_t i = 0; i < control->num_uniforms; ++i) {
+    const struct control_uniform *uniform = &control->uniforms[i];
+    const float *v = uniform->values;
+    for (size_t j = 0; j < cache->count; ++j) {
+      const struct uniform_info *info = &cache->uniforms[j];
+      if (strcmp(info->name, uniform->name)) {
+        continue;
+      }
+      switch (info->type) {
+      case GL_FLOAT:
+        glUniform1f(info->location, v[0]);
+        break;
+      case GL_FLOAT_VEC2:
+        glUniform2f(info->location, v[0], v[1]);
+        break;
+      case GL_FLOAT_VEC3:
+        glUniform3f(info->location, v[0], v[1], v[2]);
+        break;
+      case GL_FLOAT_VEC4:
+        glUniform4f(info->location, v[0], v[1], v[2], v[3]);
+        break;
+      case GL_INT:
+      case GL_BOOL:
+        glUniform1i(info->location, (int)v[0]);
+        break;
+      case GL_UNSIGNED_INT:
+        glUniform1ui(info->location, (unsigned int)v[0]);
+        break;
+      default:
+        break;
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Publish the statistics of the last frame, for the `stats`
+ * command.
+ *
+ * Never waits for the control thread: a reader that sees the sequence
+ * change reads the statistics again.
+ *
+ * @param control The control socket, which may not be open.
+ * @param stats The statistics, whose frame rate is computed here.
+ */
+void control_publish(struct control_state *control,
+                     const struct control_stats *stats) {
+  if (!control->running) {
+    return;
+  }
+  double now = timing_now();
+  if (control->last_publish > 0) {
+    double interval = now - control->last_publish;
+    control->frame_interval = control->frame_interval > 0
+                                  ? 0.9 * control->frame_interval +
+                                        0.1 * interval
+                                  : interval;
+  }
+  control->last_publish = now;
+
+  struct control_stats published = *stats;
+  published.fps =
+      control->frame_interval > 0 ? 1000.0 / control->frame_interval : 0;
+  uint64_t words[CONTROL_STATS_WORDS] = {0};
+  memcpy(words, &published, sizeof(published));
+
+  unsigned int sequence =
+      atomic_load_explicit(&control->sequence, memory_order_relaxed);
+  atomic_store_explicit(&control->sequence, sequence + 1,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for (size_t i = 0; i < CONTROL_STATS_WORDS; ++i) {
+    atomic_store_explicit(&control->stats[i], words[i], memory_order_relaxed);
+  }
+  atomic_store_explicit(&control->sequence, sequence + 2,
+                        memory_order_release);
+}
+
+/**
+ * @brief Stop the control thread, and remove the socket.
+ *
+ * @param control The control socket, which may not be open.
+ */
+void control_close(struct control_state *control) {
+  if (!control->running) {
+    return;
+  }
+  atomic_store(&control->stop, true);
+  pthread_join(control->listener, NULL);
+  close(control->fd);
+  unlink(control->path);
+  spsc_destroy(&control->commands);
+  control->running = false;
+}
@@ -0,0 +1,115 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "graph.h"
+#include "queue.h"
+#include "uniforms.h"
+
+#define CONTROL_QUEUE_SIZE 64  /**< Commands waiting for the render loop. */
+#define CONTROL_MAX_CLIENTS 4  /**< Clients connected at the same time. */
+#define CONTROL_MAX_UNIFORMS 32 /**< Uniforms set through the socket. */
+#define CONTROL_MAX_STEPS 1000 /**< Frames rendered by a single step. */
+
+/**
+ * Command sent through the control socket, run by the render loop.
+ */
+enum control_type {
+  CONTROL_SET,     /**< Set the value of a uniform. */
+  CONTROL_RELOAD,  /**< Reload one pass, or all of them. */
+  CONTROL_CAPTURE, /**< Save the next frame. */
+  CONTROL_PAUSE,   /**< Stop the time. */
+  CONTROL_RESUME,  /**< Start the time again. */
+  CONTROL_STEP,    /**< Render frames while paused. */
+  CONTROL_QUIT,    /**< Close the window. */
+};
+
+/**
+ * Parsed command, passed from the control thread to the render loop.
+ */
+struct control_command {
+  enum control_type type; /**< Command. */
+  char name[UNIFORM_NAME_SIZE]; /**< Uniform to set or pass to reload,
+                                   empty to reload all the passes. */
+  float values[4]; /**< Components of the uniform value. */
+  size_t count;    /**< Number of components, or of frames to step. */
+};
+
+/**
+ * Value of a uniform set through the control socket, applied to every
+ * pass that declares it.
+ */
+struct control_uniform {
+  char name[UNIFORM_NAME_SIZE]; /**< Name of the uniform. */
+  float values[4]; /**< Components of the value. */
+  size_t count;    /**< Number of components. */
+};
+
+/**
+ * Statistics of the render loop, published after every frame.
+ */
+struct control_stats {
+  uint64_t frame; /**< Frame count. */
+  double time;    /**< Time of the frame in seconds. */
+  double fps;     /**< Frames per second, smoothed. */
+  double cpu_ms;  /**< CPU time of the last frame. */
+  double gpu_ms;  /**< GPU time of the passes of the last frame. */
+  double scale;   /**< Render scale. */
+  bool paused;    /**< The time is paused. */
+};
+
+/** Number of 64-bit words holding the published statistics. */
+#define CONTROL_STATS_WORDS ((sizeof(struct control_stats) + 7) / 8)
+
+/**
+ * Unix-domain control socket, to drive the render loop from scripts.
+ *
+ * A background thread accepts the clients and parses their commands,
+ * one per line, and hands them to the render loop through a lock-free
+ * queue, so that the render thread never waits for a socket. The
+ * statistics are published by the render thread under a sequence lock,
+ * which the control thread reads without ever blocking the writer.
+ */
+struct control_state {
+  char path[PATH_MAX]; /**< Path of the socket. */
+  int fd;              /**< Listening socket. */
+  pthread_t listener;  /**< Thread serving the clients. */
+  bool running;        /**< The control thread is running. */
+  atomic_bool stop;    /**< The control thread must exit. */
+  void (*notify)(void); /**< Called by the control thread when a
+                           command is queued, to wake up the render
+                           loop, or NULL. */
+  struct spsc_queue commands; /**< Commands for the render loop. */
+  char pass_names[MAX_PASSES][PASS_NAME_SIZE]; /**< Passes that can be
+                                                  reloaded. */
+  size_t num_passes;  /**< Number of passes. */
+  _Alignas(64) atomic_uint sequence; /**< Odd while the statistics are
+                                        being written. */
+  _Atomic uint64_t stats[CONTROL_STATS_WORDS]; /**< Published
+                                                  statistics. */
+  double last_publish;   /**< Time of the last publication, in ms. */
+  double frame_interval; /**< Smoothed time between frames, in ms. */
+  struct control_uniform uniforms[CONTROL_MAX_UNIFORMS]; /**< Values set
+                                                            so far. */
+  size_t num_uniforms; /**< Number of uniforms set. */
+};
+
+int control_init(struct control_state *control, const char *path,
+                 const struct render_graph *graph, void (*notify)(void));
+bool control_pop(struct control_state *control,
+                 struct control_command *command);
+int control_set_uniform(struct control_state *control,
+                        const struct control_command *command);
+void control_apply_uniforms(const struct control_state *control,
+                            const struct uniform_cache *cache);
+void control_publish(struct control_state *control,
+                     const struct control_stats *stats);
+void control_close(struct control_state *control);
+
+#endif /* CONTROL_H */
@@ -0,0 +1,161 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+
+#define DIFF_LANES 16 /**< Channels compared together. */
+#define DIFF_CHUNK 4096 /**< Vectors accumulated before the lanes could
+                           overflow. */
+#define HEATMAP_RANGE 64.0 /**< Error shown with the hottest colour. */
+
+typedef uint8_t vbyte __attribute__((vector_size(DIFF_LANES)));
+typedef uint16_t vshort
+    __attribute__((vector_size(DIFF_LANES * sizeof(uint16_t))));
+typedef uint32_t vuint
+    __attribute__((vector_size(DIFF_LANES * sizeof(uint32_t))));
+
+/**
+ * @brief Sum the lanes of a vector.
+ *
+ * @param v The vector.
+ * @return The sum of its lanes.
+ */
+static uint64_t sum_lanes(const vuint *v) {
+  uint32_t lanes[DIFF_LANES];
+  memcpy(lanes, v, sizeof(lanes));
+  uint64_t sum = 0;
+  for (int i = 0; i < DIFF_LANES; ++i) {
+    sum += lanes[i];
+  }
+  return sum;
+}
+
+/**
+ * @brief Largest lane of a vector.
+ *
+ * @param v The vector.
+ * @return The largest of its lanes.
+ */
+static int max_lane(const vbyte *v) {
+  uint8_t lanes[DIFF_LANES];
+  memcpy(lanes, v, sizeof(lanes));
+  int max = 0;
+  for (int i = 0; i < DIFF_LANES; ++i) {
+    max = lanes[i] > max ? lanes[i] : max;
+  }
+  return max;
+}
+
+/**
+ * @brief Compare two 8-bit images, 16 channels at a time.
+ *
+ * The images may have different row padding, only the first
+ * `row_size` bytes of each row are compared. The squared differences
+ * are summed in 32-bit lanes over chunks of DIFF_CHUNK vectors, short
+ * enough that the lanes never overflow, and then added to the 64-bit
+ * totals.
+ *
+ * @param a The first image.
+ * @param a_pitch The size of a row of the first image, in bytes.
+ * @param b The second image.
+ * @param b_pitch The size of a row of the second image, in bytes.
+ * @param row_size The number of bytes to compare in each row.
+ * @param height The number of rows.
+ * @param diff The difference between the images.
+ */
+void image_diff(const unsigned char *a, size_t a_pitch,
+                const unsigned char *b, size_t b_pitch, size_t row_size,
+                int height, struct image_diff *diff) {
+  uint64_t squares = 0;
+  uint64_t differing = 0;
+  int max_error = 0;
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row_a = a + y * a_pitch;
+    const unsigned char *row_b = b + y * b_pitch;
+    size_t x = 0;
+    while (x + DIFF_LANES <= row_size) {
+      vbyte max = {0};
+      vuint sum = {0}, count = {0};
+      for (size_t n = 0; n < DIFF_CHUNK && x + DIFF_LANES <= row_size;
+           ++n, x += DIFF_LANES) {
+        vbyte va, vb;
+        memcpy(&va, row_a + x, sizeof(va));
+        memcpy(&vb, row_b + x, sizeof(vb));
+        /* |a - b| without widening, from the mask of a > b */
+        vbyte greater = (vbyte)(va > vb);
+        vbyte d = ((va - vb) & greater) | ((vb - va) & ~greater);
+        vbyte larger = (vbyte)(d > max);
+        max = (d & larger) | (max & ~larger);
+        vshort wide = __builtin_convertvector(d, vshort);
+        sum += __builtin_convertvector(wide * wide, vuint);
+        count += __builtin_convertvector((vbyte)(d != 0) & 1, vuint);
+      }
+      squares += sum_lanes(&sum);
+      differing += sum_lanes(&count);
+      int chunk_max = max_lane(&max);
+      max_error = chunk_max > max_error ? chunk_max : max_error;
+    }
+    for (; x < row_size; ++x) {
+      int d = abs(row_a[x] - row_b[x]);
+      squares += d * d;
+      differing += d != 0;
+      max_error = d > max_error ? d : max_error;
+    }
+  }
+
+  size_t channels = row_size * height;
+  diff->max_error = max_error;
+  diff->differing = differing;
+  diff->mse = channels ? (double)squares / channels : 0;
+  diff->psnr =
+      diff->mse > 0 ? 10.0 * log10(255.0 * 255.0 / diff->mse) : INFINITY;
+}
+
+/**
+ * @brief Draw the difference between two 3-channel images as a
+ * heatmap.
+ *
+ * Identical pixels are black, and the others are coloured with the
+ * jet colormap from their largest channel difference, from blue for
+ * the smallest to red for differences of 64 and more, so that
+ * rounding errors remain visible.
+ *
+ * @param a The first image.
+ * @param a_pitch The size of a row of the first image, in bytes.
+ * @param b The second image.
+ * @param b_pitch The size of a row of the second image, in bytes.
+ * @param width The width of the images in pixels.
+ * @param height The height of the images in pixels.
+ * @param heatmap The heatmap, written in BGR order like the images.
+ * @param heatmap_pitch The size of a row of the heatmap, in bytes.
+ */
+void image_diff_heatmap(const unsigned char *a, size_t a_pitch,
+                        const unsigned char *b, size_t b_pitch, int width,
+                        int height, unsigned char *heatmap,
+                        size_t heatmap_pitch) {
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row_a = a + y * a_pitch;
+    const unsigned char *row_b = b + y * b_pitch;
+    unsigned char *out = heatmap + y * heatmap_pitch;
+    for (int x = 0; x < 3 * width; x += 3) {
+      int error = 0;
+      for (int c = 0; c < 3; ++c) {
+        int d = abs(row_a[x + c] - row_b[x + c]);
+        error = d > error ? d : error;
+      }
+      if (error == 0) {
+        out[x] = out[x + 1] = out[x + 2] = 0;
+        continue;
+      }
+      double t = fmin(error / HEATMAP_RANGE, 1.0);
+      double r = t < 0.7 ? 4.0 * t - 1.5 : -4.0 * t + 4.5;
+      double g = t < 0.5 ? 4.0 * t - 0.5 : -4.0 * t + 3.5;
+      double bl = t < 0.3 ? 4.0 * t + 0.5 : -4.0 * t + 2.5;
+      out[x] = (unsigned char)(fmin(fmax(bl, 0.0), 1.0) * 255.0 + 0.5);
+      out[x + 1] = (unsigned char)(fmin(fmax(g, 0.0), 1.0) * 255.0 + 0.5);
+      out[x + 2] = (unsigned char)(fmin(fmax(r, 0.0), 1.0) * 255.0 + 0.5);
+    }
+  }
+}
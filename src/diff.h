@@ -0,0 +1,25 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+
+/**
+ * Difference between two 8-bit images of the same size.
+ */
+struct image_diff {
+  int max_error;    /**< Largest difference of a channel, from 0 to 255. */
+  double mse;       /**< Mean squared difference of the channels. */
+  double psnr;      /**< Peak signal-to-noise ratio in dB, infinite if the
+                       images are identical. */
+  size_t differing; /**< Number of channels that differ. */
+};
+
+void image_diff(const unsigned char *a, size_t a_pitch,
+                const unsigned char *b, size_t b_pitch, size_t row_size,
+                int height, struct image_diff *diff);
+void image_diff_heatmap(const unsigned char *a, size_t a_pitch,
+                        const unsigned char *b, size_t b_pitch, int width,
+                        int height, unsigned char *heatmap,
+                        size_t heatmap_pitch);
+
+#endif /* DIFF_H */
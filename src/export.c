@@ -0,0 +1,494 @@
+#include <FreeImage.h>
+#include <GL/glew.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "export.h"
+#include "log.h"
+#include "queue.h"
+
+/**
+ * Frame travelling through the export pipeline.
+ */
+struct export_frame {
+  size_t index;                /**< Frame index in the render loop. */
+  struct frame_pixels *pixels; /**< Pixels read back from the GPU. */
+  unsigned char *data;         /**< Converted frame, ready to be written. */
+  size_t size;                 /**< Size of the converted frame in bytes. */
+};
+
+/**
+ * @brief Parse the name of an export format.
+ *
+ * @param name One of "images", "raw", or "y4m".
+ * @return The export format, or `EXPORT_NONE` if the name is unknown.
+ */
+enum export_format export_format_from_string(const char *name) {
+  if (!strcmp(name, "images") || !strcmp(name, "png")) {
+    return EXPORT_IMAGES;
+  } else if (!strcmp(name, "raw") || !strcmp(name, "rgb")) {
+    return EXPORT_RAW;
+  } else if (!strcmp(name, "y4m")) {
+    return EXPORT_Y4M;
+  }
+  return EXPORT_NONE;
+}
+
+/**
+ * @brief Guess the export format from the output path.
+ *
+ * "-" is a raw stream on the standard output, a path ending in `.y4m`
+ * is a Y4M stream, and a path containing a frame number pattern is an
+ * image sequence. Any other path is a raw stream.
+ *
+ * @param path The output path.
+ * @return The guessed export format.
+ */
+enum export_format export_guess_format(const char *path) {
+  size_t len = strlen(path);
+  if (len >= 4 && !strcmp(path + len - 4, ".y4m")) {
+    return EXPORT_Y4M;
+  } else if (strchr(path, '%')) {
+    return EXPORT_IMAGES;
+  }
+  return EXPORT_RAW;
+}
+
+/**
+ * @brief Check that an image file name pattern contains exactly one
+ * integer conversion (such as `%05d`) and no other conversion.
+ *
+ * @param pattern The file name pattern.
+ * @return `true` if the pattern can be used with the frame index.
+ */
+bool export_valid_pattern(const char *pattern) {
+  int conversions = 0;
+  for (const char *c = pattern; *c; ++c) {
+    if (*c != '%') {
+      continue;
+    }
+    ++c;
+    if (*c == '%') {
+      continue;
+    }
+    while (*c >= '0' && *c <= '9') {
+      ++c;
+    }
+    if (*c != 'd') {
+      return false;
+    }
+    ++conversions;
+  }
+  return conversions == 1;
+}
+
+/**
+ * @brief Free a frame and everything it owns.
+ *
+ * @param frame The frame to free.
+ */
+static void free_frame(struct export_frame *frame) {
+  if (frame->pixels) {
+    free(frame->pixels->data);
+    free(frame->pixels);
+  }
+  free(frame->data);
+  free(frame);
+}
+
+/**
+ * @brief Convert bottom-up BGR pixels to top-down packed RGB.
+ *
+ * @param frame The frame to convert.
+ * @return 0 on success, 1 on failure.
+ */
+static int convert_rgb(struct export_frame *frame) {
+  const struct frame_pixels *pixels = frame->pixels;
+  size_t row_size = (size_t)pixels->width * 3;
+  frame->size = row_size * pixels->height;
+  frame->data = malloc(frame->size);
+  if (frame->data == NULL) {
+    return 1;
+  }
+  for (int y = 0; y < pixels->height; ++y) {
+    const unsigned char *src =
+        pixels->data + (size_t)(pixels->height - 1 - y) * pixels->pitch;
+    unsigned char *dst = frame->data + (size_t)y * row_size;
+    for (int x = 0; x < pixels->width; ++x) {
+      dst[3 * x + 0] = src[3 * x + 2];
+      dst[3 * x + 1] = src[3 * x + 1];
+      dst[3 * x + 2] = src[3 * x + 0];
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Convert bottom-up BGR pixels to planar YUV 4:2:0, with the
+ * BT.601 coefficients and limited range.
+ *
+ * @param frame The frame to convert.
+ * @return 0 on success, 1 on failure.
+ */
+static int convert_yuv420(struct export_frame *frame) {
+  const struct frame_pixels *pixels = frame->pixels;
+  int width = pixels->width, height = pixels->height;
+  int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+  size_t luma_size = (size_t)width * height;
+  size_t chroma_size = (size_t)chroma_width * chroma_height;
+  frame->size = luma_size + 2 * chroma_size;
+  frame->data = malloc(frame->size);
+  if (frame->data == NULL) {
+    return 1;
+  }
+  unsigned char *plane_y = frame->data;
+  unsigned char *plane_u = plane_y + luma_size;
+  unsigned char *plane_v = plane_u + chroma_size;
+
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *src =
+        pixels->data + (size_t)(height - 1 - y) * pixels->pitch;
+    for (int x = 0; x < width; ++x) {
+      int b = src[3 * x], g = src[3 * x + 1], r = src[3 * x + 2];
+      plane_y[(size_t)y * width + x] =
+          ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    }
+  }
+
+  for (int cy = 0; cy < chroma_height; ++cy) {
+    for (int cx = 0; cx < chroma_width; ++cx) {
+      /* Average the 2x2 block, clamped at the right and bottom edges */
+      int r = 0, g = 0, b = 0, n = 0;
+      for (int dy = 0; dy < 2 && 2 * cy + dy < height; ++dy) {
+        const unsigned char *src =
+            pixels->data +
+            (size_t)(height - 1 - (2 * cy + dy)) * pixels->pitch;
+        for (int dx = 0; dx < 2 && 2 * cx + dx < width; ++dx) {
+          const unsigned char *p = src + 3 * (2 * cx + dx);
+          b += p[0];
+          g += p[1];
+          r += p[2];
+          ++n;
+        }
+      }
+      r /= n;
+      g /= n;
+      b /= n;
+      size_t i = (size_t)cy * chroma_width + cx;
+      plane_u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+      plane_v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Colour conversion stage: convert frames to the output format
+ * and pass them to the writers.
+ *
+ * @param arg The export state.
+ * @return `NULL`.
+ */
+static void *converter_thread(void *arg) {
+  struct export_state *export = arg;
+  struct export_frame *frame = NULL;
+  while ((frame = queue_pop(&export->to_convert))) {
+    int err = 0;
+    switch (export->format) {
+    case EXPORT_RAW:
+      err = convert_rgb(frame);
+      break;
+    case EXPORT_Y4M:
+      err = convert_yuv420(frame);
+      break;
+    default:
+      /* FreeImage encodes the BGR pixels directly */
+      break;
+    }
+    if (err) {
+      log_error("[export] Failed to convert frame %zu", frame->index);
+      pthread_mutex_lock(&export->lock);
+      export->failed = true;
+      pthread_mutex_unlock(&export->lock);
+      free_frame(frame);
+      continue;
+    }
+    if (frame->data) {
+      free(frame->pixels->data);
+      free(frame->pixels);
+      frame->pixels = NULL;
+    }
+    if (!queue_push(&export->to_write, frame)) {
+      free_frame(frame);
+    }
+  }
+  queue_close(&export->to_write);
+  return NULL;
+}
+
+/**
+ * @brief Write a frame as a PNG file named after the pattern.
+ *
+ * @param export The export state.
+ * @param frame The frame to write.
+ * @return 0 on success, 1 on failure.
+ */
+static int write_image(struct export_state *export,
+                       struct export_frame *frame) {
+  char filename[4096] = {0};
+  /* The pattern is checked by export_valid_pattern() */
+  snprintf(filename, sizeof(filename), export->path, (int)frame->index);
+  const struct frame_pixels *pixels = frame->pixels;
+  FIBITMAP *image = FreeImage_ConvertFromRawBits(
+      pixels->data, pixels->width, pixels->height, pixels->pitch, 24,
+      FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, false);
+  bool saved = image && FreeImage_Save(FIF_PNG, image, filename, 0);
+  FreeImage_Unload(image);
+  if (!saved) {
+    log_error("[export] Failed to save image to %s", filename);
+    return 1;
+  }
+  log_debug("[export] Image saved to %s", filename);
+  return 0;
+}
+
+/**
+ * @brief Write a converted frame to the output stream, preceded by the
+ * stream header for the first frame.
+ *
+ * @param export The export state.
+ * @param frame The frame to write.
+ * @return 0 on success, 1 on failure.
+ */
+static int write_stream(struct export_state *export,
+                        struct export_frame *frame) {
+  if (export->format == EXPORT_Y4M) {
+    if (export->frames_written == 0) {
+      unsigned int rate = (unsigned int)(export->fps * 1000 + 0.5);
+      fprintf(export->stream, "YUV4MPEG2 W%d H%d F%u:1000 Ip A1:1 C420jpeg\n",
+              export->width, export->height, rate);
+    }
+    fputs("FRAME\n", export->stream);
+  }
+  if (fwrite(frame->data, 1, frame->size, export->stream) != frame->size) {
+    log_error("[export] Failed to write frame %zu: %s", frame->index,
+              strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Output stage: write frames to disk or to the standard output.
+ *
+ * @param arg The export state.
+ * @return `NULL`.
+ */
+static void *writer_thread(void *arg) {
+  struct export_state *export = arg;
+  struct export_frame *frame = NULL;
+  while ((frame = queue_pop(&export->to_write))) {
+    pthread_mutex_lock(&export->lock);
+    bool failed = export->failed;
+    pthread_mutex_unlock(&export->lock);
+    if (failed) {
+      free_frame(frame);
+      continue;
+    }
+
+    int err = export->format == EXPORT_IMAGES ? write_image(export, frame)
+                                              : write_stream(export, frame);
+    pthread_mutex_lock(&export->lock);
+    if (err) {
+      export->failed = true;
+    } else {
+      export->frames_written++;
+    }
+    pthread_mutex_unlock(&export->lock);
+    free_frame(frame);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Hand a frame read back from the GPU to the converter, if it
+ * has the size of the exported stream.
+ *
+ * @param pixels The pixels, with the frame as user data.
+ * @param data The export state.
+ */
+static void enqueue_frame(struct frame_pixels *pixels, void *data) {
+  struct export_state *export = data;
+  struct export_frame *frame = pixels->userdata;
+  frame->pixels = pixels;
+  pixels->userdata = NULL;
+
+  if (export->format != EXPORT_IMAGES) {
+    if (export->width == 0) {
+      export->width = pixels->width;
+      export->height = pixels->height;
+    } else if (pixels->width != export->width ||
+               pixels->height != export->height) {
+      log_warn("[export] Skipping frame %zu of size %dx%d in a %dx%d stream",
+               frame->index, pixels->width, pixels->height, export->width,
+               export->height);
+      free_frame(frame);
+      return;
+    }
+  }
+  if (!queue_push(&export->to_convert, frame)) {
+    free_frame(frame);
+  }
+}
+
+/**
+ * @brief Open the output and start the conversion and output threads.
+ *
+ * @param export The export state to initialize.
+ * @param format The output format.
+ * @param path The output path: a file name pattern for images, or a
+ * file name or "-" for streams.
+ * @param fps The frame rate written in stream headers.
+ * @return 0 on success, 1 on failure.
+ */
+int export_init(struct export_state *export, enum export_format format,
+                const char *path, double fps) {
+  memset(export, 0, sizeof(*export));
+  export->format = format;
+  export->path = path;
+  export->fps = fps;
+
+  if (format == EXPORT_IMAGES) {
+    if (!export_valid_pattern(path)) {
+      log_error("[export] Invalid file name pattern %s, expected a single "
+                "frame number such as %%05d",
+                path);
+      return 1;
+    }
+  } else if (!strcmp(path, "-")) {
+    export->stream = stdout;
+    /* Report a closed pipe as a write error instead of dying */
+    signal(SIGPIPE, SIG_IGN);
+  } else {
+    export->stream = fopen(path, "wb");
+    if (export->stream == NULL) {
+      log_error("[export] Could not open %s: %s", path, strerror(errno));
+      return 1;
+    }
+  }
+
+  if (queue_init(&export->to_convert, EXPORT_QUEUE_SIZE)) {
+    goto close_stream;
+  }
+  if (queue_init(&export->to_write, EXPORT_QUEUE_SIZE)) {
+    goto destroy_to_convert;
+  }
+  if (pthread_create(&export->converter, NULL, converter_thread, export)) {
+    log_error("[export] Failed to start the converter thread");
+    goto destroy_to_write;
+  }
+  pthread_mutex_init(&export->lock, NULL);
+  readback_init(&export->ring);
+
+  size_t num_writers = format == EXPORT_IMAGES ? EXPORT_IMAGE_WRITERS : 1;
+  for (size_t i = 0; i < num_writers; ++i) {
+    if (pthread_create(&export->writers[i], NULL, writer_thread, export)) {
+      log_error("[export] Failed to start a writer thread");
+      break;
+    }
+    export->num_writers++;
+  }
+  export->initialized = true;
+  if (export->num_writers == 0) {
+    export_finish(export);
+    return 1;
+  }
+
+  log_info("[export] Exporting frames to %s", path);
+  return 0;
+
+destroy_to_write:
+  queue_destroy(&export->to_write);
+destroy_to_convert:
+  queue_destroy(&export->to_convert);
+close_stream:
+  if (export->stream && export->stream != stdout) {
+    fclose(export->stream);
+  }
+  return 1;
+}
+
+/**
+ * @brief Export the frame in the current read framebuffer.
+ *
+ * The readback is started on the GPU, and the frames whose readback
+ * has completed are handed to the converter without waiting.
+ *
+ * @param export The export state.
+ * @param frame_index The index of the rendered frame.
+ */
+void export_frame(struct export_state *export, size_t frame_index) {
+  if (!export->initialized) {
+    return;
+  }
+  struct export_frame *frame = calloc(1, sizeof(struct export_frame));
+  if (frame == NULL) {
+    log_error("[export] Failed to allocate frame %zu", frame_index);
+    return;
+  }
+  frame->index = frame_index;
+
+  int viewport[4] = {0};
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  readback_request(&export->ring, viewport[2], viewport[3], frame,
+                   enqueue_frame, export);
+  readback_poll(&export->ring, false, enqueue_frame, export);
+}
+
+/**
+ * @brief Wait for all the pending frames to be written, stop the
+ * threads and close the output.
+ *
+ * @param export The export state.
+ * @return 0 if all the frames were written, 1 if a frame or the output
+ * could not be written.
+ */
+int export_finish(struct export_state *export) {
+  if (!export->initialized) {
+    return 0;
+  }
+  readback_poll(&export->ring, true, enqueue_frame, export);
+  queue_close(&export->to_convert);
+  pthread_join(export->converter, NULL);
+  for (size_t i = 0; i < export->num_writers; ++i) {
+    pthread_join(export->writers[i], NULL);
+  }
+
+  if (export->stream) {
+    if (fflush(export->stream) != 0) {
+      log_error("[export] Failed to flush %s: %s", export->path,
+                strerror(errno));
+      export->failed = true;
+    }
+    if (export->stream != stdout && fclose(export->stream) != 0) {
+      log_error("[export] Failed to close %s: %s", export->path,
+                strerror(errno));
+      export->failed = true;
+    }
+    export->stream = NULL;
+  }
+  log_info("[export] %zu frames written to %s%s", export->frames_written,
+           export->path, export->failed ? " (with errors)" : "");
+
+  readback_destroy(&export->ring);
+  pthread_mutex_destroy(&export->lock);
+  queue_destroy(&export->to_write);
+  queue_destroy(&export->to_convert);
+  export->initialized = false;
+  return export->failed;
+}
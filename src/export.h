@@ -0,0 +1,60 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "capture.h"
+#include "queue.h"
+
+#define EXPORT_QUEUE_SIZE 8 /**< Maximum number of frames between stages. */
+#define EXPORT_IMAGE_WRITERS 2 /**< Number of threads encoding images. */
+
+/**
+ * Output format of the frame export.
+ */
+enum export_format {
+  EXPORT_NONE,   /**< No export. */
+  EXPORT_IMAGES, /**< Sequence of numbered PNG files. */
+  EXPORT_RAW,    /**< Raw 8-bit RGB frames, top row first. */
+  EXPORT_Y4M,    /**< YUV4MPEG2 stream with 4:2:0 chroma subsampling. */
+};
+
+/**
+ * State of the frame export pipeline.
+ *
+ * Frames go through four stages: rendering and readback on the render
+ * thread, colour conversion on a converter thread, and output on
+ * writer threads. The stages are joined by bounded queues, so the
+ * render thread never waits on the disk unless the writers fall
+ * behind by more than the queue size.
+ */
+struct export_state {
+  enum export_format format; /**< Output format. */
+  const char *path; /**< Output file, file name pattern, or "-" for stdout. */
+  double fps;       /**< Frame rate written in stream headers. */
+  FILE *stream;     /**< Output stream for the raw and Y4M formats. */
+  int width;        /**< Width of the exported frames. */
+  int height;       /**< Height of the exported frames. */
+  struct readback_ring ring; /**< Pixel buffers of frames being read. */
+  struct queue to_convert;   /**< Frames waiting for colour conversion. */
+  struct queue to_write;     /**< Frames waiting to be written. */
+  pthread_t converter;       /**< Colour conversion thread. */
+  pthread_t writers[EXPORT_IMAGE_WRITERS]; /**< Output threads. */
+  size_t num_writers;        /**< Number of running output threads. */
+  size_t frames_written;     /**< Number of frames written so far. */
+  bool failed;               /**< An output error occurred. */
+  pthread_mutex_t lock;      /**< Protects the counters and flags. */
+  bool initialized;          /**< The pipeline is running. */
+};
+
+enum export_format export_format_from_string(const char *name);
+enum export_format export_guess_format(const char *path);
+bool export_valid_pattern(const char *pattern);
+int export_init(struct export_state *export, enum export_format format,
+                const char *path, double fps);
+void export_frame(struct export_state *export, size_t frame_index);
+int export_finish(struct export_state *export);
+
+#endif /* EXPORT_H */
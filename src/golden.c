@@ -0,0 +1,379 @@
+#include <FreeImage.h>
+#include <GL/glew.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "capture.h"
+#include "diff.h"
+#include "golden.h"
+#include "log.h"
+#include "queue.h"
+
+/**
+ * @brief Parse a list of frames to check, such as `0,30,100-200`.
+ *
+ * @param golden The golden state, whose ranges are replaced.
+ * @param list Comma-separated frame indices and inclusive ranges.
+ * @return 0 on success, 1 on failure.
+ */
+int golden_parse_frames(struct golden_state *golden, const char *list) {
+  golden->num_ranges = 0;
+  const char *c = list;
+  for (;;) {
+    if (golden->num_ranges >= GOLDEN_MAX_RANGES ||
+        !(*c >= '0' && *c <= '9')) {
+      return 1;
+    }
+    char *end = NULL;
+    struct golden_range *range = &golden->ranges[golden->num_ranges++];
+    range->first = range->last = strtoul(c, &end, 10);
+    if (*end == '-') {
+      c = end + 1;
+      if (!(*c >= '0' && *c <= '9')) {
+        return 1;
+      }
+      range->last = strtoul(c, &end, 10);
+      if (range->last < range->first) {
+        return 1;
+      }
+    }
+    if (*end == '\0') {
+      return 0;
+    } else if (*end != ',') {
+      return 1;
+    }
+    c = end + 1;
+  }
+}
+
+/**
+ * @brief Last frame to render to check all the requested frames.
+ *
+ * @param golden The golden state.
+ * @return The largest frame index of the ranges, or 0 if every frame
+ * is checked.
+ */
+size_t golden_last_frame(const struct golden_state *golden) {
+  size_t last = 0;
+  for (size_t i = 0; i < golden->num_ranges; ++i) {
+    last = golden->ranges[i].last > last ? golden->ranges[i].last : last;
+  }
+  return last;
+}
+
+/**
+ * @brief Check whether a frame is part of the run.
+ *
+ * @param golden The golden state.
+ * @param frame_index The index of the frame.
+ * @return `true` if the frame must be checked.
+ */
+static bool frame_selected(const struct golden_state *golden,
+                           size_t frame_index) {
+  if (golden->num_ranges == 0) {
+    return true;
+  }
+  for (size_t i = 0; i < golden->num_ranges; ++i) {
+    if (frame_index >= golden->ranges[i].first &&
+        frame_index <= golden->ranges[i].last) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Free pixels read back from the GPU, and their frame index.
+ *
+ * @param pixels The pixels to free.
+ */
+static void free_pixels(struct frame_pixels *pixels) {
+  free(pixels->userdata);
+  free(pixels->data);
+  free(pixels);
+}
+
+/**
+ * @brief Save BGR pixels, bottom row first, as a PNG file.
+ *
+ * @param data The pixels.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param pitch The size of a row in bytes.
+ * @param filename The file to write.
+ * @return 0 on success, 1 on failure.
+ */
+static int save_png(unsigned char *data, int width, int height, size_t pitch,
+                    const char *filename) {
+  FIBITMAP *image = FreeImage_ConvertFromRawBits(
+      data, width, height, pitch, 24, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK,
+      FI_RGBA_BLUE_MASK, false);
+  bool saved = image && FreeImage_Save(FIF_PNG, image, filename, 0);
+  FreeImage_Unload(image);
+  if (!saved) {
+    log_error("[golden] Failed to save image to %s", filename);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Write a heatmap of the difference between a frame and its
+ * reference.
+ *
+ * @param pixels The frame.
+ * @param reference The reference image, in 24-bit BGR.
+ * @param filename The file to write.
+ * @return 0 on success, 1 on failure.
+ */
+static int save_heatmap(const struct frame_pixels *pixels,
+                        FIBITMAP *reference, const char *filename) {
+  size_t pitch = readback_pitch(pixels->width);
+  unsigned char *heatmap = malloc(pitch * pixels->height);
+  if (heatmap == NULL) {
+    log_error("[golden] Failed to allocate the heatmap");
+    return 1;
+  }
+  image_diff_heatmap(pixels->data, pixels->pitch, FreeImage_GetBits(reference),
+                     FreeImage_GetPitch(reference), pixels->width,
+                     pixels->height, heatmap, pitch);
+  int err = save_png(heatmap, pixels->width, pixels->height, pitch, filename);
+  free(heatmap);
+  return err;
+}
+
+/**
+ * @brief Compare a frame to its reference image, or write the
+ * reference in update mode.
+ *
+ * @param golden The golden state.
+ * @param pixels The frame, with its index as user data.
+ * @param diff The difference with the reference.
+ * @return 0 if the frame matches, 1 otherwise.
+ */
+static int check_frame(struct golden_state *golden,
+                       const struct frame_pixels *pixels,
+                       struct image_diff *diff) {
+  size_t index = *(size_t *)pixels->userdata;
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s/%s_%05zu.png", golden->dir,
+           golden->name, index);
+  if (golden->update) {
+    memset(diff, 0, sizeof(*diff));
+    diff->psnr = INFINITY;
+    return save_png(pixels->data, pixels->width, pixels->height,
+                    pixels->pitch, filename);
+  }
+
+  FIBITMAP *image = FreeImage_Load(FIF_PNG, filename, 0);
+  if (image == NULL) {
+    log_error("[golden] Frame %zu: no reference image %s", index, filename);
+    return 1;
+  }
+  /* FreeImage stores 24-bit images in BGR order, bottom row first,
+     like the pixels read back from the GPU */
+  FIBITMAP *reference = FreeImage_ConvertTo24Bits(image);
+  FreeImage_Unload(image);
+  if (reference == NULL) {
+    log_error("[golden] Frame %zu: could not convert %s", index, filename);
+    return 1;
+  }
+  int width = FreeImage_GetWidth(reference);
+  int height = FreeImage_GetHeight(reference);
+  if (width != pixels->width || height != pixels->height) {
+    log_error("[golden] Frame %zu: size %dx%d, but %s is %dx%d", index,
+              pixels->width, pixels->height, filename, width, height);
+    FreeImage_Unload(reference);
+    return 1;
+  }
+
+  image_diff(pixels->data, pixels->pitch, FreeImage_GetBits(reference),
+             FreeImage_GetPitch(reference), (size_t)width * 3, height, diff);
+  int err = 0;
+  if (diff->max_error > golden->tolerance) {
+    char heatmap[PATH_MAX];
+    snprintf(heatmap, sizeof(heatmap), "%s/%s_%05zu_diff.png", golden->dir,
+             golden->name, index);
+    bool saved = !save_heatmap(pixels, reference, heatmap);
+    log_error("[golden] Frame %zu differs from %s: max error = %d, "
+              "PSNR = %.2f dB, %zu channels differ, heatmap in %s",
+              index, filename, diff->max_error, diff->psnr, diff->differing,
+              saved ? heatmap : "(none)");
+    err = 1;
+  } else {
+    log_debug("[golden] Frame %zu matches: max error = %d, PSNR = %.2f dB",
+              index, diff->max_error, diff->psnr);
+  }
+  FreeImage_Unload(reference);
+  return err;
+}
+
+/**
+ * @brief Comparison stage: check frames until the queue is closed.
+ *
+ * @param arg The golden state.
+ * @return `NULL`.
+ */
+static void *checker_thread(void *arg) {
+  struct golden_state *golden = arg;
+  struct frame_pixels *pixels = NULL;
+  while ((pixels = queue_pop(&golden->jobs))) {
+    struct image_diff diff = {0};
+    int err = check_frame(golden, pixels, &diff);
+    pthread_mutex_lock(&golden->lock);
+    golden->checked++;
+    if (err) {
+      golden->failed++;
+    } else {
+      if (diff.max_error > golden->max_error) {
+        golden->max_error = diff.max_error;
+      }
+      /* Ties, such as frames matching exactly, go to the first frame,
+         whichever thread checks it first */
+      size_t frame = *(size_t *)pixels->userdata;
+      if (diff.psnr < golden->min_psnr ||
+          (diff.psnr == golden->min_psnr && frame < golden->worst_frame)) {
+        golden->min_psnr = diff.psnr;
+        golden->worst_frame = frame;
+      }
+    }
+    pthread_mutex_unlock(&golden->lock);
+    free_pixels(pixels);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Hand a frame read back from the GPU to the checkers.
+ *
+ * @param pixels The pixels, with the frame index as user data.
+ * @param data The golden state.
+ */
+static void enqueue_check(struct frame_pixels *pixels, void *data) {
+  struct golden_state *golden = data;
+  if (!queue_push(&golden->jobs, pixels)) {
+    free_pixels(pixels);
+  }
+}
+
+/**
+ * @brief Start the comparison threads of a regression run.
+ *
+ * The directory, mode, tolerance and frame ranges are set by the
+ * command line before this call.
+ *
+ * @param golden The golden state, with `dir` set.
+ * @param shader_file The screen shader, naming the reference images.
+ * @return 0 on success, 1 on failure.
+ */
+int golden_init(struct golden_state *golden, const char *shader_file) {
+  const char *name = strrchr(shader_file, '/');
+  name = name ? name + 1 : shader_file;
+  const char *dot = strrchr(name, '.');
+  int length = dot && dot != name ? (int)(dot - name) : (int)strlen(name);
+  snprintf(golden->name, sizeof(golden->name), "%.*s", length, name);
+  golden->checked = golden->failed = 0;
+  golden->max_error = 0;
+  golden->min_psnr = INFINITY;
+  golden->worst_frame = SIZE_MAX;
+  golden->num_checkers = 0;
+
+  if (golden->update && make_directories(golden->dir)) {
+    log_error("[golden] Could not create %s", golden->dir);
+    return 1;
+  }
+  if (queue_init(&golden->jobs, GOLDEN_QUEUE_SIZE)) {
+    return 1;
+  }
+  pthread_mutex_init(&golden->lock, NULL);
+  readback_init(&golden->ring);
+  for (size_t i = 0; i < GOLDEN_CHECKERS; ++i) {
+    if (pthread_create(&golden->checkers[i], NULL, checker_thread, golden)) {
+      log_error("[golden] Failed to start a comparison thread");
+      break;
+    }
+    golden->num_checkers++;
+  }
+  golden->initialized = true;
+  if (golden->num_checkers == 0) {
+    golden_finish(golden);
+    return 1;
+  }
+  log_info("[golden] %s %s/%s_*.png", golden->update ? "Writing" : "Checking",
+           golden->dir, golden->name);
+  return 0;
+}
+
+/**
+ * @brief Check the frame in the current read framebuffer, if it is
+ * part of the run.
+ *
+ * The readback is started on the GPU, and the frames whose readback
+ * has completed are handed to the checkers without waiting.
+ *
+ * @param golden The golden state.
+ * @param frame_index The index of the rendered frame.
+ */
+void golden_frame(struct golden_state *golden, size_t frame_index) {
+  if (!golden->initialized || !frame_selected(golden, frame_index)) {
+    return;
+  }
+  size_t *index = malloc(sizeof(size_t));
+  if (index == NULL) {
+    log_error("[golden] Failed to allocate frame %zu", frame_index);
+    return;
+  }
+  *index = frame_index;
+
+  int viewport[4] = {0};
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  readback_request(&golden->ring, viewport[2], viewport[3], index,
+                   enqueue_check, golden);
+  readback_poll(&golden->ring, false, enqueue_check, golden);
+}
+
+/**
+ * @brief Wait for all the pending comparisons, stop the threads and
+ * report the results.
+ *
+ * @param golden The golden state.
+ * @return 0 if all the checked frames match their reference, 1 if a
+ * frame differs, could not be checked, or if no frame was checked.
+ */
+int golden_finish(struct golden_state *golden) {
+  if (!golden->initialized) {
+    return 0;
+  }
+  readback_poll(&golden->ring, true, enqueue_check, golden);
+  queue_close(&golden->jobs);
+  for (size_t i = 0; i < golden->num_checkers; ++i) {
+    pthread_join(golden->checkers[i], NULL);
+  }
+  readback_destroy(&golden->ring);
+  pthread_mutex_destroy(&golden->lock);
+  queue_destroy(&golden->jobs);
+  golden->initialized = false;
+
+  if (golden->checked == 0) {
+    log_error("[golden] No frame was checked");
+    return 1;
+  }
+  if (golden->update) {
+    log_info("[golden] %zu reference images written to %s",
+             golden->checked - golden->failed, golden->dir);
+  } else if (golden->failed == 0) {
+    log_info("[golden] %zu frames match: max error = %d, lowest PSNR = "
+             "%.2f dB (frame %zu)",
+             golden->checked, golden->max_error, golden->min_psnr,
+             golden->worst_frame);
+  } else {
+    log_error("[golden] %zu of %zu frames differ from the references",
+              golden->failed, golden->checked);
+  }
+  return golden->failed > 0;
+}
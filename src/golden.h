@@ -0,0 +1,59 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "capture.h"
+#include "queue.h"
+
+#define GOLDEN_MAX_RANGES 64  /**< Maximum number of checked frame ranges. */
+#define GOLDEN_CHECKERS 2     /**< Number of threads comparing frames. */
+#define GOLDEN_QUEUE_SIZE 8   /**< Maximum number of frames to compare. */
+#define GOLDEN_NAME_SIZE 256  /**< Maximum length of the shader name. */
+
+/**
+ * Range of frame indices to check, bounds included.
+ */
+struct golden_range {
+  size_t first; /**< First frame of the range. */
+  size_t last;  /**< Last frame of the range. */
+};
+
+/**
+ * State of a golden-image regression run.
+ *
+ * Each checked frame is read back asynchronously, and compared by
+ * background threads to the reference image of the same frame, named
+ * `DIR/NAME_FRAME.png` after the screen shader. When a frame differs
+ * by more than the tolerance, a heatmap of the difference is written
+ * next to the reference as `DIR/NAME_FRAME_diff.png`.
+ */
+struct golden_state {
+  const char *dir;   /**< Directory of the reference images. */
+  char name[GOLDEN_NAME_SIZE]; /**< Prefix of the reference images. */
+  bool update;       /**< Write the references instead of checking them. */
+  int tolerance;     /**< Largest channel difference accepted. */
+  struct golden_range ranges[GOLDEN_MAX_RANGES]; /**< Checked frames. */
+  size_t num_ranges; /**< Number of ranges, 0 to check every frame. */
+  struct readback_ring ring; /**< Pixel buffers of frames being read. */
+  struct queue jobs;         /**< Frames waiting to be compared. */
+  pthread_t checkers[GOLDEN_CHECKERS]; /**< Comparison threads. */
+  size_t num_checkers; /**< Number of running comparison threads. */
+  pthread_mutex_t lock; /**< Protects the results below. */
+  size_t checked;    /**< Number of frames compared or written. */
+  size_t failed;     /**< Frames that differ or could not be compared. */
+  int max_error;     /**< Largest channel difference of all the frames. */
+  double min_psnr;   /**< Lowest PSNR of all the frames. */
+  size_t worst_frame; /**< Frame with the lowest PSNR. */
+  bool initialized;  /**< The comparison threads are running. */
+};
+
+int golden_parse_frames(struct golden_state *golden, const char *list);
+size_t golden_last_frame(const struct golden_state *golden);
+int golden_init(struct golden_state *golden, const char *shader_file);
+void golden_frame(struct golden_state *golden, size_t frame_index);
+int golden_finish(struct golden_state *golden);
+
+#endif /* GOLDEN_H */
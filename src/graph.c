@@ -0,0 +1,900 @@
+#include <GL/glew.h>
+#include <ctype.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "graph.h"
+#include "log.h"
+#include "renderer.h"
+
+/** Mark of a pass during the depth-first traversal of the graph. */
+enum visit_mark { UNVISITED, VISITING, VISITED };
+
+/** Render target formats, indexed by `enum target_format`. */
+static const struct format_info formats[NUM_FORMATS] = {
+    {"rgb8", GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3},
+    {"rgba8", GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4},
+    {"r8", GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1},
+    {"rg16f", GL_RG16F, GL_RG, GL_HALF_FLOAT, 4},
+    {"rgba16f", GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8},
+    {"r32f", GL_R32F, GL_RED, GL_FLOAT, 4},
+    {"rgba32f", GL_RGBA32F, GL_RGBA, GL_FLOAT, 16},
+};
+
+/**
+ * @brief Describe a render target format.
+ *
+ * @param format The format.
+ * @return The OpenGL parameters of the format.
+ */
+const struct format_info *graph_format_info(enum target_format format) {
+  return &formats[format];
+}
+
+/**
+ * @brief Parse the name of a render target format, case insensitive.
+ *
+ * @param name The name of the format, such as "rgba16f".
+ * @param format The parsed format.
+ * @return 0 on success, 1 if the name is unknown.
+ */
+static int parse_format(const char *name, enum target_format *format) {
+  for (size_t i = 0; i < NUM_FORMATS; ++i) {
+    if (!strcasecmp(name, formats[i].name)) {
+      *format = i;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Parse the name of a filtering mode.
+ *
+ * @param name "linear" or "nearest".
+ * @param filter The parsed filtering mode.
+ * @return 0 on success, 1 if the name is unknown.
+ */
+static int parse_filter(const char *name, enum target_filter *filter) {
+  if (!strcasecmp(name, "linear")) {
+    *filter = FILTER_LINEAR;
+  } else if (!strcasecmp(name, "nearest")) {
+    *filter = FILTER_NEAREST;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Check the name of a new pass, image texture or stream.
+ *
+ * Names are used in uniform names, so they may only contain letters,
+ * digits and underscores, and passes, textures and streams share the
+ * same names, since all are read as inputs.
+ *
+ * @param graph The render graph.
+ * @param name The name of the new pass, texture or stream.
+ * @param filename Its file.
+ * @return 0 if the name is valid, 1 otherwise.
+ */
+static int check_name(struct render_graph *graph, const char *name,
+                      const char *filename) {
+  size_t length = strlen(name);
+  if (length == 0 || length >= PASS_NAME_SIZE) {
+    log_error("Invalid pass name '%s'", name);
+    return 1;
+  }
+  for (size_t i = 0; i < length; ++i) {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+      log_error("Invalid pass name '%s', only letters, digits and "
+                "underscores are allowed",
+                name);
+      return 1;
+    }
+  }
+  if (graph_find_pass(graph, name) || graph_find_texture(graph, name) ||
+      graph_find_stream(graph, name)) {
+    log_error("Pass %s is declared twice", name);
+    return 1;
+  }
+  if (strlen(filename) >= PATH_MAX) {
+    log_error("File name of pass %s is too long", name);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Add a pass to the render graph.
+ *
+ * @param graph The render graph.
+ * @param name The name of the pass.
+ * @param filename The source file of the fragment shader, or a shared
+ * library (`.so`) for a native pass.
+ * @return The new pass, or NULL on error.
+ */
+struct render_pass *graph_add_pass(struct render_graph *graph,
+                                   const char *name, const char *filename) {
+  if (graph->num_passes >= MAX_PASSES) {
+    log_error("Too many passes, at most %d are supported", MAX_PASSES);
+    return NULL;
+  }
+  if (check_name(graph, name, filename)) {
+    return NULL;
+  }
+
+  struct render_pass *pass = &graph->passes[graph->num_passes++];
+  memset(pass, 0, sizeof(*pass));
+  strcpy(pass->name, name);
+  strcpy(pass->filename, filename);
+  pass->shader.filename = pass->filename;
+  /* Native kernels write 8-bit RGBA pixels */
+  pass->native = kernel_is_library(filename);
+  if (pass->native) {
+    pass->format = FORMAT_RGBA8;
+  }
+  return pass;
+}
+
+/**
+ * @brief Look up a pass by name.
+ *
+ * @param graph The render graph.
+ * @param name The name of the pass.
+ * @return The pass, or NULL if there is no pass with this name.
+ */
+struct render_pass *graph_find_pass(struct render_graph *graph,
+                                    const char *name) {
+  for (size_t i = 0; i < graph->num_passes; ++i) {
+    if (!strcmp(graph->passes[i].name, name)) {
+      return &graph->passes[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Add an image texture to the render graph, read by the passes
+ * like the output of a pass.
+ *
+ * @param graph The render graph.
+ * @param name The name of the texture.
+ * @param filename The image file.
+ * @return The new texture, or NULL on error.
+ */
+struct image_texture *graph_add_texture(struct render_graph *graph,
+                                        const char *name,
+                                        const char *filename) {
+  if (graph->num_textures >= MAX_TEXTURES) {
+    log_error("Too many images, at most %d are supported", MAX_TEXTURES);
+    return NULL;
+  }
+  if (check_name(graph, name, filename)) {
+    return NULL;
+  }
+  size_t index = graph->num_textures++;
+  struct image_texture *texture = &graph->textures[index];
+  memset(texture, 0, sizeof(*texture));
+  strcpy(graph->texture_names[index], name);
+  strcpy(texture->filename, filename);
+  return texture;
+}
+
+/**
+ * @brief Look up an image texture by name.
+ *
+ * @param graph The render graph.
+ * @param name The name of the texture.
+ * @return The texture, or NULL if there is no texture with this name.
+ */
+struct image_texture *graph_find_texture(struct render_graph *graph,
+                                         const char *name) {
+  for (size_t i = 0; i < graph->num_textures; ++i) {
+    if (!strcmp(graph->texture_names[i], name)) {
+      return &graph->textures[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Add a data stream to the render graph, read by the passes
+ * like the output of a pass.
+ *
+ * @param graph The render graph.
+ * @param name The name of the stream.
+ * @param filename The FIFO or Unix socket.
+ * @return The new stream, or NULL on error.
+ */
+struct data_stream *graph_add_stream(struct render_graph *graph,
+                                     const char *name, const char *filename) {
+  if (graph->num_streams >= MAX_STREAMS) {
+    log_error("Too many streams, at most %d are supported", MAX_STREAMS);
+    return NULL;
+  }
+  if (check_name(graph, name, filename)) {
+    return NULL;
+  }
+  size_t index = graph->num_streams++;
+  struct data_stream *stream = &graph->streams[index];
+  memset(stream, 0, sizeof(*stream));
+  strcpy(graph->stream_names[index], name);
+  strcpy(stream->filename, filename);
+  return stream;
+}
+
+/**
+ * @brief Look up a data stream by name.
+ *
+ * @param graph The render graph.
+ * @param name The name of the stream.
+ * @return The stream, or NULL if there is no stream with this name.
+ */
+struct data_stream *graph_find_stream(struct render_graph *graph,
+                                      const char *name) {
+  for (size_t i = 0; i < graph->num_streams; ++i) {
+    if (!strcmp(graph->stream_names[i], name)) {
+      return &graph->streams[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Set the inputs of a pass, replacing the previous ones.
+ *
+ * The inputs are bound to consecutive texture units, in the order of
+ * the list.
+ *
+ * @param pass The pass.
+ * @param inputs Comma-separated list of pass names, possibly empty.
+ * @return 0 on success, 1 on failure.
+ */
+int graph_set_inputs(struct render_pass *pass, const char *inputs) {
+  pass->num_inputs = 0;
+  const char *start = inputs;
+  while (*start) {
+    const char *end = strchr(start, ',');
+    size_t length = end ? (size_t)(end - start) : strlen(start);
+    if (length == 0 || length >= PASS_NAME_SIZE) {
+      log_error("Invalid input list '%s' for pass %s", inputs, pass->name);
+      return 1;
+    }
+    if (pass->num_inputs >= MAX_PASS_INPUTS) {
+      log_error("Too many inputs for pass %s, at most %d are supported",
+                pass->name, MAX_PASS_INPUTS);
+      return 1;
+    }
+    memcpy(pass->input_names[pass->num_inputs], start, length);
+    pass->input_names[pass->num_inputs][length] = '\0';
+    pass->num_inputs++;
+    if (end == NULL) {
+      break;
+    }
+    start = end + 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Parse the attributes of an image texture.
+ *
+ * @param texture The texture.
+ * @param name The name of the texture, for error messages.
+ * @param saveptr The state of strtok_r() after the file name.
+ * @return 0 on success, 1 on failure.
+ */
+static int parse_texture(struct image_texture *texture, const char *name,
+                         char **saveptr) {
+  const char *attribute = NULL;
+  while ((attribute = strtok_r(NULL, " \t\r\n", saveptr))) {
+    enum target_filter filter = FILTER_LINEAR;
+    if (!strncmp(attribute, "filter=", 7) &&
+        !parse_filter(attribute + 7, &filter)) {
+      texture->nearest = filter == FILTER_NEAREST;
+    } else if (!strcmp(attribute, "wrap=repeat")) {
+      texture->clamp = false;
+    } else if (!strcmp(attribute, "wrap=clamp")) {
+      texture->clamp = true;
+    } else {
+      log_error("Invalid attribute '%s' for image %s, expected "
+                "filter=linear|nearest or wrap=repeat|clamp",
+                attribute, name);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Parse the attributes of a data stream.
+ *
+ * @param stream The stream.
+ * @param name The name of the stream, for error messages.
+ * @param saveptr The state of strtok_r() after the file name.
+ * @return 0 on success, 1 on failure.
+ */
+static int parse_stream(struct data_stream *stream, const char *name,
+                        char **saveptr) {
+  enum target_format format = FORMAT_R32F;
+  enum target_filter filter = FILTER_LINEAR;
+  const char *attribute = NULL;
+  while ((attribute = strtok_r(NULL, " \t\r\n", saveptr))) {
+    char end = 0;
+    if (!strncmp(attribute, "size=", 5) &&
+        sscanf(attribute + 5, "%dx%d%c", &stream->width, &stream->height,
+               &end) == 2) {
+      continue;
+    }
+    if ((strncmp(attribute, "format=", 7) ||
+         parse_format(attribute + 7, &format)) &&
+        (strncmp(attribute, "filter=", 7) ||
+         parse_filter(attribute + 7, &filter))) {
+      log_error("Invalid attribute '%s' for stream %s, expected size=WxH, "
+                "format=F or filter=linear|nearest",
+                attribute, name);
+      return 1;
+    }
+  }
+  if (stream->width < 1 || stream->height < 1 || stream->width > 16384 ||
+      stream->height > 16384) {
+    log_error("Stream %s needs a size=WxH of at most 16384x16384", name);
+    return 1;
+  }
+  stream->internal_format = formats[format].internal_format;
+  stream->format = formats[format].format;
+  stream->type = formats[format].type;
+  stream->record_size =
+      (size_t)stream->width * stream->height * formats[format].pixel_size;
+  stream->nearest = filter == FILTER_NEAREST;
+  return 0;
+}
+
+/**
+ * @brief Parse the declaration of a pass and add it to the graph.
+ *
+ * A declaration is a pass name and a file name, followed by optional
+ * `key=value` attributes separated by spaces:
+ *
+ *     blur shaders/blur.frag inputs=scene,mask format=rgba16f
+ *
+ * The attributes are `inputs`, the passes read by this pass, `format`,
+ * the format of its render target (rgb8 by default, rgba8, r8, rg16f,
+ * rgba16f, r32f or rgba32f), and `filter`, the filtering used when
+ * other passes sample it (linear by default, or nearest). A pass named
+ * `screen` renders to the output.
+ *
+ * A file that is an image declares an image texture instead, read by
+ * the passes like the output of a pass, and whose only attributes are
+ * `filter` and `wrap` (repeat by default, or clamp):
+ *
+ *     noise textures/noise.png filter=nearest
+ *
+ * A file that is a FIFO or a Unix socket declares a data stream, a
+ * texture of size `size` (required) and format `format` (r32f by
+ * default) whose contents are written by another process, one record
+ * of `width * height` texels at a time:
+ *
+ *     spectrum /tmp/spectrum.fifo size=512x1 filter=nearest
+ *
+ * @param graph The render graph.
+ * @param spec The declaration of the pass.
+ * @param base_dir Directory of relative file names, or NULL to use
+ * them as they are.
+ * @return 0 on success, 1 on failure.
+ */
+int graph_parse_pass(struct render_graph *graph, const char *spec,
+                     const char *base_dir) {
+  char *copy = strdup(spec);
+  if (copy == NULL) {
+    log_error("Failed to allocate memory to parse pass '%s'", spec);
+    return 1;
+  }
+  char *saveptr = NULL;
+  const char *name = strtok_r(copy, " \t\r\n", &saveptr);
+  const char *file = strtok_r(NULL, " \t\r\n", &saveptr);
+  if (name == NULL || file == NULL) {
+    log_error("Invalid pass '%s', expected NAME FILE [inputs=A,B] "
+              "[format=F] [filter=F]",
+              spec);
+    free(copy);
+    return 1;
+  }
+
+  char path[PATH_MAX];
+  if (base_dir && file[0] != '/') {
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", base_dir, file) >=
+        sizeof(path)) {
+      log_error("File name of pass %s is too long", name);
+      free(copy);
+      return 1;
+    }
+    file = path;
+  }
+
+  if (stream_is_source(file)) {
+    struct data_stream *stream = graph_add_stream(graph, name, file);
+    int err = stream == NULL || parse_stream(stream, name, &saveptr);
+    free(copy);
+    return err;
+  }
+  if (texture_is_image(file)) {
+    struct image_texture *texture = graph_add_texture(graph, name, file);
+    int err = texture == NULL || parse_texture(texture, name, &saveptr);
+    free(copy);
+    return err;
+  }
+
+  struct render_pass *pass = graph_add_pass(graph, name, file);
+  if (pass == NULL) {
+    free(copy);
+    return 1;
+  }
+
+  const char *attribute = NULL;
+  while ((attribute = strtok_r(NULL, " \t\r\n", &saveptr))) {
+    if (!strncmp(attribute, "inputs=", 7)) {
+      if (graph_set_inputs(pass, attribute + 7)) {
+        free(copy);
+        return 1;
+      }
+    } else if (!strncmp(attribute, "format=", 7)) {
+      if (parse_format(attribute + 7, &pass->format)) {
+        log_error("Unknown format '%s' for pass %s", attribute + 7, name);
+        free(copy);
+        return 1;
+      }
+    } else if (!strncmp(attribute, "filter=", 7)) {
+      if (parse_filter(attribute + 7, &pass->filter)) {
+        log_error("Unknown filter '%s' for pass %s", attribute + 7, name);
+        free(copy);
+        return 1;
+      }
+    } else {
+      log_error("Unknown attribute '%s' for pass %s", attribute, name);
+      free(copy);
+      return 1;
+    }
+  }
+
+  free(copy);
+  return 0;
+}
+
+/**
+ * @brief Add the passes declared in a manifest file to the graph.
+ *
+ * The manifest contains one pass declaration per line, in the format
+ * accepted by graph_parse_pass(). Empty lines and lines starting with
+ * `#` are ignored. Relative file names are relative to the directory
+ * of the manifest.
+ *
+ * @param graph The render graph.
+ * @param filename The manifest file.
+ * @return 0 on success, 1 on failure.
+ */
+int graph_load_manifest(struct render_graph *graph, const char *filename) {
+  FILE *file = fopen(filename, "r");
+  if (file == NULL) {
+    log_error("Could not open manifest %s", filename);
+    return 1;
+  }
+  char *path = strdup(filename);
+  if (path == NULL) {
+    fclose(file);
+    return 1;
+  }
+  const char *base_dir = dirname(path);
+
+  int err = 0;
+  char *line = NULL;
+  size_t size = 0;
+  size_t line_number = 0;
+  while (!err && getline(&line, &size, file) != -1) {
+    line_number++;
+    const char *start = line;
+    while (isspace((unsigned char)*start)) {
+      start++;
+    }
+    if (*start == '\0' || *start == '#') {
+      continue;
+    }
+    err = graph_parse_pass(graph, start, base_dir);
+    if (err) {
+      log_error("Invalid pass at %s:%zu", filename, line_number);
+    }
+  }
+
+  free(line);
+  free(path);
+  fclose(file);
+  return err;
+}
+
+/**
+ * @brief Add a pass and its dependencies to the execution order, in
+ * depth-first post-order.
+ *
+ * @param graph The render graph.
+ * @param index The index of the pass to visit.
+ * @param marks The traversal marks of the passes.
+ * @return 0 on success, 1 if the graph has a cycle.
+ */
+static int visit_pass(struct render_graph *graph, size_t index,
+                      enum visit_mark *marks) {
+  struct render_pass *pass = &graph->passes[index];
+  if (marks[index] == VISITED) {
+    return 0;
+  }
+  if (marks[index] == VISITING) {
+    log_error("Render graph has a cycle through pass %s", pass->name);
+    return 1;
+  }
+  marks[index] = VISITING;
+  for (size_t i = 0; i < pass->num_inputs; ++i) {
+    /* Feedback reads the previous frame, it is not a dependency */
+    if (pass->input_kinds[i] == INPUT_IMAGE) {
+      graph->textures[pass->inputs[i]].active = true;
+      continue;
+    }
+    if (pass->input_kinds[i] == INPUT_STREAM) {
+      graph->streams[pass->inputs[i]].active = true;
+      continue;
+    }
+    if (pass->inputs[i] == index) {
+      continue;
+    }
+    if (visit_pass(graph, pass->inputs[i], marks)) {
+      return 1;
+    }
+  }
+  marks[index] = VISITED;
+  pass->active = true;
+  graph->order[graph->num_active++] = index;
+  return 0;
+}
+
+/**
+ * @brief Resolve the inputs of the passes, order the passes by their
+ * dependencies, cull unused passes, and assign render targets.
+ *
+ * Render targets are assigned greedily in execution order: a pass
+ * reuses the target of a pass whose output was last read by an
+ * earlier pass, if both targets have the same format and filtering.
+ * Passes reading their own output get two targets of their own, since
+ * their output must survive until the next frame.
+ *
+ * @param graph The render graph.
+ * @return 0 on success, 1 on failure.
+ */
+int graph_build(struct render_graph *graph) {
+  struct render_pass *screen = graph_screen(graph);
+  if (screen == NULL) {
+    log_error("No %s pass to render", SCREEN_PASS);
+    return 1;
+  }
+  if (screen->native) {
+    log_error("The %s pass renders to the output, it cannot be a native "
+              "kernel",
+              SCREEN_PASS);
+    return 1;
+  }
+  if (screen->format != FORMAT_RGB8 || screen->filter != FILTER_LINEAR) {
+    log_error("The %s pass renders to the output, it cannot have a format "
+              "or a filter",
+              SCREEN_PASS);
+    return 1;
+  }
+
+  for (size_t i = 0; i < graph->num_passes; ++i) {
+    struct render_pass *pass = &graph->passes[i];
+    if (pass->native &&
+        (pass->num_inputs > 0 || pass->format != FORMAT_RGBA8)) {
+      log_error("Native pass %s cannot have inputs, and always renders to "
+                "rgba8",
+                pass->name);
+      return 1;
+    }
+    pass->active = false;
+    pass->feedback = false;
+    for (size_t j = 0; j < pass->num_inputs; ++j) {
+      struct render_pass *input = graph_find_pass(graph, pass->input_names[j]);
+      struct image_texture *texture =
+          graph_find_texture(graph, pass->input_names[j]);
+      struct data_stream *stream =
+          graph_find_stream(graph, pass->input_names[j]);
+      pass->input_kinds[j] = INPUT_PASS;
+      if (texture) {
+        pass->input_kinds[j] = INPUT_IMAGE;
+        pass->inputs[j] = texture - graph->textures;
+        continue;
+      }
+      if (stream) {
+        pass->input_kinds[j] = INPUT_STREAM;
+        pass->inputs[j] = stream - graph->streams;
+        continue;
+      }
+      if (input == NULL) {
+        log_error("Pass %s reads unknown pass %s", pass->name,
+                  pass->input_names[j]);
+        return 1;
+      }
+      if (input == screen) {
+        log_error("Pass %s cannot read the %s pass", pass->name, SCREEN_PASS);
+        return 1;
+      }
+      pass->inputs[j] = input - graph->passes;
+      pass->feedback |= input == pass;
+    }
+  }
+
+  enum visit_mark marks[MAX_PASSES] = {UNVISITED};
+  graph->num_active = 0;
+  for (size_t i = 0; i < graph->num_textures; ++i) {
+    graph->textures[i].active = false;
+  }
+  for (size_t i = 0; i < graph->num_streams; ++i) {
+    graph->streams[i].active = false;
+  }
+  if (visit_pass(graph, screen - graph->passes, marks)) {
+    return 1;
+  }
+  for (size_t i = 0; i < graph->num_passes; ++i) {
+    if (!graph->passes[i].active) {
+      log_warn("Pass %s is not used by the %s pass, skipping",
+               graph->passes[i].name, SCREEN_PASS);
+    }
+  }
+  for (size_t i = 0; i < graph->num_textures; ++i) {
+    if (!graph->textures[i].active) {
+      log_warn("Image %s is not used by the %s pass, skipping",
+               graph->texture_names[i], SCREEN_PASS);
+    }
+  }
+  for (size_t i = 0; i < graph->num_streams; ++i) {
+    if (!graph->streams[i].active) {
+      log_warn("Stream %s is not used by the %s pass, skipping",
+               graph->stream_names[i], SCREEN_PASS);
+    }
+  }
+
+  /* Last position in the execution order where each output is read */
+  size_t last_use[MAX_PASSES] = {0};
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    struct render_pass *pass = &graph->passes[graph->order[k]];
+    for (size_t j = 0; j < pass->num_inputs; ++j) {
+      if (pass->input_kinds[j] == INPUT_PASS &&
+          pass->inputs[j] != graph->order[k]) {
+        last_use[pass->inputs[j]] = k;
+      }
+    }
+  }
+
+  /* Position after which each target is free again */
+  size_t free_after[MAX_TARGETS] = {0};
+  graph->num_targets = 0;
+  for (size_t k = 0; k + 1 < graph->num_active; ++k) {
+    size_t index = graph->order[k];
+    struct render_pass *pass = &graph->passes[index];
+    if (pass->feedback) {
+      pass->target = graph->num_targets++;
+      pass->history = graph->num_targets++;
+      free_after[pass->target] = SIZE_MAX;
+      free_after[pass->history] = SIZE_MAX;
+      graph->targets[pass->target].format = pass->format;
+      graph->targets[pass->target].filter = pass->filter;
+      graph->targets[pass->history] = graph->targets[pass->target];
+      continue;
+    }
+    size_t target = 0;
+    while (target < graph->num_targets &&
+           (free_after[target] >= k ||
+            graph->targets[target].format != pass->format ||
+            graph->targets[target].filter != pass->filter)) {
+      target++;
+    }
+    if (target == graph->num_targets) {
+      graph->num_targets++;
+      graph->targets[target].format = pass->format;
+      graph->targets[target].filter = pass->filter;
+    }
+    pass->target = target;
+    free_after[target] = last_use[index];
+  }
+
+  char order[MAX_PASSES * (PASS_NAME_SIZE + 4)] = {0};
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    if (k > 0) {
+      strcat(order, " -> ");
+    }
+    strcat(order, graph->passes[graph->order[k]].name);
+  }
+  log_info("Render graph: %s", order);
+  log_debug("%zu intermediate passes share %zu render targets",
+            graph->num_active - 1, graph->num_targets);
+  return 0;
+}
+
+/**
+ * @brief Create the render targets of the graph.
+ *
+ * @param graph The render graph, already built.
+ * @param width The width of the render targets.
+ * @param height The height of the render targets.
+ * @return 0 on success, 1 on failure.
+ */
+int graph_initialize_targets(struct render_graph *graph, int width,
+                             int height) {
+  size_t bytes = 0;
+  for (size_t i = 0; i < graph->num_targets; ++i) {
+    struct render_target *target = &graph->targets[i];
+    if (initialize_framebuffer(&target->framebuffer, &target->texture, width,
+                               height, target->format, target->filter)) {
+      return 1;
+    }
+    bytes += formats[target->format].pixel_size;
+  }
+  log_debug("Render targets use %.1f MiB",
+            (double)bytes * width * height / (1024 * 1024));
+  graph->width = width;
+  graph->height = height;
+  graph_clear_targets(graph);
+  return 0;
+}
+
+/**
+ * @brief Change the size of the render targets of the graph.
+ *
+ * The framebuffers keep their textures, whose storage is reallocated
+ * at the new size and cleared, so feedback passes start again from a
+ * black image.
+ *
+ * @param graph The render graph, with its targets created.
+ * @param width The new width of the render targets.
+ * @param height The new height of the render targets.
+ * @return 0 on success, 1 on failure.
+ */
+int graph_resize_targets(struct render_graph *graph, int width,
+                         int height) {
+  for (size_t i = 0; i < graph->num_targets; ++i) {
+    const struct render_target *target = &graph->targets[i];
+    if (resize_framebuffer(target->framebuffer, target->texture, width,
+                           height, target->format)) {
+      return 1;
+    }
+  }
+  log_debug("Render targets resized to %dx%d", width, height);
+  graph->width = width;
+  graph->height = height;
+  graph_clear_targets(graph);
+  return 0;
+}
+
+/**
+ * @brief Clear all the render targets, so that feedback passes start
+ * again from a black image.
+ *
+ * @param graph The render graph.
+ */
+void graph_clear_targets(struct render_graph *graph) {
+  glClearColor(0, 0, 0, 0);
+  for (size_t i = 0; i < graph->num_targets; ++i) {
+    glBindFramebuffer(GL_FRAMEBUFFER, graph->targets[i].framebuffer);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/**
+ * @brief Find the pass rendering to the output.
+ *
+ * @param graph The render graph.
+ * @return The screen pass, or NULL if it was not declared.
+ */
+struct render_pass *graph_screen(struct render_graph *graph) {
+  return graph_find_pass(graph, SCREEN_PASS);
+}
+
+/**
+ * @brief Bind the outputs of the inputs of a pass to consecutive
+ * texture units.
+ *
+ * A pass reading itself gets its output of the previous frame, and
+ * image and stream inputs are bound as they are.
+ *
+ * @param graph The render graph.
+ * @param pass The pass about to be drawn.
+ */
+static void bind_input_textures(struct render_graph *graph,
+                                const struct render_pass *pass) {
+  for (size_t i = 0; i < pass->num_inputs; ++i) {
+    glActiveTexture(GL_TEXTURE0 + i);
+    if (pass->input_kinds[i] == INPUT_IMAGE) {
+      glBindTexture(GL_TEXTURE_2D, graph->textures[pass->inputs[i]].texture);
+      continue;
+    }
+    if (pass->input_kinds[i] == INPUT_STREAM) {
+      glBindTexture(GL_TEXTURE_2D, graph->streams[pass->inputs[i]].texture);
+      continue;
+    }
+    const struct render_pass *input = &graph->passes[pass->inputs[i]];
+    size_t target = input == pass ? pass->history : input->target;
+    glBindTexture(GL_TEXTURE_2D, graph->targets[target].texture);
+  }
+  if (pass->num_inputs == 0) {
+    /* Never leave the output of another pass bound, it may share the
+       target of this pass */
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+/**
+ * @brief Point the sampler uniforms of a program at the texture units
+ * of the inputs of a pass.
+ *
+ * The input i is available as `u_input<i>` and as `u_<name>`, and the
+ * first input also as `u_texture`. The program must be in use.
+ *
+ * @param pass The pass whose inputs are bound.
+ * @param uniforms The active uniforms of the program.
+ */
+static void set_input_samplers(const struct render_pass *pass,
+                               const struct uniform_cache *uniforms) {
+  if (uniforms->texture != -1) {
+    glUniform1i(uniforms->texture, 0);
+  }
+  for (size_t i = 0; i < pass->num_inputs; ++i) {
+    char name[UNIFORM_NAME_SIZE];
+    snprintf(name, sizeof(name), "u_input%zu", i);
+    int location = uniform_cache_location(uniforms, name);
+    if (location != -1) {
+      glUniform1i(location, i);
+    }
+    snprintf(name, sizeof(name), "u_%s", pass->input_names[i]);
+    location = uniform_cache_location(uniforms, name);
+    if (location != -1) {
+      glUniform1i(location, i);
+    }
+  }
+}
+
+/**
+ * @brief Bind the inputs of a pass to consecutive texture units.
+ *
+ * When the program of the pass changes, its sampler uniforms are
+ * pointed at the texture units, see set_input_samplers(). The program
+ * must be in use.
+ *
+ * @param graph The render graph.
+ * @param pass The pass about to be drawn.
+ */
+void graph_bind_inputs(struct render_graph *graph, struct render_pass *pass) {
+  bind_input_textures(graph, pass);
+  if (pass->bound_program == pass->shader.program) {
+    return;
+  }
+  set_input_samplers(pass, &pass->shader.uniforms);
+  pass->bound_program = pass->shader.program;
+}
+
+/**
+ * @brief Bind the inputs of a pass for another program drawing it,
+ * such as its poster variant.
+ *
+ * @param graph The render graph.
+ * @param pass The pass whose inputs are bound.
+ * @param uniforms The active uniforms of the program, which must be in
+ * use.
+ */
+void graph_bind_program_inputs(struct render_graph *graph,
+                               const struct render_pass *pass,
+                               const struct uniform_cache *uniforms) {
+  bind_input_textures(graph, pass);
+  set_input_samplers(pass, uniforms);
+}
@@ -0,0 +1,201 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernel.h"
+#include "preprocess.h"
+#include "stream.h"
+#include "texture.h"
+#include "timing.h"
+#include "uniforms.h"
+#include "variants.h"
+
+#define MAX_PASSES 16      /**< Maximum number of passes in a render graph. */
+#define MAX_PASS_INPUTS 8  /**< Maximum number of inputs of a pass. */
+#define PASS_NAME_SIZE 32  /**< Maximum length of a pass name. */
+#define MAX_TEXTURES 8     /**< Maximum number of image textures. */
+#define MAX_STREAMS 4      /**< Maximum number of data streams. */
+#define MAX_TARGETS (2 * MAX_PASSES) /**< Maximum number of render targets. */
+#define SCREEN_PASS "screen" /**< Name of the pass rendering to the output. */
+
+/**
+ * Program of a shader variant that is not in use.
+ */
+struct program_variant {
+  unsigned int program; /**< Linked program, or 0. */
+  uint64_t source_hash; /**< Hash of the sources of the program. */
+  double retired;       /**< Time when the program stopped being used. */
+};
+
+/**
+ * Structure representing the state of a shader.
+ */
+struct shader_state {
+  unsigned int program; /**< Shader program ID. */
+  const char *filename; /**< Shader file name. */
+  const char *defines;  /**< `#define` lines of the variant in use,
+                           inserted after the `#version` line of the
+                           fragment shader, or NULL. */
+  const char *prelude;  /**< Code inserted after the defines, or NULL. */
+  struct shader_sources sources; /**< Files the fragment shader was
+                                    preprocessed from. */
+  struct uniform_cache uniforms; /**< Active uniforms of the program. */
+  unsigned int pending_program;  /**< Program being compiled, or 0. */
+  unsigned int pending_vertex;   /**< Vertex shader being compiled. */
+  unsigned int pending_fragment; /**< Fragment shader being compiled. */
+  uint64_t source_hash;  /**< Hash of the sources of the current program. */
+  uint64_t pending_hash; /**< Hash of the sources being compiled. */
+  struct gpu_timer timer; /**< GPU time spent in the pass. */
+  bool keep_variants; /**< Keep replaced programs, to switch back to
+                         their variant without compiling. */
+  struct program_variant variants[MAX_VARIANTS]; /**< Replaced programs. */
+};
+
+/**
+ * Storage format of a render target.
+ */
+enum target_format {
+  FORMAT_RGB8,    /**< Three 8-bit normalized channels, the default. */
+  FORMAT_RGBA8,   /**< Four 8-bit normalized channels. */
+  FORMAT_R8,      /**< One 8-bit normalized channel. */
+  FORMAT_RG16F,   /**< Two 16-bit floating point channels. */
+  FORMAT_RGBA16F, /**< Four 16-bit floating point channels. */
+  FORMAT_R32F,    /**< One 32-bit floating point channel. */
+  FORMAT_RGBA32F, /**< Four 32-bit floating point channels. */
+  NUM_FORMATS
+};
+
+/**
+ * Filtering applied when a render target is sampled.
+ */
+enum target_filter {
+  FILTER_LINEAR,  /**< Bilinear interpolation, the default. */
+  FILTER_NEAREST, /**< Nearest texel, for exact reads of simulation state. */
+};
+
+/**
+ * OpenGL description of a render target format.
+ */
+struct format_info {
+  const char *name;             /**< Name used in pass declarations. */
+  unsigned int internal_format; /**< Sized internal format of the texture. */
+  unsigned int format;          /**< Pixel format of the texture. */
+  unsigned int type;            /**< Pixel type of the texture. */
+  size_t pixel_size;            /**< Size of a texel in bytes. */
+};
+
+/**
+ * Texture rendered by a pass and read by the passes that depend on
+ * it.
+ */
+struct render_target {
+  unsigned int framebuffer; /**< Framebuffer with the texture attached. */
+  unsigned int texture;     /**< Colour texture. */
+  enum target_format format; /**< Storage format of the texture. */
+  enum target_filter filter; /**< Filtering of the texture. */
+};
+
+/**
+ * Kind of texture read by a pass.
+ */
+enum input_kind {
+  INPUT_PASS,   /**< Output of a pass. */
+  INPUT_IMAGE,  /**< Image texture. */
+  INPUT_STREAM, /**< Texture fed by a data stream. */
+};
+
+/**
+ * Pass of the render graph: a fragment shader drawn over a full
+ * screen quad, reading the outputs of other passes as textures, or a
+ * native kernel computing its output on the CPU.
+ */
+struct render_pass {
+  char name[PASS_NAME_SIZE]; /**< Name used to refer to the pass. */
+  char filename[PATH_MAX];   /**< Source file of the fragment shader, or
+                                shared library of the kernel. */
+  struct shader_state shader; /**< Program of the pass. */
+  bool native; /**< The pass runs a kernel instead of a shader. */
+  struct cpu_kernel kernel; /**< Kernel of a native pass. */
+  char input_names[MAX_PASS_INPUTS][PASS_NAME_SIZE]; /**< Declared inputs. */
+  size_t num_inputs;             /**< Number of inputs. */
+  size_t inputs[MAX_PASS_INPUTS]; /**< Indices of the input passes, of
+                                     the image textures or of the
+                                     streams. */
+  enum input_kind input_kinds[MAX_PASS_INPUTS]; /**< Kind of each
+                                                   input. */
+  bool active;  /**< The output of the pass is used, directly or not, by
+                   the screen pass. */
+  size_t target; /**< Index of the render target written by the pass. */
+  bool feedback; /**< The pass reads its own output of the previous frame. */
+  size_t history; /**< Index of the render target holding the output of
+                     the previous frame, for feedback passes. */
+  unsigned int bound_program; /**< Program whose samplers are bound. */
+  enum target_format format; /**< Format of the render target. */
+  enum target_filter filter; /**< Filtering of the render target. */
+};
+
+/**
+ * Render graph: the passes of a frame, ordered by their dependencies.
+ *
+ * Passes whose output does not reach the screen pass are culled.
+ * Render targets are shared by passes whose outputs are never needed
+ * at the same time, so that the number of textures is the maximum
+ * number of intermediate results alive at once, not the number of
+ * passes. Only targets with the same format and filtering are shared.
+ * Passes reading their own output own two targets, swapped
+ * every frame, which are never shared.
+ */
+struct render_graph {
+  struct render_pass passes[MAX_PASSES]; /**< Declared passes. */
+  size_t num_passes;                     /**< Number of declared passes. */
+  size_t order[MAX_PASSES]; /**< Active passes, in execution order. The
+                               screen pass comes last. */
+  size_t num_active;        /**< Number of active passes. */
+  struct render_target targets[MAX_TARGETS]; /**< Intermediate textures. */
+  size_t num_targets;       /**< Number of intermediate textures. */
+  int width;                /**< Width of the render targets. */
+  int height;               /**< Height of the render targets. */
+  char texture_names[MAX_TEXTURES][PASS_NAME_SIZE]; /**< Names of the
+                                                       image textures. */
+  struct image_texture textures[MAX_TEXTURES]; /**< Image inputs. */
+  size_t num_textures;      /**< Number of image textures. */
+  char stream_names[MAX_STREAMS][PASS_NAME_SIZE]; /**< Names of the data
+                                                     streams. */
+  struct data_stream streams[MAX_STREAMS]; /**< Data stream inputs. */
+  size_t num_streams;       /**< Number of data streams. */
+};
+
+const struct format_info *graph_format_info(enum target_format format);
+struct render_pass *graph_add_pass(struct render_graph *graph,
+                                   const char *name, const char *filename);
+struct render_pass *graph_find_pass(struct render_graph *graph,
+                                    const char *name);
+struct image_texture *graph_add_texture(struct render_graph *graph,
+                                        const char *name,
+                                        const char *filename);
+struct image_texture *graph_find_texture(struct render_graph *graph,
+                                         const char *name);
+struct data_stream *graph_add_stream(struct render_graph *graph,
+                                     const char *name, const char *filename);
+struct data_stream *graph_find_stream(struct render_graph *graph,
+                                      const char *name);
+int graph_set_inputs(struct render_pass *pass, const char *inputs);
+int graph_parse_pass(struct render_graph *graph, const char *spec,
+                     const char *base_dir);
+int graph_load_manifest(struct render_graph *graph, const char *filename);
+int graph_build(struct render_graph *graph);
+int graph_initialize_targets(struct render_graph *graph, int width,
+                             int height);
+int graph_resize_targets(struct render_graph *graph, int width, int height);
+struct render_pass *graph_screen(struct render_graph *graph);
+void graph_clear_targets(struct render_graph *graph);
+void graph_bind_inputs(struct render_graph *graph, struct render_pass *pass);
+void graph_bind_program_inputs(struct render_graph *graph,
+                               const struct render_pass *pass,
+                               const struct uniform_cache *uniforms);
+
+#endif /* GRAPH_H */
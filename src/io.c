@@ -1,18 +1,14 @@
-#include <FreeImage.h>
-#include <errno.h>
 #include <libgen.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/inotify.h>
 #include <time.h>
-#include <unistd.h>
 
+#include "capture.h"
 #include "log.h"
+#include "preprocess.h"
 #include "renderer.h"
 #include "shaders.h"
 
-#define BUF_LEN (10 * (sizeof(struct inotify_event) + 1))
-
 /**
  * @brief Return the file name without the leading directories and
  * without the extension.
@@ -37,9 +33,10 @@ char *basename_without_suffix(const char *filename) {
 /**
  * @brief Capture a screenshot of the current window.
  *
- * Takes the dimensions of the viewport to save a pixel array of the
- * same dimensions. Uses FreeImage to create an image from the raw
- * pixels and save it to disk.
+ * Takes the dimensions of the viewport to read a pixel array of the
+ * same dimensions from the current framebuffer. The pixels are read
+ * back asynchronously and saved to disk by a background thread, so
+ * the render loop does not wait for the GPU or the PNG encoder.
  *
  * @param state The renderer state, needed to get the name of the
  * current shader and the frame count.
@@ -49,32 +46,105 @@ void capture_screenshot(struct renderer_state *state) {
   struct tm *timenow = gmtime(&now);
   char image_filename[255] = {0};
   char *shader_basename =
-      basename_without_suffix(state->screen_shader.filename);
+      basename_without_suffix(graph_screen(&state->graph)->filename);
   snprintf(image_filename, sizeof(image_filename),
            "%s_%zu_%d%02d%02d_%02d%02d%02d.png", shader_basename,
            state->frame_count, timenow->tm_year + 1900, timenow->tm_mon,
            timenow->tm_mday, timenow->tm_hour, timenow->tm_min,
            timenow->tm_sec);
 
-  int viewport[4] = {0};
-  glGetIntegerv(GL_VIEWPORT, viewport);
-
-  GLubyte *pixels = calloc(3 * viewport[2] * viewport[3], 1);
-  glReadPixels(0, 0, viewport[2], viewport[3], GL_BGR, GL_UNSIGNED_BYTE,
-               pixels);
+  capture_request(&state->capture, image_filename);
+}
 
-  FIBITMAP *image = FreeImage_ConvertFromRawBits(
-      pixels, viewport[2], viewport[3], 3 * viewport[2], 24, FI_RGBA_RED_MASK,
-      FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, false);
+/**
+ * @brief Restart the time and frame count from zero, and the feedback
+ * passes from a black image.
+ *
+ * @param state The current state of the renderer.
+ */
+static void reset_time(struct renderer_state *state) {
+  state->frame_count = 0;
+  state->prev_frame_count = 0;
+  glfwSetTime(0.0);
+  state->time = 0.0;
+  state->prev_time = 0.0;
+  graph_clear_targets(&state->graph);
+  progressive_restart(&state->progressive);
+  state->redraw = true;
+}
 
-  if (FreeImage_Save(FIF_PNG, image, image_filename, 0)) {
-    log_debug("Image saved to %s", image_filename);
-  } else {
-    log_error("Failed to saved image to %s", image_filename);
+/**
+ * @brief Reload the passes, as asked through the control socket.
+ *
+ * @param state The current state of the renderer.
+ * @param name The pass to reload, or an empty string for all of them.
+ */
+static void control_reload(struct renderer_state *state, const char *name) {
+  if (name[0] == '\0') {
+    log_info("Reloading shaders");
+    if (!reload_shaders(state, NULL)) {
+      reset_time(state);
+    }
+    return;
+  }
+  bool changed[MAX_PASSES] = {false};
+  struct render_pass *pass = graph_find_pass(&state->graph, name);
+  const struct shader_sources *sources = &pass->shader.sources;
+  for (size_t i = 0; i < sources->count; ++i) {
+    source_cache_invalidate(sources->files[i]);
+  }
+  changed[pass - state->graph.passes] = true;
+  log_info("Reloading pass %s", name);
+  if (!reload_shaders(state, changed)) {
+    reset_time(state);
   }
+}
 
-  FreeImage_Unload(image);
-  free(pixels);
+/**
+ * @brief Run the commands received through the control socket since
+ * the last frame.
+ *
+ * The commands were checked by the control thread, only the errors
+ * that depend on the state of the renderer are left to report.
+ *
+ * @param state The current state of the renderer.
+ */
+static void run_control_commands(struct renderer_state *state) {
+  struct control_command command;
+  while (control_pop(&state->control, &command)) {
+    switch (command.type) {
+    case CONTROL_SET:
+      control_set_uniform(&state->control, &command);
+      state->redraw = true;
+      break;
+    case CONTROL_RELOAD:
+      control_reload(state, command.name);
+      break;
+    case CONTROL_CAPTURE:
+      state->screenshot_requested = true;
+      state->redraw = true;
+      break;
+    case CONTROL_PAUSE:
+      state->paused = true;
+      break;
+    case CONTROL_RESUME:
+      /* Continue from the time where it was paused */
+      glfwSetTime(state->time);
+      state->paused = false;
+      state->steps = 0;
+      state->redraw = true;
+      break;
+    case CONTROL_STEP:
+      state->paused = true;
+      state->steps += command.count;
+      state->redraw = true;
+      break;
+    case CONTROL_QUIT:
+      log_info("Quitting");
+      glfwSetWindowShouldClose(state->window, true);
+      break;
+    }
+  }
 }
 
 /**
@@ -84,21 +154,25 @@ void capture_screenshot(struct renderer_state *state) {
  * @param state The current state of the renderer.
  */
 void process_input(struct renderer_state *state) {
-  bool should_reload = false;
+  /* Posters take a while, render one per key press, and switch
+     variants once per key press too */
+  static bool poster_key_down = false;
+  static bool variant_key_down = false;
+  bool changed[MAX_PASSES] = {false};
+  bool should_reload = watch_poll(&state->watcher, &state->graph, changed);
 
-  // Skip inotify checking if it's not available
-  if (state->inotify_fd != -1 &&
-      (state->screen_shader.wd != -1 || state->buffer_shader.wd != -1)) {
-    char buf[BUF_LEN] = {0};
-    int num_read = read(state->inotify_fd, buf, BUF_LEN);
-    if (num_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-      // No event, do nothing
-    } else if (num_read <= 0) {
-      log_error("[inotify] Could not read inotify state");
-    } else {
-      should_reload = true;
-    }
+  if (poll_shader_reload(state)) {
+    log_info("Shaders reloaded");
+    reset_time(state);
+  }
+  if (texture_loader_poll(&state->loader, state->graph.textures,
+                          state->graph.num_textures, false)) {
+    state->redraw = true;
+  }
+  if (stream_poll(state->graph.streams, state->graph.num_streams)) {
+    state->redraw = true;
   }
+  run_control_commands(state);
 
   if (glfwGetKey(state->window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
     log_info("Quitting");
@@ -110,20 +184,26 @@ void process_input(struct renderer_state *state) {
     } else {
       log_info("Reloading shaders");
     }
-    // reinitialize time and frame count
-    state->frame_count = 0;
-    state->prev_frame_count = 0;
-    glfwSetTime(0.0);
-    state->time = 0.0;
-    state->prev_time = 0.0;
-    // recompile shaders
-    compile_shaders(&state->screen_shader.program,
-                    state->screen_shader.filename);
-    if (state->buffer_shader.filename) {
-      compile_shaders(&state->buffer_shader.program,
-                      state->buffer_shader.filename);
+    // recompile shaders in the background, the current programs keep
+    // rendering until the new ones are linked
+    if (!reload_shaders(state, should_reload ? changed : NULL) &&
+        !should_reload) {
+      // nothing changed, but restart anyway when asked explicitly
+      reset_time(state);
     }
   } else if (glfwGetKey(state->window, GLFW_KEY_S) == GLFW_PRESS) {
-    capture_screenshot(state);
+    /* Captured once the frame is rendered, before swapping buffers */
+    state->screenshot_requested = true;
+  }
+
+  bool poster_key = glfwGetKey(state->window, GLFW_KEY_P) == GLFW_PRESS;
+  state->poster_requested |= poster_key && !poster_key_down;
+  poster_key_down = poster_key;
+
+  bool variant_key = glfwGetKey(state->window, GLFW_KEY_V) == GLFW_PRESS;
+  if (variant_key && !variant_key_down && !switch_variant(state)) {
+    // the programs were swapped, or there is no other variant
+    reset_time(state);
   }
+  variant_key_down = variant_key;
 }
@@ -0,0 +1,163 @@
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel.h"
+#include "log.h"
+
+/**
+ * Frame computed by a kernel, shared by the tasks of the pool.
+ */
+struct kernel_job {
+  const struct cpu_kernel *kernel; /**< Kernel being run. */
+  struct shadertool_frame frame;   /**< Uniforms of the frame. */
+  size_t columns;                  /**< Number of tiles in a row. */
+};
+
+/**
+ * @brief Check whether a pass file is a native kernel rather than a
+ * shader.
+ *
+ * @param filename The file of the pass.
+ * @return `true` if the file is a shared library.
+ */
+bool kernel_is_library(const char *filename) {
+  size_t length = strlen(filename);
+  return length > 3 && !strcmp(filename + length - 3, ".so");
+}
+
+/**
+ * @brief Load the kernel function of a shared library.
+ *
+ * When the kernel is already loaded, its library is closed before
+ * being opened again, since the dynamic loader would otherwise return
+ * the library already in memory instead of a rebuilt one. The pass
+ * keeps its last output until a library loads.
+ *
+ * @param kernel The kernel.
+ * @param filename The shared library.
+ * @return 0 on success, 1 on failure.
+ */
+int kernel_load(struct cpu_kernel *kernel, const char *filename) {
+  /* Without a slash, dlopen() would search the library path */
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s%s", strchr(filename, '/') ? "" : "./",
+           filename);
+  if (kernel->library) {
+    dlclose(kernel->library);
+    kernel->library = NULL;
+    kernel->run = NULL;
+  }
+
+  void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (library == NULL) {
+    log_error("Could not load kernel %s: %s", filename, dlerror());
+    return 1;
+  }
+  const int *version = dlsym(library, "shadertool_kernel_version");
+  /* POSIX idiom, ISO C has no conversion to function pointers */
+  shadertool_kernel_fn *run = NULL;
+  *(void **)&run = dlsym(library, "shadertool_kernel");
+  if (version == NULL || run == NULL) {
+    log_error("%s does not export shadertool_kernel_version and "
+              "shadertool_kernel",
+              filename);
+    dlclose(library);
+    return 1;
+  }
+  if (*version != SHADERTOOL_KERNEL_VERSION) {
+    log_error("%s implements version %d of the kernel interface, expected %d",
+              filename, *version, SHADERTOOL_KERNEL_VERSION);
+    dlclose(library);
+    return 1;
+  }
+  kernel->library = library;
+  kernel->run = run;
+  log_debug("Kernel %s loaded", filename);
+  return 0;
+}
+
+/**
+ * @brief Close the library of a kernel and free its output.
+ *
+ * @param kernel The kernel.
+ */
+void kernel_unload(struct cpu_kernel *kernel) {
+  if (kernel->library) {
+    dlclose(kernel->library);
+  }
+  free(kernel->pixels);
+  memset(kernel, 0, sizeof(*kernel));
+}
+
+/**
+ * @brief Compute one tile of the output, as a task of the pool.
+ *
+ * @param data The kernel_job.
+ * @param index The index of the tile, row by row from the bottom.
+ */
+static void kernel_tile(void *data, size_t index) {
+  const struct kernel_job *job = data;
+  const struct cpu_kernel *kernel = job->kernel;
+  struct shadertool_tile tile = {
+      .x = (index % job->columns) * KERNEL_TILE_SIZE,
+      .y = (index / job->columns) * KERNEL_TILE_SIZE,
+      .stride = (size_t)kernel->width * 4,
+  };
+  tile.width = kernel->width - tile.x;
+  tile.width = tile.width < KERNEL_TILE_SIZE ? tile.width : KERNEL_TILE_SIZE;
+  tile.height = kernel->height - tile.y;
+  tile.height = tile.height < KERNEL_TILE_SIZE ? tile.height : KERNEL_TILE_SIZE;
+  tile.pixels = kernel->pixels + tile.y * tile.stride + tile.x * 4;
+  kernel->run(&job->frame, &tile);
+}
+
+/**
+ * @brief Compute the output of a kernel for a frame, with all the
+ * threads of the pool.
+ *
+ * The output is split into square tiles, distributed by the
+ * work-stealing scheduler of the pool, so that expensive regions do
+ * not leave the other cores idle.
+ *
+ * @param kernel The kernel, loaded.
+ * @param pool The thread pool.
+ * @param globals The standard uniforms of the frame.
+ * @param width The width of the output.
+ * @param height The height of the output.
+ * @return 0 on success, 1 on failure.
+ */
+int kernel_run(struct cpu_kernel *kernel, struct thread_pool *pool,
+               const struct frame_globals *globals, int width, int height) {
+  if (kernel->run == NULL) {
+    return 1;
+  }
+  if (kernel->width != width || kernel->height != height) {
+    unsigned char *pixels =
+        realloc(kernel->pixels, (size_t)width * height * 4);
+    if (pixels == NULL) {
+      log_error("Failed to allocate the output of a kernel");
+      return 1;
+    }
+    kernel->pixels = pixels;
+    kernel->width = width;
+    kernel->height = height;
+  }
+
+  struct kernel_job job = {
+      .kernel = kernel,
+      .frame =
+          {
+              .time = globals->time,
+              .frame = globals->frame,
+              .resolution = {globals->resolution[0], globals->resolution[1]},
+              .mouse = {globals->mouse[0], globals->mouse[1]},
+          },
+      .columns = (width + KERNEL_TILE_SIZE - 1) / KERNEL_TILE_SIZE,
+  };
+  size_t rows = (height + KERNEL_TILE_SIZE - 1) / KERNEL_TILE_SIZE;
+  pool_run(pool, job.columns * rows, kernel_tile, &job);
+  return 0;
+}
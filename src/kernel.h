@@ -0,0 +1,31 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "kernel_api.h"
+#include "pool.h"
+#include "uniforms.h"
+
+#define KERNEL_TILE_SIZE 32 /**< Width and height of a kernel task. */
+
+/**
+ * Native CPU kernel computing the output of a pass, loaded from a
+ * shared library.
+ */
+struct cpu_kernel {
+  void *library;              /**< Handle of the library, or NULL. */
+  shadertool_kernel_fn *run;  /**< Kernel function of the library. */
+  unsigned char *pixels;      /**< RGBA output of the last run. */
+  int width;                  /**< Width of the output. */
+  int height;                 /**< Height of the output. */
+};
+
+bool kernel_is_library(const char *filename);
+int kernel_load(struct cpu_kernel *kernel, const char *filename);
+void kernel_unload(struct cpu_kernel *kernel);
+int kernel_run(struct cpu_kernel *kernel, struct thread_pool *pool,
+               const struct frame_globals *globals, int width, int height);
+
+#endif /* KERNEL_H */
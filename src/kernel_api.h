@@ -0,0 +1,54 @@
+#ifndef KERNEL_API_H
+#define KERNEL_API_H
+
+/*
+ * Interface of the native CPU kernels loaded by ShaderTool.
+ *
+ * A kernel is a shared library exporting:
+ *
+ *     const int shadertool_kernel_version = SHADERTOOL_KERNEL_VERSION;
+ *     void shadertool_kernel(const struct shadertool_frame *frame,
+ *                            const struct shadertool_tile *tile);
+ *
+ * The kernel function computes the pixels of one tile of the output
+ * of a pass. It is called concurrently from several threads, for
+ * distinct tiles of the same frame, so it must not modify global
+ * state.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHADERTOOL_KERNEL_VERSION 1 /**< Version of this interface. */
+
+/**
+ * Standard uniforms of the frame, as seen by the shaders.
+ */
+struct shadertool_frame {
+  float time;          /**< u_time */
+  uint32_t frame;      /**< u_frame */
+  float resolution[2]; /**< u_resolution */
+  float mouse[2];      /**< u_mouse */
+};
+
+/**
+ * Tile of the output to compute.
+ *
+ * Coordinates follow OpenGL: the origin is the bottom left corner, and
+ * the pixel (x, y) has its centre at `gl_FragCoord.xy` = (x + 0.5,
+ * y + 0.5).
+ */
+struct shadertool_tile {
+  int x;                 /**< Left column of the tile. */
+  int y;                 /**< Bottom row of the tile. */
+  int width;             /**< Width of the tile in pixels. */
+  int height;            /**< Height of the tile in pixels. */
+  unsigned char *pixels; /**< RGBA pixel (x, y), 4 bytes per pixel. */
+  size_t stride;         /**< Bytes from a row to the row above it. */
+};
+
+/** Signature of the `shadertool_kernel` function. */
+typedef void shadertool_kernel_fn(const struct shadertool_frame *frame,
+                                  const struct shadertool_tile *tile);
+
+#endif /* KERNEL_API_H */
@@ -128,10 +128,10 @@ int log_add_fp(FILE *fp, int level) {
 }
 
 
-static void init_event(log_Event *ev, void *udata) {
+static void init_event(log_Event *ev, void *udata, struct tm *tm) {
   if (!ev->time) {
     time_t t = time(NULL);
-    ev->time = localtime(&t);
+    ev->time = localtime_r(&t, tm);
   }
   ev->udata = udata;
 }
@@ -144,11 +144,12 @@ void log_log(int level, const char *file, int line, const char *fmt, ...) {
     .line  = line,
     .level = level,
   };
+  struct tm tm;
 
   lock();
 
   if (!L.quiet && level >= L.level) {
-    init_event(&ev, stderr);
+    init_event(&ev, stderr, &tm);
     va_start(ev.ap, fmt);
     stdout_callback(&ev);
     va_end(ev.ap);
@@ -157,7 +158,7 @@ void log_log(int level, const char *file, int line, const char *fmt, ...) {
   for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
     Callback *cb = &L.callbacks[i];
     if (level >= cb->level) {
-      init_event(&ev, cb->udata);
+      init_event(&ev, cb->udata, &tm);
       va_start(ev.ap, fmt);
       cb->fn(&ev);
       va_end(ev.ap);
@@ -1,32 +1,156 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <argp.h>
-#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <sys/inotify.h>
 
+#include "benchmark.h"
+#include "cache.h"
+#include "capture.h"
+#include "export.h"
+#include "golden.h"
+#include "graph.h"
 #include "io.h"
 #include "log.h"
+#include "profile.h"
+#include "poster.h"
 #include "renderer.h"
+#include "resolution.h"
 #include "shaders.h"
+#include "timing.h"
 
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 800
+#define IDLE_POLL_INTERVAL 0.05 /**< Seconds between checks for changed
+                                   files while waiting for events. */
 
 const char *argp_program_version = "0.1";
 const char *argp_program_bug_address =
     "https://github.com/dlozeve/ShaderTool/issues";
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static char doc[] =
     "ShaderTool -- Live tool for developing OpenGL shaders interactively";
 static char args_doc[] = "SHADER\v"
                          "Compile and render the SHADER.";
 
+enum {
+  OPT_HEADLESS = 0x100,
+  OPT_FRAMES,
+  OPT_SIZE,
+  OPT_FPS,
+  OPT_EXPORT_FORMAT,
+  OPT_CACHE_DIR,
+  OPT_NO_CACHE,
+  OPT_TEXTURE_CACHE_SIZE,
+  OPT_TRACE,
+  OPT_BENCHMARK,
+  OPT_BENCHMARK_FORMAT,
+  OPT_PASS,
+  OPT_MANIFEST,
+  OPT_INPUTS,
+  OPT_SCALE,
+  OPT_DYNAMIC_RESOLUTION,
+  OPT_PROGRESSIVE,
+  OPT_POSTER,
+  OPT_POSTER_SIZE,
+  OPT_VARIANT,
+  OPT_GOLDEN,
+  OPT_GOLDEN_FRAMES,
+  OPT_GOLDEN_TOLERANCE,
+  OPT_GOLDEN_UPDATE,
+  OPT_CONTROL,
+};
+
 static struct argp_option options[] = {
     {"verbose", 'v', 0, 0, "Produce verbose output", 0},
     {"silent", 's', 0, 0, "Don't produce any output", 0},
     {"quiet", 'q', 0, OPTION_ALIAS, 0, 0},
     {"auto-reload", 'r', 0, 0, "Automatically reload on save", 0},
-    {"buffer", 'b', "FILE", 0, "Source file of the buffer fragment shader", 0},
+    {"buffer", 'b', "FILE", 0,
+     "Source file of the buffer fragment shader, a pass named buffer", 0},
+    {"pass", OPT_PASS, "SPEC", 0,
+     "Add a buffer pass, declared as \"NAME FILE [inputs=A,B] [format=F] "
+     "[filter=F]\", an image input if FILE is an image, or a data stream "
+     "if FILE is a FIFO or a socket",
+     0},
+    {"manifest", OPT_MANIFEST, "FILE", 0,
+     "Read pass declarations from FILE, one per line; a pass named screen "
+     "replaces SHADER",
+     0},
+    {"inputs", OPT_INPUTS, "A,B", 0,
+     "Passes read by the screen shader (default: the buffer pass)", 0},
+    {"define", 'D', "NAME[=VALUE]", 0,
+     "Define NAME in the fragment shaders, after the #version line", 0},
+    {"variant", OPT_VARIANT, "NAME=VALUE,...", 0,
+     "Add a variant of the shaders with these definitions, on top of the -D "
+     "ones; V switches to the next variant",
+     0},
+    {"size", OPT_SIZE, "WxH", 0, "Size of the rendered image (default 800x800)",
+     0},
+    {"scale", OPT_SCALE, "FACTOR", 0,
+     "Render the passes at FACTOR times the output size, between 0.25 and 1 "
+     "(default 1)",
+     0},
+    {"dynamic-resolution", OPT_DYNAMIC_RESOLUTION, "MS", 0,
+     "Lower the render scale when frames take more than MS milliseconds", 0},
+    {"progressive", OPT_PROGRESSIVE, "MS", 0,
+     "Draw each frame in tiles over several iterations of about MS "
+     "milliseconds, for very slow shaders",
+     0},
+    {"poster", OPT_POSTER, "FILE", 0,
+     "Render the last frame, or the frame when P is pressed, as a PNG "
+     "image of any size in FILE",
+     0},
+    {"poster-size", OPT_POSTER_SIZE, "WxH", 0,
+     "Size of the poster (default four times the size of the frames)", 0},
+    {"headless", OPT_HEADLESS, 0, 0,
+     "Render offscreen without a window and save the last frame", 0},
+    {"frames", OPT_FRAMES, "N", 0,
+     "Number of frames to render in headless mode (default 1)", 0},
+    {"fps", OPT_FPS, "RATE", 0,
+     "Frame rate used to compute the time in headless mode (default 60)", 0},
+    {"export", 'o', "PATH", 0,
+     "Export every rendered frame to PATH: a file name pattern such as "
+     "frame_%05d.png, a .y4m file, or - for raw RGB on stdout",
+     0},
+    {"export-format", OPT_EXPORT_FORMAT, "FORMAT", 0,
+     "Export format: images, raw, or y4m (default: guessed from PATH)", 0},
+    {"cache-dir", OPT_CACHE_DIR, "DIR", 0,
+     "Cache directory (default $XDG_CACHE_HOME/shadertool)", 0},
+    {"no-cache", OPT_NO_CACHE, 0, 0,
+     "Do not cache compiled shader programs and decoded images", 0},
+    {"texture-cache-size", OPT_TEXTURE_CACHE_SIZE, "MIB", 0,
+     "Size limit of the decoded image cache, in MiB (default 1024)", 0},
+    {"benchmark", OPT_BENCHMARK, "N", 0,
+     "Render N frames with vsync off after a warm-up, report the frame "
+     "times, and exit",
+     0},
+    {"benchmark-format", OPT_BENCHMARK_FORMAT, "FORMAT", 0,
+     "Benchmark report format: human, json, or csv (default human)", 0},
+    {"golden", OPT_GOLDEN, "DIR", 0,
+     "Render headless, compare the frames to the reference images "
+     "DIR/SHADER_FRAME.png, and fail if they differ",
+     0},
+    {"golden-frames", OPT_GOLDEN_FRAMES, "LIST", 0,
+     "Frames compared by --golden, such as 0,30,100-200 (default: all the "
+     "rendered frames)",
+     0},
+    {"golden-tolerance", OPT_GOLDEN_TOLERANCE, "MAX", 0,
+     "Largest channel difference accepted by --golden, from 0 to 255 "
+     "(default 0)",
+     0},
+    {"golden-update", OPT_GOLDEN_UPDATE, 0, 0,
+     "Write the reference images of --golden instead of comparing them", 0},
+    {"control", OPT_CONTROL, "PATH", 0,
+     "Listen for commands on the Unix socket PATH", 0},
+    {"trace", OPT_TRACE, "FILE", 0,
+     "On exit, write the timings of the last frames to FILE as a Chrome "
+     "trace",
+     0},
     {0},
 };
 
@@ -36,6 +160,32 @@ struct arguments {
   bool silent;
   bool autoreload;
   char *buffer_file;
+  char *pass_specs[MAX_PASSES];
+  size_t num_pass_specs;
+  char *manifest;
+  char *screen_inputs;
+  struct shader_variants variants;
+  double scale;
+  double target_frame_time;
+  double progressive;
+  char *poster;
+  int poster_width;
+  int poster_height;
+  int width;
+  int height;
+  bool headless;
+  size_t frames;
+  double fps;
+  char *export_path;
+  enum export_format export_format;
+  char *cache_dir;
+  bool no_cache;
+  size_t texture_cache_size;
+  char *trace_file;
+  size_t benchmark;
+  enum benchmark_format benchmark_format;
+  struct golden_state golden;
+  char *control_path;
 };
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -55,6 +205,83 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case 'b':
     arguments->buffer_file = arg;
     break;
+  case OPT_PASS:
+    if (arguments->num_pass_specs >= MAX_PASSES) {
+      argp_error(state, "too many passes, at most %d are supported",
+                 MAX_PASSES);
+    }
+    arguments->pass_specs[arguments->num_pass_specs++] = arg;
+    break;
+  case OPT_MANIFEST:
+    arguments->manifest = arg;
+    break;
+  case OPT_INPUTS:
+    arguments->screen_inputs = arg;
+    break;
+  case 'D':
+    if (variants_define(&arguments->variants, arg)) {
+      argp_error(state, "invalid definition '%s', expected NAME[=VALUE]",
+                 arg);
+    }
+    break;
+  case OPT_VARIANT:
+    if (arguments->variants.count >= MAX_VARIANTS) {
+      argp_error(state, "too many variants, at most %d are supported",
+                 MAX_VARIANTS);
+    }
+    if (variants_add(&arguments->variants, arg)) {
+      argp_error(state, "invalid variant '%s', expected NAME=VALUE,...", arg);
+    }
+    break;
+  case OPT_SCALE:
+    arguments->scale = strtod(arg, NULL);
+    if (arguments->scale < RESOLUTION_MIN_SCALE || arguments->scale > 1) {
+      argp_error(state, "invalid render scale '%s'", arg);
+    }
+    break;
+  case OPT_DYNAMIC_RESOLUTION:
+    arguments->target_frame_time = strtod(arg, NULL);
+    if (arguments->target_frame_time <= 0) {
+      argp_error(state, "invalid frame time '%s'", arg);
+    }
+    break;
+  case OPT_PROGRESSIVE:
+    arguments->progressive = strtod(arg, NULL);
+    if (arguments->progressive <= 0) {
+      argp_error(state, "invalid iteration time '%s'", arg);
+    }
+    break;
+  case OPT_SIZE:
+    if (sscanf(arg, "%dx%d", &arguments->width, &arguments->height) != 2 ||
+        arguments->width <= 0 || arguments->height <= 0) {
+      argp_error(state, "invalid size '%s', expected WIDTHxHEIGHT", arg);
+    }
+    break;
+  case OPT_POSTER:
+    arguments->poster = arg;
+    break;
+  case OPT_POSTER_SIZE:
+    if (sscanf(arg, "%dx%d", &arguments->poster_width,
+               &arguments->poster_height) != 2 ||
+        arguments->poster_width <= 0 || arguments->poster_height <= 0) {
+      argp_error(state, "invalid size '%s', expected WIDTHxHEIGHT", arg);
+    }
+    break;
+  case OPT_HEADLESS:
+    arguments->headless = true;
+    break;
+  case OPT_FRAMES:
+    arguments->frames = strtoul(arg, NULL, 10);
+    if (arguments->frames == 0) {
+      argp_error(state, "invalid number of frames '%s'", arg);
+    }
+    break;
+  case OPT_FPS:
+    arguments->fps = strtod(arg, NULL);
+    if (arguments->fps <= 0) {
+      argp_error(state, "invalid frame rate '%s'", arg);
+    }
+    break;
 
   case ARGP_KEY_ARG:
     if (state->arg_num >= 1) {
@@ -65,10 +292,94 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     break;
 
   case ARGP_KEY_END:
-    if (state->arg_num < 1) {
+    if (state->arg_num < 1 && !arguments->manifest) {
       /* Not enough arguments */
       argp_usage(state);
     }
+    if (arguments->progressive && arguments->target_frame_time) {
+      argp_error(state,
+                 "--progressive and --dynamic-resolution cannot be combined");
+    }
+    if (!arguments->golden.dir &&
+        (arguments->golden.update || arguments->golden.num_ranges)) {
+      argp_error(state, "--golden-frames and --golden-update require "
+                        "--golden");
+    }
+    if (arguments->golden.dir && arguments->benchmark) {
+      argp_error(state, "--golden and --benchmark cannot be combined");
+    }
+    if (arguments->control_path &&
+        (arguments->headless || arguments->golden.dir ||
+         arguments->benchmark)) {
+      argp_error(state, "--control needs a window, it cannot be combined "
+                        "with --headless, --golden or --benchmark");
+    }
+    break;
+
+  case 'o':
+    arguments->export_path = arg;
+    break;
+  case OPT_EXPORT_FORMAT:
+    arguments->export_format = export_format_from_string(arg);
+    if (arguments->export_format == EXPORT_NONE) {
+      argp_error(state, "unknown export format '%s'", arg);
+    }
+    break;
+
+  case OPT_CACHE_DIR:
+    arguments->cache_dir = arg;
+    break;
+  case OPT_NO_CACHE:
+    arguments->no_cache = true;
+    break;
+  case OPT_TEXTURE_CACHE_SIZE: {
+    char *end = NULL;
+    long long size = strtoll(arg, &end, 10);
+    if (end == arg || *end || size < 0 ||
+        (unsigned long long)size > SIZE_MAX >> 20) {
+      argp_error(state, "invalid cache size '%s'", arg);
+    }
+    arguments->texture_cache_size = (size_t)size << 20;
+    break;
+  }
+  case OPT_TRACE:
+    arguments->trace_file = arg;
+    break;
+  case OPT_BENCHMARK:
+    arguments->benchmark = strtoul(arg, NULL, 10);
+    if (arguments->benchmark == 0) {
+      argp_error(state, "invalid number of frames '%s'", arg);
+    }
+    break;
+  case OPT_BENCHMARK_FORMAT:
+    arguments->benchmark_format = benchmark_format_from_string(arg);
+    if (arguments->benchmark_format == BENCHMARK_NONE) {
+      argp_error(state, "unknown benchmark format '%s'", arg);
+    }
+    break;
+
+  case OPT_GOLDEN:
+    arguments->golden.dir = arg;
+    break;
+  case OPT_GOLDEN_FRAMES:
+    if (golden_parse_frames(&arguments->golden, arg)) {
+      argp_error(state, "invalid frame list '%s', expected N,A-B,...", arg);
+    }
+    break;
+  case OPT_GOLDEN_TOLERANCE: {
+    char *end = NULL;
+    long tolerance = strtol(arg, &end, 10);
+    if (end == arg || *end || tolerance < 0 || tolerance > 255) {
+      argp_error(state, "invalid tolerance '%s'", arg);
+    }
+    arguments->golden.tolerance = (int)tolerance;
+    break;
+  }
+  case OPT_GOLDEN_UPDATE:
+    arguments->golden.update = true;
+    break;
+  case OPT_CONTROL:
+    arguments->control_path = arg;
     break;
 
   default:
@@ -77,6 +388,158 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   return 0;
 }
 
+/**
+ * @brief Declare the passes of the render graph from the command
+ * line, and build the graph.
+ *
+ * Passes come from the manifest, then from the `--pass` options. The
+ * `--buffer` option declares a pass named `buffer`, reading its own
+ * previous frame, and read by the screen pass unless `--inputs` says
+ * otherwise.
+ *
+ * @param graph The render graph to fill.
+ * @param arguments The parsed command line.
+ * @return 0 on success, 1 on failure.
+ */
+static int build_render_graph(struct render_graph *graph,
+                              const struct arguments *arguments) {
+  if (arguments->manifest &&
+      graph_load_manifest(graph, arguments->manifest)) {
+    return 1;
+  }
+  for (size_t i = 0; i < arguments->num_pass_specs; ++i) {
+    if (graph_parse_pass(graph, arguments->pass_specs[i], NULL)) {
+      return 1;
+    }
+  }
+  if (arguments->buffer_file) {
+    /* The buffer pass reads its previous frame, as u_texture */
+    struct render_pass *buffer =
+        graph_add_pass(graph, "buffer", arguments->buffer_file);
+    if (buffer == NULL || graph_set_inputs(buffer, "buffer")) {
+      return 1;
+    }
+  }
+
+  struct render_pass *screen = graph_screen(graph);
+  if (arguments->shader_file) {
+    if (screen == NULL) {
+      screen = graph_add_pass(graph, SCREEN_PASS, arguments->shader_file);
+      if (screen == NULL) {
+        return 1;
+      }
+    } else {
+      snprintf(screen->filename, sizeof(screen->filename), "%s",
+               arguments->shader_file);
+    }
+  }
+  if (screen && arguments->screen_inputs) {
+    if (graph_set_inputs(screen, arguments->screen_inputs)) {
+      return 1;
+    }
+  } else if (screen && arguments->buffer_file && screen->num_inputs == 0) {
+    graph_set_inputs(screen, "buffer");
+  }
+
+  return graph_build(graph);
+}
+
+/**
+ * @brief Lock callback of the logger, so that the records of the
+ * background threads do not interleave.
+ *
+ * @param lock `true` to acquire the lock, `false` to release it.
+ * @param udata The mutex.
+ */
+static void log_lock(bool lock, void *udata) {
+  if (lock) {
+    pthread_mutex_lock(udata);
+  } else {
+    pthread_mutex_unlock(udata);
+  }
+}
+
+/**
+ * @brief Sleep until the window must be redrawn.
+ *
+ * Used when the shaders are static: the image only changes on input,
+ * resize, or when the shaders are reloaded. Without file watching or
+ * background compilation, the loop blocks until the next event.
+ * Otherwise, it wakes up regularly to check the watched files and the
+ * pending compilations.
+ *
+ * @param state The renderer state.
+ */
+static void wait_for_redraw(struct renderer_state *state) {
+  while (!state->redraw && !state->screenshot_requested &&
+         !state->poster_requested && !glfwWindowShouldClose(state->window)) {
+    if (state->watcher.fd != -1 || shaders_compiling(state) ||
+        texture_loader_busy(state->graph.textures,
+                            state->graph.num_textures)) {
+      glfwWaitEventsTimeout(IDLE_POLL_INTERVAL);
+    } else {
+      glfwWaitEvents();
+    }
+    process_input(state);
+  }
+}
+
+/**
+ * @brief GPU time of all the passes of the last measured frame.
+ *
+ * @param state The renderer state.
+ * @return The time in milliseconds.
+ */
+static double frame_gpu_time(const struct renderer_state *state) {
+  double gpu = 0;
+  const struct render_graph *graph = &state->graph;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    gpu += graph->passes[graph->order[k]].shader.timer.stats.last_ms;
+  }
+  return gpu;
+}
+
+/**
+ * @brief Cost of the last frame, used to choose the render scale.
+ *
+ * This is the largest of the CPU time of the frame and the GPU time
+ * of all its passes, since either can be the bottleneck.
+ *
+ * @param state The renderer state.
+ * @return The cost in milliseconds.
+ */
+static double frame_cost(const struct renderer_state *state) {
+  return fmax(frame_gpu_time(state), state->cpu_frame.last_ms);
+}
+
+/**
+ * @brief Log the average CPU time of a frame and the average GPU time
+ * of each pass.
+ *
+ * The CPU time covers everything the render loop does for a frame,
+ * except waiting for the buffer swap.
+ *
+ * @param state The renderer state.
+ * @param interval Average over the interval since the last log, and
+ * start a new interval, instead of averaging over the whole run.
+ */
+static void log_timings(struct renderer_state *state, bool interval) {
+  double cpu = interval ? timing_stats_interval(&state->cpu_frame)
+                        : timing_stats_mean(&state->cpu_frame);
+  char passes[MAX_PASSES * (PASS_NAME_SIZE + 24)] = {0};
+  size_t length = 0;
+  struct render_graph *graph = &state->graph;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    struct render_pass *pass = &graph->passes[graph->order[k]];
+    double gpu = interval ? timing_stats_interval(&pass->shader.timer.stats)
+                          : timing_stats_mean(&pass->shader.timer.stats);
+    length += snprintf(passes + length, sizeof(passes) - length,
+                       ", gpu %s = %.3f ms", pass->name, gpu);
+  }
+  log_info("%s: cpu = %.3f ms%s",
+           interval ? "frame time" : "average frame time", cpu, passes);
+}
+
 static struct argp argp_parser = {
     .options = options, .parser = parse_opt, .args_doc = args_doc, .doc = doc};
 
@@ -87,9 +550,57 @@ int main(int argc, char *argv[]) {
   arguments.silent = false;
   arguments.autoreload = false;
   arguments.buffer_file = 0;
+  arguments.num_pass_specs = 0;
+  arguments.manifest = 0;
+  arguments.screen_inputs = 0;
+  arguments.scale = 1.0;
+  arguments.target_frame_time = 0;
+  arguments.progressive = 0;
+  arguments.poster = 0;
+  arguments.poster_width = 0;
+  arguments.poster_height = 0;
+  arguments.width = WINDOW_WIDTH;
+  arguments.height = WINDOW_HEIGHT;
+  arguments.headless = false;
+  arguments.frames = 1;
+  arguments.fps = 60.0;
+  arguments.export_path = 0;
+  arguments.export_format = EXPORT_NONE;
+  arguments.cache_dir = 0;
+  arguments.no_cache = false;
+  arguments.texture_cache_size = (size_t)TEXTURE_CACHE_SIZE << 20;
+  arguments.trace_file = 0;
+  arguments.benchmark = 0;
+  arguments.benchmark_format = BENCHMARK_HUMAN;
+  arguments.control_path = 0;
 
   argp_parse(&argp_parser, argc, argv, 0, 0, &arguments);
+  if (!arguments.poster_width) {
+    arguments.poster_width = 4 * arguments.width;
+    arguments.poster_height = 4 * arguments.height;
+  }
+
+  struct benchmark_state benchmark = {
+      .frames = arguments.benchmark,
+      .warmup = BENCHMARK_WARMUP,
+      .format = arguments.benchmark_format,
+  };
+  if (benchmark.frames) {
+    arguments.frames = benchmark.warmup + benchmark.frames;
+  }
 
+  /* Golden runs are headless, so that the frames only depend on their
+     index, and render at least up to the last requested frame */
+  struct golden_state golden = arguments.golden;
+  if (golden.dir) {
+    arguments.headless = true;
+    if (golden.num_ranges && arguments.frames <= golden_last_frame(&golden)) {
+      arguments.frames = golden_last_frame(&golden) + 1;
+    }
+  }
+
+  /* Before any thread starts */
+  log_set_lock(log_lock, &log_mutex);
   if (arguments.silent) {
     log_set_level(LOG_ERROR);
   } else if (arguments.verbose) {
@@ -99,118 +610,262 @@ int main(int argc, char *argv[]) {
   }
 
   struct renderer_state state = {0};
+  if (build_render_graph(&state.graph, &arguments)) {
+    return EXIT_FAILURE;
+  }
 
+  state.variants = arguments.variants;
+  state.watcher.fd = -1;
   if (arguments.autoreload) {
-    /* Create inotify instance */
-    state.inotify_fd = inotify_init();
-    if (state.inotify_fd == -1) {
-      log_warn("[inotify] Cannot initialize inotify");
-      perror("inotify_init");
-    } else {
-      /* Set the inotify file descriptor to be non-blocking */
-      if (!fcntl(state.inotify_fd, F_SETFL, O_NONBLOCK)) {
-        log_debug("[inotify] Initialized successfully");
-      }
+    watch_init(&state.watcher);
+  }
+
+  if (arguments.headless) {
+    if (initialize_headless_context(&state, arguments.width,
+                                    arguments.height)) {
+      return EXIT_FAILURE;
     }
   } else {
-    state.inotify_fd = -1;
+    state.window = initialize_window(arguments.width, arguments.height);
+    if (state.window == NULL) {
+      glfwTerminate();
+      return EXIT_FAILURE;
+    }
+    if (benchmark.frames) {
+      glfwSwapInterval(0);
+    }
+    glfwSetWindowUserPointer(state.window, &state);
+    glfwGetFramebufferSize(state.window, &state.width, &state.height);
+  }
+  resolution_init(&state.resolution, arguments.target_frame_time,
+                  arguments.scale);
+  progressive_init(&state.progressive, arguments.progressive);
+
+  state.vao = initialize_vertices();
+
+  char cache_dir[PATH_MAX] = {0};
+  if (arguments.cache_dir) {
+    snprintf(cache_dir, sizeof(cache_dir), "%s", arguments.cache_dir);
+  } else if (default_cache_dir(cache_dir, sizeof(cache_dir))) {
+    arguments.no_cache = true;
   }
+  program_cache_init(arguments.no_cache ? NULL : cache_dir);
+  texture_cache_init(arguments.no_cache ? NULL : cache_dir,
+                     arguments.texture_cache_size);
 
-  state.window = initialize_window(WINDOW_WIDTH, WINDOW_HEIGHT);
-  if (state.window == NULL) {
-    glfwTerminate();
+  if (capture_init(&state.capture)) {
+    terminate_context(&state);
     return EXIT_FAILURE;
   }
 
-  unsigned int VAO = initialize_vertices();
+  if (arguments.export_path) {
+    enum export_format format =
+        arguments.export_format != EXPORT_NONE
+            ? arguments.export_format
+            : export_guess_format(arguments.export_path);
+    if (export_init(&state.export, format, arguments.export_path,
+                    arguments.fps)) {
+      capture_finish(&state.capture);
+      terminate_context(&state);
+      return EXIT_FAILURE;
+    }
+  }
 
-  int err =
-      initialize_shaders(&state, arguments.shader_file, arguments.buffer_file,
-                         WINDOW_WIDTH, WINDOW_HEIGHT);
+  int err = initialize_shaders(&state, arguments.width, arguments.height);
+  if (!err && (!state.window || benchmark.frames)) {
+    /* Frames must not depend on how long the images take to load */
+    texture_loader_poll(&state.loader, state.graph.textures,
+                        state.graph.num_textures, true);
+  }
+  if (!err && benchmark.frames && !shaders_ready(&state)) {
+    log_error("Cannot benchmark shaders that do not compile or whose images "
+              "do not load");
+    err = 1;
+  }
+  if (!err && golden.dir && !shaders_ready(&state)) {
+    log_error("Cannot check shaders that do not compile or whose images do "
+              "not load");
+    err = 1;
+  }
+  err = err || (golden.dir &&
+                golden_init(&golden, graph_screen(&state.graph)->filename));
+  err = err ||
+        (arguments.control_path && control_init(&state.control,
+                                                arguments.control_path,
+                                                &state.graph,
+                                                glfwPostEmptyEvent));
   if (err) {
-    glfwDestroyWindow(state.window);
-    glfwTerminate();
+    export_finish(&state.export);
+    capture_finish(&state.capture);
+    texture_loader_finish(&state.loader, state.graph.textures,
+                          state.graph.num_textures);
+    stream_close(state.graph.streams, state.graph.num_streams);
+    control_close(&state.control);
+    terminate_context(&state);
+    pool_destroy(&state.pool);
     return EXIT_FAILURE;
   }
 
-  /* Drawing loop */
-  glfwSetTime(0.0);
-  while (!glfwWindowShouldClose(state.window)) {
-    process_input(&state);
-
-    /* data required for uniforms */
-    state.time = glfwGetTime();
-    int viewport[4] = {0};
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    double mouse_x = 0, mouse_y = 0;
-    glfwGetCursorPos(state.window, &mouse_x, &mouse_y);
+  /* Drawing loop, profiled with a fixed memory footprint (a failure
+     to allocate the profile only disables profiling) */
+  profile_init(&state.profile);
+  if (state.window) {
+    glfwSetTime(0.0);
+  }
+  while (state.window ? !glfwWindowShouldClose(state.window) &&
+                            (!benchmark.frames ||
+                             state.frame_count < arguments.frames)
+                      : state.frame_count < arguments.frames) {
+    if (benchmark.frames && state.frame_count == benchmark.warmup) {
+      benchmark_start(&benchmark, &state);
+    }
+    double frame_start = timing_now();
+    profile_frame_begin(&state.profile, state.frame_count);
+    if (state.window) {
+      profile_phase_begin(&state.profile);
+      process_input(&state);
+      profile_phase_end(&state.profile, PHASE_INPUT);
+      if (!progressive_started(&state.progressive)) {
+        if (!state.paused) {
+          state.time = glfwGetTime();
+        } else if (state.steps) {
+          /* Paused through the control socket, each step advances the
+             time by one frame */
+          state.time += 1.0 / arguments.fps;
+          state.steps--;
+        }
+      }
+    } else {
+      /* Headless time only depends on the frame index, so that
+         renders are deterministic and faster than real time */
+      state.time = state.frame_count / arguments.fps;
+      stream_poll(state.graph.streams, state.graph.num_streams);
+    }
 
-    if (state.time - state.prev_time >= 1.0) {
+    if (state.window && state.time - state.prev_time >= 1.0) {
+      int viewport[4] = {0};
+      glGetIntegerv(GL_VIEWPORT, viewport);
       double fps = (state.frame_count - state.prev_frame_count) /
                    (state.time - state.prev_time);
-      log_info("frame = %zu, time = %.2f, fps = %.2f, viewport = (%d, %d)",
-               state.frame_count, state.time, fps, viewport[2], viewport[3]);
+      log_info("frame = %zu, time = %.2f, fps = %.2f, viewport = (%d, %d), "
+               "scale = %.2f",
+               state.frame_count, state.time, fps, viewport[2], viewport[3],
+               state.resolution.scale);
+      log_timings(&state, true);
       state.prev_frame_count = state.frame_count;
       state.prev_time = state.time;
     }
 
-    if (state.buffer_shader.filename) {
-      /* bind the framebuffer and draw to it */
-      glBindFramebuffer(GL_FRAMEBUFFER, state.framebuffer);
-
-      /* Background */
-      glClearColor(0, 0, 0, 1.0f);
-      glClear(GL_COLOR_BUFFER_BIT);
-
-      /* Setup uniforms */
-      glUseProgram(state.buffer_shader.program);
-      glUniform1ui(glGetUniformLocation(state.buffer_shader.program, "u_frame"),
-                   state.frame_count);
-      glUniform1f(glGetUniformLocation(state.buffer_shader.program, "u_time"),
-                  state.time);
-      glUniform2f(
-          glGetUniformLocation(state.buffer_shader.program, "u_resolution"),
-          viewport[2], viewport[3]);
-      glUniform2f(glGetUniformLocation(state.buffer_shader.program, "u_mouse"),
-                  mouse_x, mouse_y);
-
-      /* Draw the vertices */
-      glBindVertexArray(VAO);
-      glBindTexture(GL_TEXTURE_2D, state.texture_color_buffer);
-      glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-      glBindVertexArray(0);
-    }
-
-    /* bind back to default framebuffer */
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glClearColor(1.0, 1.0, 1.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    /* Setup uniforms */
-    glUseProgram(state.screen_shader.program);
-    glUniform1ui(glGetUniformLocation(state.screen_shader.program, "u_frame"),
-                 state.frame_count);
-    glUniform1f(glGetUniformLocation(state.screen_shader.program, "u_time"),
-                state.time);
-    glUniform2f(
-        glGetUniformLocation(state.screen_shader.program, "u_resolution"),
-        viewport[2], viewport[3]);
-    glUniform2f(glGetUniformLocation(state.screen_shader.program, "u_mouse"),
-                mouse_x, mouse_y);
-
-    /* Draw the vertices */
-    glBindVertexArray(VAO);
-    glBindTexture(GL_TEXTURE_2D, state.texture_color_buffer);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-
-    glfwSwapBuffers(state.window);
-    glfwPollEvents();
-    state.frame_count++;
-  }
-
-  glfwDestroyWindow(state.window);
-  glfwTerminate();
-  return EXIT_SUCCESS;
+    /* In progressive mode, only complete frames are saved and counted */
+    state.redraw = false;
+    bool complete = render_frame(&state);
+
+    profile_phase_begin(&state.profile);
+    if (complete) {
+      export_frame(&state.export, state.frame_count);
+      golden_frame(&golden, state.frame_count);
+    }
+    if (complete &&
+        (state.screenshot_requested ||
+         (!state.window && !state.export.initialized && !benchmark.frames &&
+          !golden.initialized && state.frame_count + 1 == arguments.frames))) {
+      capture_screenshot(&state);
+      state.screenshot_requested = false;
+    }
+    if (complete && state.poster_requested) {
+      if (arguments.poster) {
+        poster_render(&state, arguments.poster, arguments.poster_width,
+                      arguments.poster_height);
+      } else {
+        log_warn("No poster file, use --poster FILE");
+      }
+      state.poster_requested = false;
+    }
+    capture_poll(&state.capture);
+    profile_phase_end(&state.profile, PHASE_OUTPUT);
+    timing_stats_add(&state.cpu_frame, timing_now() - frame_start);
+    resolution_update(&state.resolution, frame_cost(&state));
+    if (complete) {
+      struct control_stats stats = {
+          .frame = state.frame_count,
+          .time = state.time,
+          .cpu_ms = state.cpu_frame.last_ms,
+          .gpu_ms = frame_gpu_time(&state),
+          .scale = state.resolution.scale,
+          .paused = state.paused,
+      };
+      control_publish(&state.control, &stats);
+    }
+
+    if (state.window) {
+      profile_phase_begin(&state.profile);
+      glfwSwapBuffers(state.window);
+      profile_phase_end(&state.profile, PHASE_SWAP);
+      profile_phase_begin(&state.profile);
+      /* Static or paused shaders are only redrawn when something
+         changes */
+      if (complete && !benchmark.frames && !state.export.initialized &&
+          (shaders_static(&state) || (state.paused && !state.steps))) {
+        wait_for_redraw(&state);
+      } else {
+        glfwPollEvents();
+      }
+      profile_phase_end(&state.profile, PHASE_EVENTS);
+    }
+    profile_frame_end(&state.profile);
+    if (complete) {
+      state.frame_count++;
+    }
+  }
+
+  int status = EXIT_SUCCESS;
+  if (benchmark.frames) {
+    if (state.frame_count < arguments.frames) {
+      log_error("Benchmark interrupted after %zu frames", state.frame_count);
+      status = EXIT_FAILURE;
+    } else {
+      benchmark_stop(&benchmark);
+    }
+  }
+
+  if (!state.window && arguments.poster && status == EXIT_SUCCESS &&
+      poster_render(&state, arguments.poster, arguments.poster_width,
+                    arguments.poster_height)) {
+    status = EXIT_FAILURE;
+  }
+  if (!state.window) {
+    log_info("Rendered %zu frames (%.2f s of shader time)", state.frame_count,
+             state.frame_count / arguments.fps);
+  }
+  /* Wait for the last timer queries before the final report */
+  glFinish();
+  for (size_t k = 0; k < state.graph.num_active; ++k) {
+    gpu_timer_collect(&state.graph.passes[state.graph.order[k]].shader.timer);
+  }
+  log_timings(&state, false);
+  profile_log_percentiles(&state.profile);
+  if (benchmark.frames && status == EXIT_SUCCESS &&
+      benchmark_report(&benchmark, &state, stdout)) {
+    status = EXIT_FAILURE;
+  }
+  if (arguments.trace_file) {
+    profile_write_trace(&state.profile, arguments.trace_file);
+  }
+  profile_destroy(&state.profile);
+
+  if (export_finish(&state.export)) {
+    status = EXIT_FAILURE;
+  }
+  if (golden_finish(&golden)) {
+    status = EXIT_FAILURE;
+  }
+  capture_finish(&state.capture);
+  texture_loader_finish(&state.loader, state.graph.textures,
+                        state.graph.num_textures);
+  stream_close(state.graph.streams, state.graph.num_streams);
+  control_close(&state.control);
+  terminate_context(&state);
+  pool_destroy(&state.pool);
+  watch_close(&state.watcher);
+  return status;
 }
@@ -0,0 +1,218 @@
+#include <unistd.h>
+
+#include "log.h"
+#include "pool.h"
+
+/**
+ * @brief Pack a range of task indices.
+ *
+ * @param begin The first task of the range.
+ * @param end The end of the range.
+ * @return The packed range.
+ */
+static uint64_t pack_range(uint64_t begin, uint64_t end) {
+  return begin << 32 | end;
+}
+
+/**
+ * @brief Take the first task of the range of a thread, as its owner.
+ *
+ * @param range The range of the thread.
+ * @param index The task taken.
+ * @return `true` if a task was taken, `false` if the range is empty.
+ */
+static bool take_task(struct pool_range *range, size_t *index) {
+  uint64_t bounds = atomic_load(&range->bounds);
+  for (;;) {
+    uint64_t begin = bounds >> 32, end = bounds & UINT32_MAX;
+    if (begin >= end) {
+      return false;
+    }
+    if (atomic_compare_exchange_weak(&range->bounds, &bounds,
+                                     pack_range(begin + 1, end))) {
+      *index = begin;
+      return true;
+    }
+  }
+}
+
+/**
+ * @brief Steal the second half of the range of another thread.
+ *
+ * The first stolen task is returned, and the others become the range
+ * of the thief, whose own range is empty.
+ *
+ * @param pool The pool.
+ * @param thief The index of the stealing thread.
+ * @param index The first stolen task.
+ * @return `true` if a task was stolen, `false` if all the ranges are
+ * empty.
+ */
+static bool steal_task(struct thread_pool *pool, size_t thief,
+                       size_t *index) {
+  for (size_t i = 1; i < pool->num_threads; ++i) {
+    struct pool_range *victim = &pool->ranges[(thief + i) % pool->num_threads];
+    uint64_t bounds = atomic_load(&victim->bounds);
+    for (;;) {
+      uint64_t begin = bounds >> 32, end = bounds & UINT32_MAX;
+      if (begin >= end) {
+        break;
+      }
+      uint64_t middle = begin + (end - begin) / 2;
+      if (atomic_compare_exchange_weak(&victim->bounds, &bounds,
+                                       pack_range(begin, middle))) {
+        *index = middle;
+        atomic_store(&pool->ranges[thief].bounds, pack_range(middle + 1, end));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Run tasks of the current batch until none is left.
+ *
+ * @param pool The pool.
+ * @param self The index of the running thread.
+ */
+static void run_tasks(struct thread_pool *pool, size_t self) {
+  size_t index = 0;
+  while (take_task(&pool->ranges[self], &index) ||
+         steal_task(pool, self, &index)) {
+    pool->task(pool->data, index);
+  }
+}
+
+/**
+ * @brief Main function of the worker threads, waiting for batches.
+ *
+ * @param arg The pool_worker of the thread.
+ * @return NULL.
+ */
+static void *worker_thread(void *arg) {
+  struct pool_worker *worker = arg;
+  struct thread_pool *pool = worker->pool;
+  uint64_t batch = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->quit && pool->batch == batch) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->quit) {
+      break;
+    }
+    batch = pool->batch;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool, worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/**
+ * @brief Start the worker threads of a pool.
+ *
+ * @param pool The pool to initialize.
+ * @param num_threads The number of threads, including the thread
+ * calling pool_run(), or 0 for one per online processor.
+ * @return 0 on success, 1 on failure.
+ */
+int pool_init(struct thread_pool *pool, size_t num_threads) {
+  if (num_threads == 0) {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = processors > 0 ? (size_t)processors : 1;
+  }
+  if (num_threads > POOL_MAX_THREADS) {
+    num_threads = POOL_MAX_THREADS;
+  }
+  pool->num_threads = 1;
+  pool->batch = 0;
+  pool->running = 0;
+  pool->quit = false;
+  for (size_t i = 0; i < POOL_MAX_THREADS; ++i) {
+    atomic_init(&pool->ranges[i].bounds, 0);
+  }
+  if (pthread_mutex_init(&pool->lock, NULL)) {
+    log_error("Failed to initialize the thread pool");
+    return 1;
+  }
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->initialized = true;
+
+  for (size_t i = 1; i < num_threads; ++i) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if (pthread_create(&pool->threads[i], NULL, worker_thread,
+                       &pool->workers[i])) {
+      log_warn("Could only start %zu of %zu threads", i, num_threads);
+      break;
+    }
+    pool->num_threads++;
+  }
+  log_debug("Thread pool started with %zu threads", pool->num_threads);
+  return 0;
+}
+
+/**
+ * @brief Run a task for each index of a batch, and wait for all of
+ * them to complete.
+ *
+ * @param pool The pool.
+ * @param count The number of tasks, the indices going from 0 to
+ * `count - 1`.
+ * @param task The task, called concurrently from all the threads.
+ * @param data The data passed to the task.
+ */
+void pool_run(struct thread_pool *pool, size_t count, pool_task_fn *task,
+              void *data) {
+  for (size_t i = 0; i < pool->num_threads; ++i) {
+    atomic_store(&pool->ranges[i].bounds,
+                 pack_range(count * i / pool->num_threads,
+                            count * (i + 1) / pool->num_threads));
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->data = data;
+  pool->batch++;
+  pool->running = pool->num_threads - 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  run_tasks(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Stop the worker threads and release the pool.
+ *
+ * @param pool The pool, which may not have been initialized.
+ */
+void pool_destroy(struct thread_pool *pool) {
+  if (!pool->initialized) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 1; i < pool->num_threads; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->lock);
+  pool->initialized = false;
+}
@@ -0,0 +1,65 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_MAX_THREADS 64 /**< Maximum number of threads of a pool. */
+
+/** Task run by the pool, for each index of a batch. */
+typedef void pool_task_fn(void *data, size_t index);
+
+/**
+ * Range of task indices owned by a thread, packed in a single word so
+ * that the owner and thieves update it with compare-and-swap. The
+ * owner takes tasks from the start, thieves from the end.
+ */
+struct pool_range {
+  _Alignas(64) _Atomic uint64_t bounds; /**< First index in the high
+                                           bits, end in the low bits. */
+};
+
+struct thread_pool;
+
+/**
+ * Argument of a worker thread.
+ */
+struct pool_worker {
+  struct thread_pool *pool; /**< Pool of the worker. */
+  size_t index;             /**< Index of the worker in the pool. */
+};
+
+/**
+ * Work-stealing thread pool.
+ *
+ * The tasks of a batch are split evenly between the threads, the
+ * calling thread included. A thread that runs out of tasks steals
+ * half of the remaining range of another one, so that tasks of uneven
+ * cost, such as tiles of a fractal, keep all the cores busy until the
+ * end of the batch.
+ */
+struct thread_pool {
+  pthread_t threads[POOL_MAX_THREADS]; /**< Workers, the caller is 0. */
+  size_t num_threads;  /**< Number of threads, including the caller. */
+  struct pool_worker workers[POOL_MAX_THREADS]; /**< Thread arguments. */
+  struct pool_range ranges[POOL_MAX_THREADS]; /**< Tasks of each thread. */
+  pool_task_fn *task;  /**< Task of the current batch. */
+  void *data;          /**< Data of the task. */
+  uint64_t batch;      /**< Number of the current batch. */
+  size_t running;      /**< Workers still running the batch. */
+  bool quit;           /**< The workers must exit. */
+  bool initialized;    /**< The threads were started. */
+  pthread_mutex_t lock; /**< Protects the batch fields. */
+  pthread_cond_t start; /**< Signaled when a batch starts. */
+  pthread_cond_t done;  /**< Signaled when the last worker finishes. */
+};
+
+int pool_init(struct thread_pool *pool, size_t num_threads);
+void pool_run(struct thread_pool *pool, size_t count, pool_task_fn *task,
+              void *data);
+void pool_destroy(struct thread_pool *pool);
+
+#endif /* POOL_H */
@@ -0,0 +1,247 @@
+#include <GL/glew.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "poster.h"
+#include "shaders.h"
+#include "timing.h"
+#include "uniforms.h"
+
+/** Code inserted in the screen shader, so that `gl_FragCoord` is the
+    position of the fragment in the whole poster, not in the tile. */
+static const char *const poster_prelude =
+    "uniform vec2 u_tile_offset;\n"
+    "#define gl_FragCoord (gl_FragCoord + vec4(u_tile_offset, 0.0, 0.0))\n";
+
+/**
+ * PNG file written row by row.
+ */
+struct poster_png {
+  FILE *file;     /**< Output file. */
+  png_structp png; /**< libpng write structure. */
+  png_infop info; /**< libpng header information. */
+};
+
+/**
+ * @brief Release the PNG encoder and close the file.
+ *
+ * @param out The PNG file.
+ * @return 0 on success, 1 if the file could not be closed.
+ */
+static int png_close(struct poster_png *out) {
+  if (out->png) {
+    png_destroy_write_struct(&out->png, out->info ? &out->info : NULL);
+  }
+  int err = 0;
+  if (out->file) {
+    err = fclose(out->file) != 0;
+    out->file = NULL;
+  }
+  return err;
+}
+
+/**
+ * @brief Create a PNG file and write its header, for 8-bit RGB rows.
+ *
+ * @param out The PNG file to open.
+ * @param filename The name of the file.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @return 0 on success, 1 on failure.
+ */
+static int png_open(struct poster_png *out, const char *filename, int width,
+                    int height) {
+  out->file = fopen(filename, "wb");
+  if (out->file == NULL) {
+    log_error("Could not open %s", filename);
+    return 1;
+  }
+  out->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  out->info = out->png ? png_create_info_struct(out->png) : NULL;
+  if (out->info == NULL) {
+    log_error("Failed to allocate the PNG encoder");
+    png_close(out);
+    return 1;
+  }
+  if (setjmp(png_jmpbuf(out->png))) {
+    log_error("Could not write the PNG header of %s", filename);
+    png_close(out);
+    return 1;
+  }
+  png_init_io(out->png, out->file);
+  png_set_IHDR(out->png, out->info, width, height, 8, PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(out->png, out->info);
+  return 0;
+}
+
+/**
+ * @brief Encode rows read back from OpenGL, bottom row first, in the
+ * top-down order of PNG.
+ *
+ * @param out The PNG file.
+ * @param rows The pixels of the rows.
+ * @param stride The size of a row in bytes.
+ * @param count The number of rows.
+ * @return 0 on success, 1 on failure.
+ */
+static int png_write_strip(struct poster_png *out, const unsigned char *rows,
+                           size_t stride, int count) {
+  if (setjmp(png_jmpbuf(out->png))) {
+    return 1;
+  }
+  for (int i = count - 1; i >= 0; --i) {
+    png_write_row(out->png, rows + i * stride);
+  }
+  return 0;
+}
+
+/**
+ * @brief Write the end of the PNG file.
+ *
+ * @param out The PNG file, with all its rows written.
+ * @return 0 on success, 1 on failure.
+ */
+static int png_finish(struct poster_png *out) {
+  if (setjmp(png_jmpbuf(out->png))) {
+    return 1;
+  }
+  png_write_end(out->png, NULL);
+  return 0;
+}
+
+/**
+ * @brief Render the current frame of the screen shader as a PNG image
+ * of any size.
+ *
+ * The image is rendered in tiles no larger than the maximum texture
+ * and viewport sizes, by a variant of the screen shader whose
+ * `gl_FragCoord` is offset by the position of the tile, with
+ * `u_resolution` set to the size of the whole image. A strip of tiles
+ * is read back at a time, and its rows are encoded before the next
+ * strip is rendered, so that the whole image is never held in memory.
+ *
+ * Buffer passes are rendered at the size of the window, so posters
+ * are limited to render graphs with a single pass. Its image and
+ * stream inputs are bound as for the frame.
+ *
+ * @param state The renderer state, after rendering the frame.
+ * @param filename The name of the PNG file.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @return 0 on success, 1 on failure.
+ */
+int poster_render(struct renderer_state *state, const char *filename,
+                  int width, int height) {
+  struct render_graph *graph = &state->graph;
+  if (graph->num_active != 1) {
+    log_error("Posters can only be rendered from a single pass, without "
+              "buffer passes");
+    return 1;
+  }
+  double start = timing_now();
+
+  int max_texture = 0, max_viewport[2] = {0};
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture);
+  glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+  size_t stride = (size_t)width * 3;
+  int tile_width = POSTER_TILE_SIZE;
+  tile_width = tile_width < max_texture ? tile_width : max_texture;
+  tile_width = tile_width < max_viewport[0] ? tile_width : max_viewport[0];
+  tile_width = tile_width < width ? tile_width : width;
+  int strip_height = POSTER_TILE_SIZE;
+  strip_height = strip_height < max_texture ? strip_height : max_texture;
+  strip_height =
+      strip_height < max_viewport[1] ? strip_height : max_viewport[1];
+  strip_height = strip_height < height ? strip_height : height;
+  if ((size_t)strip_height * stride > POSTER_STRIP_BYTES) {
+    strip_height = POSTER_STRIP_BYTES / stride > 0 ? POSTER_STRIP_BYTES / stride
+                                                   : 1;
+  }
+
+  struct shader_state shader = {
+      .filename = graph_screen(graph)->filename,
+      .defines = variants_defines(&state->variants),
+      .prelude = poster_prelude,
+  };
+  if (compile_shaders(&shader) || !shader.program) {
+    log_error("Could not compile the poster variant of %s", shader.filename);
+    return 1;
+  }
+  unsigned char *strip = malloc(stride * strip_height);
+  unsigned int framebuffer = 0, texture = 0;
+  struct poster_png out = {0};
+  int err = strip == NULL;
+  if (err) {
+    log_error("Failed to allocate memory for %d rows of %d pixels",
+              strip_height, width);
+  }
+  err = err || initialize_framebuffer(&framebuffer, &texture, tile_width,
+                                      strip_height, FORMAT_RGB8,
+                                      FILTER_LINEAR);
+  err = err || png_open(&out, filename, width, height);
+
+  if (!err) {
+    log_info("Rendering a %dx%d poster in tiles of %dx%d", width, height,
+             tile_width, strip_height);
+    /* The same frame as on screen, on a larger canvas */
+    struct frame_globals globals = state->globals;
+    globals.mouse[0] *= width / globals.resolution[0];
+    globals.mouse[1] *= height / globals.resolution[1];
+    globals.resolution[0] = width;
+    globals.resolution[1] = height;
+    update_globals(state->globals_ubo, &globals);
+    glUseProgram(shader.program);
+    apply_globals(&shader.uniforms, &globals);
+    control_apply_uniforms(&state->control, &shader.uniforms);
+    int offset = uniform_cache_location(&shader.uniforms, "u_tile_offset");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glBindVertexArray(state->vao);
+    graph_bind_program_inputs(graph, graph_screen(graph), &shader.uniforms);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ROW_LENGTH, width);
+    glClearColor(1.0, 1.0, 1.0, 1.0);
+    /* PNG rows go from the top, render the strips from the top */
+    for (int top = height; top > 0 && !err; top -= strip_height) {
+      int bottom = top > strip_height ? top - strip_height : 0;
+      for (int x = 0; x < width; x += tile_width) {
+        int columns = width - x < tile_width ? width - x : tile_width;
+        glViewport(0, 0, columns, top - bottom);
+        glUniform2f(offset, x, bottom);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glReadPixels(0, 0, columns, top - bottom, GL_RGB, GL_UNSIGNED_BYTE,
+                     strip + x * 3);
+      }
+      err = png_write_strip(&out, strip, stride, top - bottom);
+      log_debug("Poster rows %d to %d written", height - top,
+                height - bottom - 1);
+    }
+    err = err || png_finish(&out);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glBindVertexArray(0);
+    update_globals(state->globals_ubo, &state->globals);
+  }
+  if (png_close(&out) && !err) {
+    err = 1;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, state->output_framebuffer);
+  glViewport(0, 0, state->width, state->height);
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteTextures(1, &texture);
+  glDeleteProgram(shader.program);
+  free(strip);
+  if (err) {
+    log_error("Could not write poster %s", filename);
+  } else {
+    log_info("Poster saved to %s in %.2f s", filename,
+             (timing_now() - start) / 1e3);
+  }
+  return err;
+}
@@ -0,0 +1,13 @@
+#ifndef POSTER_H
+#define POSTER_H
+
+#include "renderer.h"
+
+#define POSTER_TILE_SIZE 1024 /**< Largest side of a rendered tile. */
+#define POSTER_STRIP_BYTES (64 << 20) /**< Largest strip of rows held in
+                                         memory before encoding. */
+
+int poster_render(struct renderer_state *state, const char *filename,
+                  int width, int height);
+
+#endif /* POSTER_H */
@@ -0,0 +1,337 @@
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "preprocess.h"
+#include "shaders.h"
+
+/** Source files read so far, shared by all the shaders. */
+static struct source_file source_cache[MAX_SOURCE_FILES];
+/** Number of files in the source cache. */
+static size_t source_cache_count = 0;
+
+/**
+ * Growable string holding the preprocessed source.
+ */
+struct text_buffer {
+  char *data;      /**< Null-terminated text. */
+  size_t length;   /**< Length of the text. */
+  size_t capacity; /**< Allocated size. */
+};
+
+/**
+ * @brief Append text to a buffer.
+ *
+ * @param buffer The buffer.
+ * @param text The text to append.
+ * @param length The length of the text.
+ * @return 0 on success, 1 on failure.
+ */
+static int buffer_append(struct text_buffer *buffer, const char *text,
+                         size_t length) {
+  if (buffer->length + length + 1 > buffer->capacity) {
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->length + length + 1) {
+      capacity *= 2;
+    }
+    char *data = realloc(buffer->data, capacity);
+    if (data == NULL) {
+      log_error("Failed to allocate memory to preprocess a shader");
+      return 1;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->length, text, length);
+  buffer->length += length;
+  buffer->data[buffer->length] = '\0';
+  return 0;
+}
+
+/**
+ * @brief Append a `#line` directive to a buffer.
+ *
+ * @param buffer The buffer.
+ * @param line The number of the next line.
+ * @param number The source string number of the next line.
+ * @return 0 on success, 1 on failure.
+ */
+static int buffer_line(struct text_buffer *buffer, size_t line,
+                       size_t number) {
+  char directive[64];
+  int length =
+      snprintf(directive, sizeof(directive), "#line %zu %zu\n", line, number);
+  return buffer_append(buffer, directive, length);
+}
+
+/**
+ * @brief Find a file in the source cache, adding it if needed.
+ *
+ * @param path The path of the file.
+ * @return The index of the file, or `SIZE_MAX` if the cache is full.
+ */
+static size_t source_cache_find(const char *path) {
+  for (size_t i = 0; i < source_cache_count; ++i) {
+    if (!strcmp(source_cache[i].path, path)) {
+      return i;
+    }
+  }
+  if (source_cache_count >= MAX_SOURCE_FILES) {
+    log_error("Too many source files, at most %d are supported",
+              MAX_SOURCE_FILES);
+    return SIZE_MAX;
+  }
+  struct source_file *file = &source_cache[source_cache_count];
+  file->path = strdup(path);
+  if (file->path == NULL) {
+    log_error("Failed to allocate memory for source file %s", path);
+    return SIZE_MAX;
+  }
+  file->text = NULL;
+  file->wd = -1;
+  file->watched = false;
+  return source_cache_count++;
+}
+
+/**
+ * @brief Number of files in the source cache.
+ *
+ * @return The number of files read by the preprocessor so far.
+ */
+size_t source_cache_size(void) { return source_cache_count; }
+
+/**
+ * @brief Access a file of the source cache.
+ *
+ * @param index The index of the file, less than source_cache_size().
+ * @return The file.
+ */
+struct source_file *source_cache_file(size_t index) {
+  return &source_cache[index];
+}
+
+/**
+ * @brief Forget the contents of a file, so that it is read again from
+ * disk the next time a shader including it is preprocessed.
+ *
+ * @param index The index of the file.
+ */
+void source_cache_invalidate(size_t index) {
+  free(source_cache[index].text);
+  source_cache[index].text = NULL;
+}
+
+/**
+ * @brief Forget the contents of all the files.
+ */
+void source_cache_invalidate_all(void) {
+  for (size_t i = 0; i < source_cache_count; ++i) {
+    source_cache_invalidate(i);
+  }
+}
+
+/**
+ * @brief Check whether a shader depends on a file.
+ *
+ * @param sources The files of the shader.
+ * @param file The index of the file in the source cache.
+ * @return `true` if the shader was preprocessed from the file.
+ */
+bool shader_sources_contain(const struct shader_sources *sources,
+                            size_t file) {
+  for (size_t i = 0; i < sources->count; ++i) {
+    if (sources->files[i] == file) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Log the files of a shader with their source string numbers,
+ * which compilers print in front of line numbers.
+ *
+ * @param sources The files of the shader.
+ */
+void shader_sources_log(const struct shader_sources *sources) {
+  if (sources->count < 2) {
+    return;
+  }
+  for (size_t i = 0; i < sources->count; ++i) {
+    log_error("Source %zu is %s", i, source_cache[sources->files[i]].path);
+  }
+}
+
+/**
+ * @brief Parse the file name of an `#include "FILE"` directive.
+ *
+ * @param start The text following `#include`.
+ * @param end The end of the line.
+ * @param name The file name.
+ * @return 0 on success, 1 if the directive is invalid.
+ */
+static int parse_include(const char *start, const char *end, char *name) {
+  while (start < end && (*start == ' ' || *start == '\t')) {
+    start++;
+  }
+  if (start == end || *start != '"') {
+    return 1;
+  }
+  const char *close = memchr(start + 1, '"', end - start - 1);
+  if (close == NULL || close == start + 1 || close - start > PATH_MAX - 1) {
+    return 1;
+  }
+  memcpy(name, start + 1, close - start - 1);
+  name[close - start - 1] = '\0';
+  return 0;
+}
+
+static int expand_file(struct text_buffer *out, struct shader_sources *sources,
+                       size_t number);
+
+/**
+ * @brief Expand an included file in place of its `#include` directive.
+ *
+ * Each file is included at most once per shader, as if it started
+ * with `#pragma once`, so that shared functions are never defined
+ * twice and include cycles are harmless.
+ *
+ * @param out The preprocessed source.
+ * @param sources The files of the shader.
+ * @param parent The path of the including file.
+ * @param name The file name in the directive, relative to the
+ * directory of the including file.
+ * @return 0 on success, 1 on failure.
+ */
+static int include_file(struct text_buffer *out,
+                        struct shader_sources *sources, const char *parent,
+                        const char *name) {
+  char path[PATH_MAX];
+  if (name[0] == '/') {
+    snprintf(path, sizeof(path), "%s", name);
+  } else {
+    char directory[PATH_MAX];
+    snprintf(directory, sizeof(directory), "%s", parent);
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", dirname(directory),
+                         name) >= sizeof(path)) {
+      log_error("Path of included file %s is too long", name);
+      return 1;
+    }
+  }
+
+  size_t index = source_cache_find(path);
+  if (index == SIZE_MAX) {
+    return 1;
+  }
+  if (shader_sources_contain(sources, index)) {
+    return 0;
+  }
+  if (sources->count >= MAX_SHADER_SOURCES) {
+    log_error("Too many included files, at most %d are supported",
+              MAX_SHADER_SOURCES);
+    return 1;
+  }
+  size_t number = sources->count;
+  sources->files[sources->count++] = index;
+  return buffer_line(out, 1, number) || expand_file(out, sources, number);
+}
+
+/**
+ * @brief Copy a file to the preprocessed source, expanding its
+ * `#include` directives.
+ *
+ * `#line` directives follow each included file, so that compilers
+ * report errors at the lines of the original files.
+ *
+ * @param out The preprocessed source.
+ * @param sources The files of the shader.
+ * @param number The source string number of the file.
+ * @return 0 on success, 1 on failure.
+ */
+static int expand_file(struct text_buffer *out, struct shader_sources *sources,
+                       size_t number) {
+  struct source_file *file = &source_cache[sources->files[number]];
+  if (file->text == NULL) {
+    file->text = read_file(file->path);
+    if (file->text == NULL) {
+      return 1;
+    }
+  }
+
+  size_t line_number = 1;
+  const char *line = file->text;
+  while (*line) {
+    const char *end = strchr(line, '\n');
+    size_t length = end ? (size_t)(end - line) : strlen(line);
+    const char *directive = line;
+    while (directive < line + length &&
+           (*directive == ' ' || *directive == '\t')) {
+      directive++;
+    }
+
+    if (!strncmp(directive, "#include", 8)) {
+      char name[PATH_MAX];
+      if (parse_include(directive + 8, line + length, name)) {
+        log_error("%s:%zu: Invalid #include, expected #include \"FILE\"",
+                  file->path, line_number);
+        return 1;
+      }
+      if (include_file(out, sources, file->path, name)) {
+        log_error("%s:%zu: Could not include %s", file->path, line_number,
+                  name);
+        return 1;
+      }
+      if (buffer_line(out, line_number + 1, number)) {
+        return 1;
+      }
+    } else if (number > 0 && !strncmp(directive, "#version", 8)) {
+      log_error("%s:%zu: #version is only allowed in the shader file, not "
+                "in included files",
+                file->path, line_number);
+      return 1;
+    } else if (buffer_append(out, line, length) ||
+               buffer_append(out, "\n", 1)) {
+      return 1;
+    }
+
+    line_number++;
+    if (end == NULL) {
+      break;
+    }
+    line = end + 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Read a shader and the files it includes.
+ *
+ * `#include "FILE"` directives are replaced by the contents of the
+ * file, relative to the directory of the including file. Files are
+ * read once and kept in a cache shared by all the shaders, until they
+ * are invalidated when they change on disk.
+ *
+ * @param filename The shader file.
+ * @param sources The files the shader was preprocessed from, even if
+ * preprocessing failed.
+ * @return The preprocessed source, to be freed by the caller, or NULL
+ * on error.
+ */
+char *preprocess_shader(const char *filename, struct shader_sources *sources) {
+  sources->count = 0;
+  size_t index = source_cache_find(filename);
+  if (index == SIZE_MAX) {
+    return NULL;
+  }
+  sources->files[sources->count++] = index;
+
+  struct text_buffer out = {0};
+  if (buffer_append(&out, "", 0) || expand_file(&out, sources, 0)) {
+    free(out.data);
+    return NULL;
+  }
+  return out.data;
+}
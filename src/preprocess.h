@@ -0,0 +1,40 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_SOURCE_FILES 64   /**< Files in the source cache. */
+#define MAX_SHADER_SOURCES 16 /**< Files included by a single shader. */
+
+/**
+ * Source file in the cache shared by all the shaders.
+ */
+struct source_file {
+  char *path; /**< Path of the file. */
+  char *text; /**< Contents of the file, or NULL if it must be read again
+                 from disk. */
+  int wd;     /**< inotify watch descriptor of its directory, or -1. */
+  bool watched; /**< A watch was attempted for the file. */
+};
+
+/**
+ * Files a shader was preprocessed from, in the order of their source
+ * string numbers in `#line` directives: the shader file itself, then
+ * its includes.
+ */
+struct shader_sources {
+  size_t files[MAX_SHADER_SOURCES]; /**< Indices in the source cache. */
+  size_t count;                     /**< Number of files. */
+};
+
+char *preprocess_shader(const char *filename, struct shader_sources *sources);
+bool shader_sources_contain(const struct shader_sources *sources,
+                            size_t file);
+void shader_sources_log(const struct shader_sources *sources);
+size_t source_cache_size(void);
+struct source_file *source_cache_file(size_t index);
+void source_cache_invalidate(size_t index);
+void source_cache_invalidate_all(void);
+
+#endif /* PREPROCESS_H */
@@ -0,0 +1,270 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "profile.h"
+#include "timing.h"
+
+/** Names of the phases in traces. */
+static const char *const phase_names[NUM_PHASES] = {
+    [PHASE_INPUT] = "input",   [PHASE_UNIFORMS] = "uniforms",
+    [PHASE_DRAW] = "draw",     [PHASE_OUTPUT] = "output",
+    [PHASE_SWAP] = "swap",     [PHASE_EVENTS] = "events",
+};
+
+/**
+ * @brief Allocate the ring of frame records of the profiler.
+ *
+ * @param profile The profile to initialize.
+ * @return 0 on success, 1 on failure.
+ */
+int profile_init(struct frame_profile *profile) {
+  memset(profile, 0, sizeof(*profile));
+  profile->records = calloc(PROFILE_FRAMES, sizeof(struct frame_record));
+  if (profile->records == NULL) {
+    log_error("Failed to allocate the frame profile");
+    return 1;
+  }
+  profile->origin = timing_now();
+  return 0;
+}
+
+/**
+ * @brief Free the frame records of the profiler.
+ *
+ * @param profile The profile to destroy.
+ */
+void profile_destroy(struct frame_profile *profile) {
+  free(profile->records);
+  memset(profile, 0, sizeof(*profile));
+}
+
+/**
+ * @brief Forget all the recorded frames, for instance at the end of a
+ * warm-up.
+ *
+ * @param profile The profile.
+ */
+void profile_reset(struct frame_profile *profile) {
+  profile->count = 0;
+  profile->current = NULL;
+}
+
+/**
+ * @brief Start recording a frame, overwriting the oldest record if
+ * the ring is full.
+ *
+ * @param profile The profile.
+ * @param frame The index of the frame.
+ */
+void profile_frame_begin(struct frame_profile *profile, size_t frame) {
+  if (profile->records == NULL) {
+    return;
+  }
+  struct frame_record *record =
+      &profile->records[profile->count % PROFILE_FRAMES];
+  record->frame = frame;
+  record->start = timing_now() - profile->origin;
+  record->end = record->start;
+  for (size_t i = 0; i < NUM_PHASES; ++i) {
+    record->phase_start[i] = -1;
+    record->phase_ms[i] = 0;
+  }
+  profile->current = record;
+}
+
+/**
+ * @brief Finish recording the current frame.
+ *
+ * @param profile The profile.
+ */
+void profile_frame_end(struct frame_profile *profile) {
+  if (profile->current == NULL) {
+    return;
+  }
+  profile->current->end = timing_now() - profile->origin;
+  profile->current = NULL;
+  profile->count++;
+}
+
+/**
+ * @brief Start measuring a phase of the current frame.
+ *
+ * @param profile The profile.
+ */
+void profile_phase_begin(struct frame_profile *profile) {
+  profile->phase_begin = timing_now() - profile->origin;
+}
+
+/**
+ * @brief Finish measuring a phase of the current frame. A phase
+ * measured several times in a frame accumulates its durations.
+ *
+ * @param profile The profile.
+ * @param phase The phase that was measured since the last call to
+ * profile_phase_begin().
+ */
+void profile_phase_end(struct frame_profile *profile, enum frame_phase phase) {
+  struct frame_record *record = profile->current;
+  if (record == NULL) {
+    return;
+  }
+  double now = timing_now() - profile->origin;
+  if (record->phase_start[phase] < 0) {
+    record->phase_start[phase] = profile->phase_begin;
+  }
+  record->phase_ms[phase] += now - profile->phase_begin;
+}
+
+/**
+ * @brief Number of frames currently held in the ring.
+ *
+ * @param profile The profile.
+ * @return The number of records.
+ */
+static size_t profile_size(const struct frame_profile *profile) {
+  return profile->count < PROFILE_FRAMES ? profile->count : PROFILE_FRAMES;
+}
+
+/**
+ * @brief Compare two durations, for qsort().
+ */
+static int compare_durations(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Nearest-rank percentile of sorted durations.
+ *
+ * @param durations The durations, in increasing order.
+ * @param count The number of durations, at least 1.
+ * @param percentile The percentile, between 0 and 100.
+ * @return The duration at the given percentile.
+ */
+static double percentile(const double *durations, size_t count,
+                         double percentile) {
+  size_t rank = (size_t)ceil(percentile / 100 * count);
+  return durations[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * @brief Compute the distribution of the frame times kept in the ring.
+ *
+ * A frame time runs from the start of a frame to the start of the
+ * next one, so that it includes everything the render loop did in
+ * between. Percentiles use the nearest-rank method.
+ *
+ * @param profile The profile.
+ * @param summary The distribution to fill.
+ * @return 0 on success, 1 if fewer than two frames were recorded or
+ * on allocation failure.
+ */
+int profile_summarize(const struct frame_profile *profile,
+                      struct frame_time_summary *summary) {
+  memset(summary, 0, sizeof(*summary));
+  size_t size = profile_size(profile);
+  if (size < 2) {
+    return 1;
+  }
+  size_t n = size - 1;
+  double *durations = malloc(n * sizeof(double));
+  if (durations == NULL) {
+    log_error("Failed to allocate the frame time distribution");
+    return 1;
+  }
+  size_t first = profile->count - size;
+  double sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const struct frame_record *record =
+        &profile->records[(first + i) % PROFILE_FRAMES];
+    const struct frame_record *next =
+        &profile->records[(first + i + 1) % PROFILE_FRAMES];
+    durations[i] = next->start - record->start;
+    sum += durations[i];
+  }
+  qsort(durations, n, sizeof(double), compare_durations);
+
+  summary->frames = n;
+  summary->min = durations[0];
+  summary->mean = sum / n;
+  summary->p50 = percentile(durations, n, 50);
+  summary->p95 = percentile(durations, n, 95);
+  summary->p99 = percentile(durations, n, 99);
+  summary->max = durations[n - 1];
+  free(durations);
+  return 0;
+}
+
+/**
+ * @brief Log the distribution of the frame times kept in the ring.
+ *
+ * @param profile The profile.
+ */
+void profile_log_percentiles(const struct frame_profile *profile) {
+  struct frame_time_summary summary;
+  if (profile_summarize(profile, &summary)) {
+    return;
+  }
+  log_info("Frame times over %zu frames: p50 = %.3f ms, p95 = %.3f ms, "
+           "p99 = %.3f ms, max = %.3f ms",
+           summary.frames, summary.p50, summary.p95, summary.p99,
+           summary.max);
+}
+
+/**
+ * @brief Write the frames kept in the ring as a Chrome trace.
+ *
+ * The trace uses the JSON trace event format, with one complete event
+ * per frame and one per phase, and can be opened in Perfetto or
+ * chrome://tracing.
+ *
+ * @param profile The profile.
+ * @param filename The output file.
+ * @return 0 on success, 1 on failure.
+ */
+int profile_write_trace(const struct frame_profile *profile,
+                        const char *filename) {
+  FILE *file = fopen(filename, "w");
+  if (file == NULL) {
+    log_error("Could not open trace file %s", filename);
+    return 1;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+                "\"args\":{\"name\":\"render loop\"}}");
+  size_t size = profile_size(profile);
+  size_t first = profile->count - size;
+  for (size_t i = 0; i < size; ++i) {
+    const struct frame_record *record =
+        &profile->records[(first + i) % PROFILE_FRAMES];
+    /* Timestamps are in microseconds */
+    fprintf(file,
+            ",\n{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%zu}}",
+            record->start * 1e3, (record->end - record->start) * 1e3,
+            record->frame);
+    for (size_t phase = 0; phase < NUM_PHASES; ++phase) {
+      if (record->phase_start[phase] < 0) {
+        continue;
+      }
+      fprintf(file,
+              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              phase_names[phase], record->phase_start[phase] * 1e3,
+              record->phase_ms[phase] * 1e3);
+    }
+  }
+  fprintf(file, "\n]}\n");
+
+  if (fclose(file)) {
+    log_error("Could not write trace file %s", filename);
+    return 1;
+  }
+  log_info("Trace of %zu frames written to %s", size, filename);
+  return 0;
+}
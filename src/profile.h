@@ -0,0 +1,74 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PROFILE_FRAMES 8192 /**< Number of frames kept by the profiler. */
+
+/**
+ * Phases of the render loop measured by the profiler.
+ */
+enum frame_phase {
+  PHASE_INPUT,    /**< Keyboard input and inotify polling. */
+  PHASE_UNIFORMS, /**< Upload of the standard uniforms. */
+  PHASE_DRAW,     /**< Submission of the draw calls of all the passes. */
+  PHASE_OUTPUT,   /**< Readback for screenshots and export. */
+  PHASE_SWAP,     /**< Buffer swap, including waiting for vsync. */
+  PHASE_EVENTS,   /**< Window event polling. */
+  NUM_PHASES,
+};
+
+/**
+ * CPU timings of one frame, relative to the start of the profile.
+ */
+struct frame_record {
+  size_t frame;                     /**< Index of the frame. */
+  double start;                     /**< Start of the frame, in ms. */
+  double end;                       /**< End of the frame, in ms. */
+  double phase_start[NUM_PHASES];   /**< Start of each phase, or -1. */
+  double phase_ms[NUM_PHASES];      /**< Time spent in each phase. */
+};
+
+/**
+ * Profile of the render loop.
+ *
+ * Frames are recorded in a ring allocated once, so that profiling a
+ * long session uses a fixed amount of memory and only the most recent
+ * frames are kept.
+ */
+struct frame_profile {
+  struct frame_record *records; /**< Ring of frame records. */
+  size_t count;                 /**< Number of frames recorded so far. */
+  double origin;                /**< Start of the profile, in ms. */
+  struct frame_record *current; /**< Frame being recorded, or NULL. */
+  double phase_begin;           /**< Start of the current phase, in ms. */
+};
+
+/**
+ * Distribution of the frame times of a profile, in milliseconds.
+ */
+struct frame_time_summary {
+  size_t frames; /**< Number of frame times. */
+  double min;    /**< Shortest frame time. */
+  double mean;   /**< Average frame time. */
+  double p50;    /**< Median frame time. */
+  double p95;    /**< 95th percentile. */
+  double p99;    /**< 99th percentile. */
+  double max;    /**< Longest frame time. */
+};
+
+int profile_init(struct frame_profile *profile);
+void profile_destroy(struct frame_profile *profile);
+void profile_reset(struct frame_profile *profile);
+void profile_frame_begin(struct frame_profile *profile, size_t frame);
+void profile_frame_end(struct frame_profile *profile);
+void profile_phase_begin(struct frame_profile *profile);
+void profile_phase_end(struct frame_profile *profile, enum frame_phase phase);
+int profile_summarize(const struct frame_profile *profile,
+                      struct frame_time_summary *summary);
+void profile_log_percentiles(const struct frame_profile *profile);
+int profile_write_trace(const struct frame_profile *profile,
+                        const char *filename);
+
+#endif /* PROFILE_H */
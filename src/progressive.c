@@ -0,0 +1,134 @@
+#include <math.h>
+
+#include "log.h"
+#include "progressive.h"
+
+/**
+ * @brief Initialize the progress of the first frame.
+ *
+ * @param progressive The progress to initialize.
+ * @param target_ms Target duration of an iteration of the render loop
+ * in milliseconds, or 0 to render whole frames.
+ */
+void progressive_init(struct progressive_state *progressive,
+                      double target_ms) {
+  progressive->target_ms = target_ms;
+  progressive->tile_ms = 0;
+  progressive->tiles_per_frame = 1;
+  progressive_restart(progressive);
+}
+
+/**
+ * @brief Start the frame again from its first tile.
+ *
+ * @param progressive The progress of the frame.
+ */
+void progressive_restart(struct progressive_state *progressive) {
+  progressive->pass = 0;
+  progressive->tile = 0;
+}
+
+/**
+ * @brief Check whether frames are rendered progressively.
+ *
+ * @param progressive The progress of the frame.
+ * @return `true` if frames are split into tiles.
+ */
+bool progressive_enabled(const struct progressive_state *progressive) {
+  return progressive->target_ms > 0;
+}
+
+/**
+ * @brief Check whether some tiles of the current frame were drawn.
+ *
+ * The time and the other standard uniforms must not change until the
+ * frame is complete.
+ *
+ * @param progressive The progress of the frame.
+ * @return `true` if the frame is partially drawn.
+ */
+bool progressive_started(const struct progressive_state *progressive) {
+  return progressive->pass > 0 || progressive->tile > 0;
+}
+
+/**
+ * @brief Number of tiles of each pass.
+ *
+ * @param progressive The progress of the frame.
+ * @param width The width of the render targets.
+ * @param height The height of the render targets.
+ * @return The number of tiles, 1 when frames are not split.
+ */
+size_t progressive_num_tiles(const struct progressive_state *progressive,
+                             int width, int height) {
+  if (!progressive_enabled(progressive)) {
+    return 1;
+  }
+  size_t columns = (width + PROGRESSIVE_TILE_SIZE - 1) / PROGRESSIVE_TILE_SIZE;
+  size_t rows = (height + PROGRESSIVE_TILE_SIZE - 1) / PROGRESSIVE_TILE_SIZE;
+  return columns * rows;
+}
+
+/**
+ * @brief Rectangle of the next tile, in row-major order from the
+ * bottom left corner.
+ *
+ * @param progressive The progress of the frame.
+ * @param width The width of the render targets.
+ * @param height The height of the render targets.
+ * @param x The left edge of the tile.
+ * @param y The bottom edge of the tile.
+ * @param tile_width The width of the tile.
+ * @param tile_height The height of the tile.
+ */
+void progressive_tile(const struct progressive_state *progressive, int width,
+                      int height, int *x, int *y, int *tile_width,
+                      int *tile_height) {
+  if (!progressive_enabled(progressive)) {
+    *x = 0;
+    *y = 0;
+    *tile_width = width;
+    *tile_height = height;
+    return;
+  }
+  size_t columns = (width + PROGRESSIVE_TILE_SIZE - 1) / PROGRESSIVE_TILE_SIZE;
+  *x = (progressive->tile % columns) * PROGRESSIVE_TILE_SIZE;
+  *y = (progressive->tile / columns) * PROGRESSIVE_TILE_SIZE;
+  *tile_width = fmin(PROGRESSIVE_TILE_SIZE, width - *x);
+  *tile_height = fmin(PROGRESSIVE_TILE_SIZE, height - *y);
+}
+
+/**
+ * @brief Record the time spent drawing tiles, and choose how many
+ * tiles to draw in the next iteration.
+ *
+ * The cost of a tile is smoothed over the iterations, and at least
+ * one tile is drawn per iteration, so that the frame always makes
+ * progress.
+ *
+ * @param progressive The progress of the frame.
+ * @param tiles The number of tiles drawn in the iteration.
+ * @param elapsed_ms The time spent drawing them, until the GPU
+ * finished, in milliseconds.
+ */
+void progressive_update(struct progressive_state *progressive, size_t tiles,
+                        double elapsed_ms) {
+  if (!progressive_enabled(progressive) || tiles == 0) {
+    return;
+  }
+  double tile_ms = elapsed_ms / tiles;
+  progressive->tile_ms =
+      progressive->tile_ms > 0
+          ? progressive->tile_ms +
+                PROGRESSIVE_SMOOTHING * (tile_ms - progressive->tile_ms)
+          : tile_ms;
+  size_t budget = 1;
+  if (progressive->tile_ms > 0) {
+    budget = fmax(1, floor(progressive->target_ms / progressive->tile_ms));
+  }
+  if (budget != progressive->tiles_per_frame) {
+    log_debug("Drawing %zu tiles per frame (%.2f ms per tile)", budget,
+              progressive->tile_ms);
+  }
+  progressive->tiles_per_frame = budget;
+}
@@ -0,0 +1,42 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PROGRESSIVE_TILE_SIZE 64   /**< Width and height of a tile. */
+#define PROGRESSIVE_SMOOTHING 0.25 /**< Weight of a new tile cost. */
+
+/**
+ * Progress of the frame being rendered.
+ *
+ * In progressive mode, each pass is drawn in square tiles, restricted
+ * with the scissor test, and a frame is spread over as many iterations
+ * of the render loop as needed. The number of tiles drawn in an
+ * iteration adapts so that the iteration takes about the target time.
+ * Otherwise, each pass is a single tile covering the whole image.
+ */
+struct progressive_state {
+  double target_ms;       /**< Target duration of an iteration, or 0 to
+                             render whole frames. */
+  size_t pass;            /**< Position of the pass being drawn in the
+                             execution order. */
+  size_t tile;            /**< Next tile of the pass. */
+  double tile_ms;         /**< Smoothed cost of a tile, or 0 if unknown. */
+  size_t tiles_per_frame; /**< Tiles to draw in the next iteration. */
+};
+
+void progressive_init(struct progressive_state *progressive,
+                      double target_ms);
+void progressive_restart(struct progressive_state *progressive);
+bool progressive_enabled(const struct progressive_state *progressive);
+bool progressive_started(const struct progressive_state *progressive);
+size_t progressive_num_tiles(const struct progressive_state *progressive,
+                             int width, int height);
+void progressive_tile(const struct progressive_state *progressive, int width,
+                      int height, int *x, int *y, int *tile_width,
+                      int *tile_height);
+void progressive_update(struct progressive_state *progressive, size_t tiles,
+                        double elapsed_ms);
+
+#endif /* PROGRESSIVE_H */
@@ -0,0 +1,204 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "queue.h"
+
+/**
+ * @brief Initialize an empty queue.
+ *
+ * @param queue The queue to initialize.
+ * @param capacity The maximum number of items in the queue.
+ * @return 0 on success, 1 on failure.
+ */
+int queue_init(struct queue *queue, size_t capacity) {
+  queue->items = calloc(capacity, sizeof(void *));
+  if (queue->items == NULL) {
+    log_error("Failed to allocate a queue of %zu items", capacity);
+    return 1;
+  }
+  queue->capacity = capacity;
+  queue->head = 0;
+  queue->count = 0;
+  queue->closed = false;
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  pthread_cond_init(&queue->not_full, NULL);
+  return 0;
+}
+
+/**
+ * @brief Free the resources of a queue.
+ *
+ * The queue must be empty and no thread may be waiting on it.
+ *
+ * @param queue The queue to destroy.
+ */
+void queue_destroy(struct queue *queue) {
+  pthread_cond_destroy(&queue->not_full);
+  pthread_cond_destroy(&queue->not_empty);
+  pthread_mutex_destroy(&queue->lock);
+  free(queue->items);
+  queue->items = NULL;
+}
+
+/**
+ * @brief Append an item to the queue, waiting while it is full.
+ *
+ * @param queue The queue.
+ * @param item The item to append.
+ * @return `true` on success, `false` if the queue has been closed.
+ */
+bool queue_push(struct queue *queue, void *item) {
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == queue->capacity && !queue->closed) {
+    pthread_cond_wait(&queue->not_full, &queue->lock);
+  }
+  if (queue->closed) {
+    pthread_mutex_unlock(&queue->lock);
+    return false;
+  }
+  queue->items[(queue->head + queue->count) % queue->capacity] = item;
+  queue->count++;
+  pthread_cond_signal(&queue->not_empty);
+  pthread_mutex_unlock(&queue->lock);
+  return true;
+}
+
+/**
+ * @brief Remove the oldest item from the queue, waiting while it is
+ * empty.
+ *
+ * @param queue The queue.
+ * @return The oldest item, or `NULL` if the queue is closed and
+ * empty.
+ */
+void *queue_pop(struct queue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == 0 && !queue->closed) {
+    pthread_cond_wait(&queue->not_empty, &queue->lock);
+  }
+  void *item = NULL;
+  if (queue->count > 0) {
+    item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return item;
+}
+
+/**
+ * @brief Remove the oldest item from the queue, without waiting.
+ *
+ * @param queue The queue.
+ * @return The oldest item, or `NULL` if the queue is empty.
+ */
+void *queue_try_pop(struct queue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  void *item = NULL;
+  if (queue->count > 0) {
+    item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return item;
+}
+
+/**
+ * @brief Close the queue and wake up all the waiting threads.
+ *
+ * Items already in the queue can still be popped, but no new item can
+ * be pushed.
+ *
+ * @param queue The queue to close.
+ */
+void queue_close(struct queue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  queue->closed = true;
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_cond_broadcast(&queue->not_full);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Initialize an empty single-producer single-consumer queue.
+ *
+ * @param queue The queue to initialize.
+ * @param capacity The maximum number of items, rounded up to a power
+ * of two.
+ * @param item_size The size of an item in bytes.
+ * @return 0 on success, 1 on failure.
+ */
+int spsc_init(struct spsc_queue *queue, size_t capacity, size_t item_size) {
+  size_t slots = 1;
+  while (slots < capacity) {
+    slots *= 2;
+  }
+  queue->items = calloc(slots, item_size);
+  if (queue->items == NULL) {
+    log_error("Failed to allocate a queue of %zu items", slots);
+    return 1;
+  }
+  queue->item_size = item_size;
+  queue->capacity = slots;
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+  return 0;
+}
+
+/**
+ * @brief Free the resources of a single-producer single-consumer queue.
+ *
+ * @param queue The queue to destroy, no longer used by any thread.
+ */
+void spsc_destroy(struct spsc_queue *queue) {
+  free(queue->items);
+  queue->items = NULL;
+}
+
+/**
+ * @brief Append a copy of an item to the queue, from the producer
+ * thread.
+ *
+ * @param queue The queue.
+ * @param item The item to copy.
+ * @return `true` on success, `false` if the queue is full.
+ */
+bool spsc_push(struct spsc_queue *queue, const void *item) {
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if (tail - head == queue->capacity) {
+    return false;
+  }
+  memcpy(queue->items + (tail & (queue->capacity - 1)) * queue->item_size,
+         item, queue->item_size);
+  /* Publishes the item to the consumer */
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Remove the oldest item of the queue, from the consumer
+ * thread.
+ *
+ * @param queue The queue.
+ * @param item The buffer receiving the item.
+ * @return `true` on success, `false` if the queue is empty.
+ */
+bool spsc_pop(struct spsc_queue *queue, void *item) {
+  size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  if (head == tail) {
+    return false;
+  }
+  memcpy(item, queue->items + (head & (queue->capacity - 1)) * queue->item_size,
+         queue->item_size);
+  /* Hands the slot back to the producer */
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+  return true;
+}
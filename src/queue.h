@@ -0,0 +1,50 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Bounded blocking FIFO of pointers, shared between threads.
+ */
+struct queue {
+  void **items;          /**< Ring buffer of items. */
+  size_t capacity;       /**< Maximum number of items in the queue. */
+  size_t head;           /**< Index of the oldest item. */
+  size_t count;          /**< Number of items in the queue. */
+  bool closed;           /**< No more items will be pushed. */
+  pthread_mutex_t lock;  /**< Protects all the fields above. */
+  pthread_cond_t not_empty; /**< Signaled when an item is pushed. */
+  pthread_cond_t not_full;  /**< Signaled when an item is popped. */
+};
+
+/**
+ * Bounded lock-free FIFO of fixed-size items, between a single
+ * producer thread and a single consumer thread, neither of which ever
+ * waits for the other.
+ */
+struct spsc_queue {
+  unsigned char *items; /**< Ring buffer of items. */
+  size_t item_size;     /**< Size of an item in bytes. */
+  size_t capacity;      /**< Number of slots, a power of two. */
+  _Alignas(64) _Atomic size_t head; /**< Number of items popped, written
+                                       by the consumer only. */
+  _Alignas(64) _Atomic size_t tail; /**< Number of items pushed, written
+                                       by the producer only. */
+};
+
+int queue_init(struct queue *queue, size_t capacity);
+void queue_destroy(struct queue *queue);
+bool queue_push(struct queue *queue, void *item);
+void *queue_pop(struct queue *queue);
+void *queue_try_pop(struct queue *queue);
+void queue_close(struct queue *queue);
+
+int spsc_init(struct spsc_queue *queue, size_t capacity, size_t item_size);
+void spsc_destroy(struct spsc_queue *queue);
+bool spsc_push(struct spsc_queue *queue, const void *item);
+bool spsc_pop(struct spsc_queue *queue, void *item);
+
+#endif /* QUEUE_H */
@@ -1,10 +1,12 @@
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <string.h>
 
 #include "log.h"
 #include "renderer.h"
-
-#define UNUSED(a) (void)a
+#include "uniforms.h"
 
 /**
  * @brief Initialize GLFW and OpenGL, and create a window.
@@ -36,6 +38,9 @@ GLFWwindow *initialize_window(int width, int height) {
 
   glViewport(0, 0, width, height);
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+  glfwSetWindowRefreshCallback(window, window_refresh_callback);
+  glfwSetKeyCallback(window, key_callback);
+  glfwSetMouseButtonCallback(window, mouse_button_callback);
 
   /* Initialize OpenGL */
   if (glewInit() != GLEW_OK) {
@@ -47,6 +52,164 @@ GLFWwindow *initialize_window(int width, int height) {
   return window;
 }
 
+/**
+ * @brief Create an offscreen OpenGL context with EGL, without any
+ * window.
+ *
+ * The Mesa surfaceless platform is preferred, so that software
+ * rasterizers such as llvmpipe work on machines without a display or
+ * a GPU. If the context cannot be made current without a surface, a
+ * small pbuffer is used instead. In both cases, the screen shader
+ * renders into an offscreen framebuffer of the requested size.
+ *
+ * @param state The renderer state where the EGL handles and the
+ * output framebuffer are stored.
+ * @param width The width of the output framebuffer.
+ * @param height The height of the output framebuffer.
+ * @return 0 on success, 1 on failure.
+ */
+int initialize_headless_context(struct renderer_state *state, int width,
+                                int height) {
+  state->egl_display = EGL_NO_DISPLAY;
+  state->egl_context = EGL_NO_CONTEXT;
+  state->egl_surface = EGL_NO_SURFACE;
+
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+          "eglGetPlatformDisplayEXT");
+  if (get_platform_display) {
+    state->egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                              EGL_DEFAULT_DISPLAY, NULL);
+  }
+#endif
+  if (state->egl_display == EGL_NO_DISPLAY) {
+    state->egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+  int major = 0, minor = 0;
+  if (state->egl_display == EGL_NO_DISPLAY ||
+      !eglInitialize(state->egl_display, &major, &minor)) {
+    log_error("[EGL] Failed to initialize display");
+    return 1;
+  }
+  log_debug("[EGL] Initialized EGL %d.%d", major, minor);
+
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    log_error("[EGL] OpenGL API not available");
+    terminate_context(state);
+    return 1;
+  }
+
+  const EGLint config_attribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                                   EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                   EGL_NONE};
+  EGLConfig config = NULL;
+  EGLint num_configs = 0;
+  if (!eglChooseConfig(state->egl_display, config_attribs, &config, 1,
+                       &num_configs) ||
+      num_configs < 1) {
+    log_error("[EGL] No suitable framebuffer configuration");
+    terminate_context(state);
+    return 1;
+  }
+
+  const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                    3,
+                                    EGL_CONTEXT_MINOR_VERSION,
+                                    3,
+                                    EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                    EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                    EGL_NONE};
+  state->egl_context = eglCreateContext(state->egl_display, config,
+                                        EGL_NO_CONTEXT, context_attribs);
+  if (state->egl_context == EGL_NO_CONTEXT) {
+    log_error("[EGL] Failed to create OpenGL 3.3 core context");
+    terminate_context(state);
+    return 1;
+  }
+
+  const char *extensions =
+      eglQueryString(state->egl_display, EGL_EXTENSIONS);
+  bool surfaceless =
+      extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+  if (!surfaceless) {
+    const EGLint pbuffer_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    state->egl_surface = eglCreatePbufferSurface(state->egl_display, config,
+                                                 pbuffer_attribs);
+    if (state->egl_surface == EGL_NO_SURFACE) {
+      log_error("[EGL] Failed to create pbuffer surface");
+      terminate_context(state);
+      return 1;
+    }
+  }
+  if (!eglMakeCurrent(state->egl_display, state->egl_surface,
+                      state->egl_surface, state->egl_context)) {
+    log_error("[EGL] Failed to make the context current");
+    terminate_context(state);
+    return 1;
+  }
+  log_debug("[EGL] Created %s context",
+            surfaceless ? "surfaceless" : "pbuffer");
+
+  /* Initialize OpenGL. GLEW may complain about the missing GLX
+     display, but the core entry points are loaded anyway. */
+  GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  if (glew_status == GLEW_ERROR_NO_GLX_DISPLAY) {
+    glew_status = GLEW_OK;
+  }
+#endif
+  if (glew_status != GLEW_OK) {
+    log_error("[GLEW] Failed to initialize");
+    terminate_context(state);
+    return 1;
+  }
+  log_debug("[GLEW] Initialized successfully");
+  log_info("[EGL] Headless renderer: %s", glGetString(GL_RENDERER));
+
+  if (initialize_framebuffer(&state->output_framebuffer,
+                             &state->output_texture, width, height,
+                             FORMAT_RGB8, FILTER_LINEAR)) {
+    terminate_context(state);
+    return 1;
+  }
+  state->width = width;
+  state->height = height;
+  glViewport(0, 0, width, height);
+
+  return 0;
+}
+
+/**
+ * @brief Destroy the window or the headless context, and terminate
+ * GLFW or EGL.
+ *
+ * @param state The renderer state holding the window or EGL handles.
+ */
+void terminate_context(struct renderer_state *state) {
+  if (state->window) {
+    glfwDestroyWindow(state->window);
+    state->window = NULL;
+    glfwTerminate();
+    return;
+  }
+  if (state->egl_display == EGL_NO_DISPLAY) {
+    return;
+  }
+  eglMakeCurrent(state->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 EGL_NO_CONTEXT);
+  if (state->egl_surface != EGL_NO_SURFACE) {
+    eglDestroySurface(state->egl_display, state->egl_surface);
+  }
+  if (state->egl_context != EGL_NO_CONTEXT) {
+    eglDestroyContext(state->egl_display, state->egl_context);
+  }
+  eglTerminate(state->egl_display);
+  state->egl_display = EGL_NO_DISPLAY;
+  state->egl_context = EGL_NO_CONTEXT;
+  state->egl_surface = EGL_NO_SURFACE;
+}
+
 /**
  * @brief Initialize the vertex array.
  *
@@ -103,42 +266,375 @@ unsigned int initialize_vertices() {
  * @param texture_color_buffer The texture ID to be initialized.
  * @param texture_width The width of the desired texture image.
  * @param texture_height The height of the desired texture image.
+ * @param format The storage format of the texture.
+ * @param filter The filtering of the texture.
  * @return 0 on success, 1 on failure.
  */
 unsigned int initialize_framebuffer(unsigned int *framebuffer,
                                     unsigned int *texture_color_buffer,
                                     unsigned int texture_width,
-                                    unsigned int texture_height) {
+                                    unsigned int texture_height,
+                                    enum target_format format,
+                                    enum target_filter filter) {
+  const struct format_info *info = graph_format_info(format);
+  int gl_filter = filter == FILTER_NEAREST ? GL_NEAREST : GL_LINEAR;
   glGenFramebuffers(1, framebuffer);
   glBindFramebuffer(GL_FRAMEBUFFER, *framebuffer);
   /* color attachment texture */
   glGenTextures(1, texture_color_buffer);
   glBindTexture(GL_TEXTURE_2D, *texture_color_buffer);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture_width, texture_height, 0,
-               GL_RGB, GL_UNSIGNED_BYTE, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexImage2D(GL_TEXTURE_2D, 0, info->internal_format, texture_width,
+               texture_height, 0, info->format, info->type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, gl_filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, gl_filter);
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
                          *texture_color_buffer, 0);
   /* check that the framebuffer is complete */
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-    log_error("Framebuffer is not complete");
+    log_error("Framebuffer is not complete with format %s", info->name);
     return 1;
   }
-  log_debug("Framebuffer initialized and complete");
+  log_debug("Framebuffer initialized and complete (%s)", info->name);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   return 0;
 }
 
+/**
+ * @brief Reallocate the texture attached to a framebuffer at a new
+ * size.
+ *
+ * @param framebuffer The framebuffer.
+ * @param texture The texture attached to the framebuffer.
+ * @param width The new width of the texture.
+ * @param height The new height of the texture.
+ * @param format The format of the texture.
+ * @return 0 on success, 1 on failure.
+ */
+int resize_framebuffer(unsigned int framebuffer, unsigned int texture,
+                       int width, int height, enum target_format format) {
+  const struct format_info *info = graph_format_info(format);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, info->internal_format, width, height, 0,
+               info->format, info->type, NULL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    log_error("Framebuffer is not complete after resizing to %dx%d", width,
+              height);
+    return 1;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return 0;
+}
+
+/**
+ * @brief Resize the render targets to the render size of the frame.
+ *
+ * The render size is the output size multiplied by the render scale.
+ * When it is smaller than the output, or when frames are rendered
+ * progressively, the screen pass renders into an intermediate
+ * framebuffer, copied to the output afterwards. A frame being rendered
+ * progressively starts again when the size changes.
+ *
+ * @param state The renderer state.
+ * @param width The width at which the passes render.
+ * @param height The height at which the passes render.
+ * @param offscreen Whether the screen pass renders into the
+ * intermediate framebuffer.
+ */
+static void update_render_size(struct renderer_state *state, int width,
+                               int height, bool offscreen) {
+  if (state->graph.width == width && state->graph.height == height &&
+      (!offscreen || state->screen_framebuffer)) {
+    return;
+  }
+  graph_resize_targets(&state->graph, width, height);
+  progressive_restart(&state->progressive);
+  if (!offscreen) {
+    return;
+  }
+  if (!state->screen_framebuffer) {
+    initialize_framebuffer(&state->screen_framebuffer, &state->screen_texture,
+                           width, height, FORMAT_RGB8, FILTER_LINEAR);
+  } else {
+    resize_framebuffer(state->screen_framebuffer, state->screen_texture,
+                       width, height, FORMAT_RGB8);
+  }
+  /* Shown until the first frame is complete in progressive mode */
+  glBindFramebuffer(GL_FRAMEBUFFER, state->screen_framebuffer);
+  glClearColor(0, 0, 0, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/**
+ * @brief Compute and upload the standard uniforms of a new frame.
+ *
+ * @param state The renderer state, with the time and frame count of
+ * the frame to render.
+ * @param width The width at which the passes render.
+ * @param height The height at which the passes render.
+ */
+static void update_frame_globals(struct renderer_state *state, int width,
+                                 int height) {
+  double mouse_x = 0, mouse_y = 0;
+  if (state->window) {
+    glfwGetCursorPos(state->window, &mouse_x, &mouse_y);
+  }
+  state->globals = (struct frame_globals){
+      .time = state->time,
+      .frame = state->frame_count,
+      .resolution = {width, height},
+      .mouse = {mouse_x * state->resolution.scale,
+                mouse_y * state->resolution.scale},
+  };
+  update_globals(state->globals_ubo, &state->globals);
+}
+
+/**
+ * @brief Compute the output of a native pass on the CPU, and upload it
+ * to the render target of the pass.
+ *
+ * The time of the kernel and of the upload is recorded in the timer
+ * statistics of the pass, in place of a GPU time.
+ *
+ * @param state The renderer state.
+ * @param pass The native pass.
+ * @param width The width of the render targets.
+ * @param height The height of the render targets.
+ */
+static void run_native_pass(struct renderer_state *state,
+                            struct render_pass *pass, int width, int height) {
+  double start = timing_now();
+  if (kernel_run(&pass->kernel, &state->pool, &state->globals, width,
+                 height)) {
+    return;
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, state->graph.targets[pass->target].texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA,
+                  GL_UNSIGNED_BYTE, pass->kernel.pixels);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  timing_stats_add(&pass->shader.timer.stats, timing_now() - start);
+}
+
+/**
+ * @brief Render one frame of all the passes of the render graph.
+ *
+ * The passes render into their render targets in dependency order,
+ * then the screen pass renders into the output framebuffer, which is
+ * the window or the offscreen target in headless mode. The passes
+ * render at the output size multiplied by the render scale, and the
+ * result is upscaled to the output if needed. The output framebuffer
+ * is left bound, with a viewport covering it, so that it can be read
+ * back afterwards.
+ *
+ * In progressive mode, only the tiles that fit in the time budget are
+ * drawn, and the next call continues the same frame, with the same
+ * standard uniforms. The output shows the tiles of the screen pass
+ * drawn so far over the previous frame. The GPU is waited for at the
+ * end of each call, to measure the cost of the tiles and to keep each
+ * submission short.
+ *
+ * @param state The renderer state, with the time and frame count of
+ * the frame to render.
+ * @return `true` if the frame is complete, `false` if some tiles are
+ * left for the next calls.
+ */
+bool render_frame(struct renderer_state *state) {
+  struct progressive_state *progressive = &state->progressive;
+  bool tiled = progressive_enabled(progressive);
+  int width = 0, height = 0;
+  resolution_size(&state->resolution, state->width, state->height, &width,
+                  &height);
+  bool scaled = width != state->width || height != state->height;
+  bool offscreen = scaled || tiled;
+  update_render_size(state, width, height, offscreen);
+
+  /* Standard uniforms, uploaded once for all the passes */
+  profile_phase_begin(&state->profile);
+  if (!progressive_started(progressive)) {
+    update_frame_globals(state, width, height);
+  }
+  profile_phase_end(&state->profile, PHASE_UNIFORMS);
+
+  profile_phase_begin(&state->profile);
+  struct render_graph *graph = &state->graph;
+  size_t num_tiles = progressive_num_tiles(progressive, width, height);
+  size_t budget = tiled ? progressive->tiles_per_frame : SIZE_MAX;
+  size_t drawn = 0;
+  double start = timing_now();
+  glViewport(0, 0, width, height);
+  glBindVertexArray(state->vao);
+  if (tiled) {
+    glEnable(GL_SCISSOR_TEST);
+  }
+  while (progressive->pass < graph->num_active && drawn < budget) {
+    struct render_pass *pass = &graph->passes[graph->order[progressive->pass]];
+    bool screen = progressive->pass + 1 == graph->num_active;
+
+    /* bind the target of the pass, the last pass renders to the output */
+    if (screen) {
+      glBindFramebuffer(GL_FRAMEBUFFER, offscreen ? state->screen_framebuffer
+                                                  : state->output_framebuffer);
+      glClearColor(1.0, 1.0, 1.0, 1.0);
+    } else {
+      if (pass->feedback && progressive->tile == 0) {
+        /* Write over the output of two frames ago, the previous frame
+           stays readable */
+        size_t history = pass->history;
+        pass->history = pass->target;
+        pass->target = history;
+      }
+      glBindFramebuffer(GL_FRAMEBUFFER,
+                        graph->targets[pass->target].framebuffer);
+      glClearColor(0, 0, 0, 1.0f);
+    }
+
+    if (pass->native) {
+      /* The kernel uses all the cores already, it runs in one go */
+      run_native_pass(state, pass, width, height);
+      progressive->tile = num_tiles;
+      drawn++;
+    } else {
+      /* Clear the tiles drawn in this iteration first, so that the
+         timer only measures the draws */
+      size_t first = progressive->tile;
+      size_t count = num_tiles - first < budget - drawn ? num_tiles - first
+                                                        : budget - drawn;
+      for (; progressive->tile < first + count; progressive->tile++) {
+        int x = 0, y = 0, tile_width = 0, tile_height = 0;
+        progressive_tile(progressive, width, height, &x, &y, &tile_width,
+                         &tile_height);
+        glScissor(x, y, tile_width, tile_height);
+        glClear(GL_COLOR_BUFFER_BIT);
+      }
+      progressive->tile = first;
+
+      gpu_timer_begin(&pass->shader.timer);
+
+      /* Setup uniforms and inputs */
+      glUseProgram(pass->shader.program);
+      apply_globals(&pass->shader.uniforms, &state->globals);
+      control_apply_uniforms(&state->control, &pass->shader.uniforms);
+      graph_bind_inputs(graph, pass);
+
+      /* Draw the vertices, restricted to the tiles that fit in the
+         budget */
+      while (progressive->tile < num_tiles && drawn < budget) {
+        int x = 0, y = 0, tile_width = 0, tile_height = 0;
+        progressive_tile(progressive, width, height, &x, &y, &tile_width,
+                         &tile_height);
+        glScissor(x, y, tile_width, tile_height);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        progressive->tile++;
+        drawn++;
+      }
+
+      gpu_timer_end(&pass->shader.timer);
+    }
+    if (progressive->tile == num_tiles) {
+      progressive->pass++;
+      progressive->tile = 0;
+    }
+  }
+  glBindVertexArray(0);
+  bool complete = progressive->pass == graph->num_active;
+  if (complete) {
+    progressive_restart(progressive);
+  }
+  if (tiled) {
+    glDisable(GL_SCISSOR_TEST);
+    glFinish();
+    progressive_update(progressive, drawn, timing_now() - start);
+  }
+
+  if (offscreen) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, state->screen_framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, state->output_framebuffer);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, state->width, state->height,
+                      GL_COLOR_BUFFER_BIT, scaled ? GL_LINEAR : GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, state->output_framebuffer);
+  }
+  glViewport(0, 0, state->width, state->height);
+  profile_phase_end(&state->profile, PHASE_DRAW);
+  return complete;
+}
+
 /**
  * @brief Callback to adjust the size of the viewport when the window
  * is resized.
  *
- * @param window The current window.
+ * The render targets follow the new size at the next frame.
+ *
+ * @param window The current window, whose user pointer is the
+ * renderer state.
  * @param width The new width.
  * @param height The new height.
  */
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
-  UNUSED(window);
+  struct renderer_state *state = glfwGetWindowUserPointer(window);
+  if (state) {
+    state->width = width;
+    state->height = height;
+    state->redraw = true;
+  }
   glViewport(0, 0, width, height);
 }
+
+/**
+ * @brief Request a new frame, for events that may change the image of
+ * static shaders.
+ *
+ * @param window The window, whose user pointer is the renderer state.
+ */
+static void request_redraw(GLFWwindow *window) {
+  struct renderer_state *state = glfwGetWindowUserPointer(window);
+  if (state) {
+    state->redraw = true;
+  }
+}
+
+/**
+ * @brief Callback redrawing the window when its contents are damaged.
+ *
+ * @param window The window.
+ */
+void window_refresh_callback(GLFWwindow *window) { request_redraw(window); }
+
+/**
+ * @brief Callback redrawing the window when a key is pressed or
+ * released. The keys themselves are read by process_input().
+ *
+ * @param window The window.
+ * @param key The key.
+ * @param scancode The platform-specific scancode of the key.
+ * @param action Whether the key was pressed, repeated or released.
+ * @param mods The modifier keys held down.
+ */
+void key_callback(GLFWwindow *window, int key, int scancode, int action,
+                  int mods) {
+  (void)key;
+  (void)scancode;
+  (void)action;
+  (void)mods;
+  request_redraw(window);
+}
+
+/**
+ * @brief Callback redrawing the window when a mouse button is pressed
+ * or released.
+ *
+ * @param window The window.
+ * @param button The mouse button.
+ * @param action Whether the button was pressed or released.
+ * @param mods The modifier keys held down.
+ */
+void mouse_button_callback(GLFWwindow *window, int button, int action,
+                           int mods) {
+  (void)button;
+  (void)action;
+  (void)mods;
+  request_redraw(window);
+}
@@ -1,41 +1,94 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <EGL/egl.h>
+#include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-/**
- * Structure representing the state of a shader.
- */
-struct shader_state {
-  unsigned int program; /**< Shader program ID. */
-  const char *filename; /**< Shader file name. */
-  int wd;               /**< inotify watch descriptor. */
-};
+#include "capture.h"
+#include "control.h"
+#include "export.h"
+#include "graph.h"
+#include "pool.h"
+#include "profile.h"
+#include "progressive.h"
+#include "resolution.h"
+#include "timing.h"
+#include "uniforms.h"
+#include "variants.h"
+#include "watch.h"
 
 /**
  * Structure representing the state of the renderer and associated
  * shaders.
  */
 struct renderer_state {
-  GLFWwindow *window; /**< GLFW window where the shaders are rendered. */
-  struct shader_state screen_shader; /**< Shader for the main screen. */
-  struct shader_state buffer_shader; /**< Shader for the framebuffer. */
-  unsigned int framebuffer;          /**< Framebuffer. */
-  unsigned int
-      texture_color_buffer; /**< Texture where the framebuffer renders. */
-  int inotify_fd;           /**< inotify file descriptor. */
+  GLFWwindow *window; /**< GLFW window where the shaders are rendered, or
+                         `NULL` in headless mode. */
+  EGLDisplay egl_display; /**< EGL display used in headless mode. */
+  EGLContext egl_context; /**< EGL context used in headless mode. */
+  EGLSurface egl_surface; /**< EGL pbuffer surface, or `EGL_NO_SURFACE` when
+                             the context is surfaceless. */
+  struct render_graph graph; /**< Passes rendered in each frame. */
+  struct shader_variants variants; /**< Defines inserted in the shaders. */
+  struct thread_pool pool; /**< Threads running the native passes. */
+  struct texture_loader loader; /**< Threads decoding the images. */
+  unsigned int vao;                  /**< Vertex array of the screen quad. */
+  unsigned int globals_ubo; /**< Uniform buffer of the standard uniforms. */
+  unsigned int output_framebuffer; /**< Framebuffer where the screen shader
+                                      renders, 0 for the window. */
+  unsigned int output_texture; /**< Texture attached to the output
+                                  framebuffer in headless mode. */
+  int width;  /**< Width of the output framebuffer. */
+  int height; /**< Height of the output framebuffer. */
+  struct resolution_controller resolution; /**< Render scale. */
+  struct progressive_state progressive; /**< Progress of the frame. */
+  struct frame_globals globals; /**< Standard uniforms of the frame. */
+  unsigned int screen_framebuffer; /**< Framebuffer where the screen shader
+                                      renders when the render scale is
+                                      lower than 1 or in progressive mode,
+                                      or 0. */
+  unsigned int screen_texture; /**< Texture attached to the screen
+                                  framebuffer. */
+  struct file_watcher watcher; /**< Watcher of the shader files. */
+  struct capture_state capture; /**< Asynchronous screenshot capture. */
+  bool screenshot_requested; /**< Capture the next rendered frame. */
+  bool poster_requested;     /**< Render the next frame as a poster. */
+  bool redraw; /**< Something changed since the last frame, which must be
+                  drawn again even if the shaders are static. */
+  struct export_state export; /**< Export of every rendered frame. */
+  struct control_state control; /**< Commands from the control socket. */
+  bool paused;  /**< The time is stopped by the control socket. */
+  size_t steps; /**< Frames to render while paused. */
   size_t frame_count; /**< Frame count since the start of the render loop. */
   size_t prev_frame_count; /**< Frame count at the last log. */
   double time;      /**< Time in seconds since the start of the render loop. */
   double prev_time; /**< Time in seconds at the last log. */
+  struct timing_stats cpu_frame; /**< CPU time spent on each frame. */
+  struct frame_profile profile;  /**< Timings of the render loop phases. */
 };
 
 GLFWwindow *initialize_window(int width, int height);
+int initialize_headless_context(struct renderer_state *state, int width,
+                                int height);
+void terminate_context(struct renderer_state *state);
 unsigned int initialize_vertices();
 unsigned int initialize_framebuffer(unsigned int *framebuffer,
                                     unsigned int *texture_color_buffer,
                                     unsigned int texture_width,
-                                    unsigned int texture_height);
+                                    unsigned int texture_height,
+                                    enum target_format format,
+                                    enum target_filter filter);
+int resize_framebuffer(unsigned int framebuffer, unsigned int texture,
+                       int width, int height, enum target_format format);
+bool render_frame(struct renderer_state *state);
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
+void window_refresh_callback(GLFWwindow *window);
+void key_callback(GLFWwindow *window, int key, int scancode, int action,
+                  int mods);
+void mouse_button_callback(GLFWwindow *window, int button, int action,
+                           int mods);
 
 #endif /* RENDERER_H */
@@ -0,0 +1,85 @@
+#include <math.h>
+
+#include "log.h"
+#include "resolution.h"
+
+/**
+ * @brief Initialize the resolution controller.
+ *
+ * @param controller The controller to initialize.
+ * @param target_ms Target cost of a frame in milliseconds, or 0 to
+ * always render at the given scale.
+ * @param scale Initial and highest render scale, between 0 and 1.
+ */
+void resolution_init(struct resolution_controller *controller,
+                     double target_ms, double scale) {
+  controller->target_ms = target_ms;
+  controller->max_scale = scale;
+  controller->scale = scale;
+  controller->cost_ms = 0;
+  controller->settle = RESOLUTION_SETTLE_FRAMES;
+}
+
+/**
+ * @brief Record the cost of a frame, and adjust the render scale if
+ * the smoothed cost leaves the band between the headroom and the
+ * target.
+ *
+ * After a change, the controller waits for a few frames, so that the
+ * timings of frames rendered at the old scale have been collected.
+ *
+ * @param controller The controller.
+ * @param cost_ms The cost of the last frame in milliseconds.
+ * @return `true` if the render scale changed.
+ */
+bool resolution_update(struct resolution_controller *controller,
+                       double cost_ms) {
+  if (controller->target_ms <= 0 || cost_ms <= 0) {
+    return false;
+  }
+  if (controller->settle > 0) {
+    controller->settle--;
+    return false;
+  }
+  controller->cost_ms =
+      controller->cost_ms > 0
+          ? controller->cost_ms +
+                RESOLUTION_SMOOTHING * (cost_ms - controller->cost_ms)
+          : cost_ms;
+
+  double ratio = controller->target_ms / controller->cost_ms;
+  if (ratio >= 1 && ratio * RESOLUTION_HEADROOM <= 1) {
+    return false;
+  }
+  /* The cost grows with the number of pixels, the square of the scale */
+  double scale = controller->scale * sqrt(ratio);
+  scale = floor(scale / RESOLUTION_STEP + 1e-6) * RESOLUTION_STEP;
+  scale = fmin(fmax(scale, RESOLUTION_MIN_SCALE), controller->max_scale);
+  if (fabs(scale - controller->scale) < RESOLUTION_STEP / 2) {
+    return false;
+  }
+
+  log_debug("Render scale %.2f -> %.2f (frame cost %.2f ms, target %.2f ms)",
+            controller->scale, scale, controller->cost_ms,
+            controller->target_ms);
+  controller->scale = scale;
+  controller->cost_ms = 0;
+  controller->settle = RESOLUTION_SETTLE_FRAMES;
+  return true;
+}
+
+/**
+ * @brief Size of the render targets for an output size.
+ *
+ * @param controller The controller.
+ * @param width The width of the output.
+ * @param height The height of the output.
+ * @param render_width The width at which the passes render.
+ * @param render_height The height at which the passes render.
+ */
+void resolution_size(const struct resolution_controller *controller,
+                     int width, int height, int *render_width,
+                     int *render_height) {
+  *render_width = fmax(1, lround(width * controller->scale));
+  *render_height = fmax(1, lround(height * controller->scale));
+}
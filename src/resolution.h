@@ -0,0 +1,38 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RESOLUTION_MIN_SCALE 0.25   /**< Lowest render scale. */
+#define RESOLUTION_STEP 0.05        /**< Granularity of the render scale. */
+#define RESOLUTION_HEADROOM 0.75    /**< Cost ratio below which the scale
+                                       increases again. */
+#define RESOLUTION_SMOOTHING 0.1    /**< Weight of a new frame cost. */
+#define RESOLUTION_SETTLE_FRAMES 16 /**< Frames to wait after a change. */
+
+/**
+ * Dynamic resolution controller.
+ *
+ * The passes render at a fraction of the output size, which the
+ * controller adjusts to keep the cost of a frame under a target. The
+ * cost is assumed to be proportional to the number of pixels, and a
+ * band between the headroom and the target avoids oscillations.
+ */
+struct resolution_controller {
+  double target_ms; /**< Target cost of a frame, or 0 for a fixed scale. */
+  double max_scale; /**< Highest render scale. */
+  double scale;     /**< Current render scale. */
+  double cost_ms;   /**< Smoothed cost of a frame, or 0 if unknown. */
+  size_t settle;    /**< Frames left before the next adjustment. */
+};
+
+void resolution_init(struct resolution_controller *controller,
+                     double target_ms, double scale);
+bool resolution_update(struct resolution_controller *controller,
+                       double cost_ms);
+void resolution_size(const struct resolution_controller *controller,
+                     int width, int height, int *render_width,
+                     int *render_height);
+
+#endif /* RESOLUTION_H */
@@ -1,167 +1,579 @@
 #include <GL/glew.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/inotify.h>
+#include <string.h>
 
+#include "cache.h"
 #include "log.h"
 #include "renderer.h"
 #include "shaders.h"
+#include "timing.h"
+#include "uniforms.h"
+
+/** The driver compiles shaders in the background. */
+static bool parallel_compile = false;
+
+/** Source of the vertex shader shared by all the programs. */
+static const char *const vertex_shader_source =
+    "#version 330 core\n"
+    "layout (location = 0) in vec3 aPos;\n"
+    "layout (location = 1) in vec2 aTexCoord;\n"
+    "out vec2 TexCoord;\n"
+    "void main()\n"
+    "{\n"
+    "  gl_Position = vec4(aPos, 1.0);\n"
+    "  TexCoord = aTexCoord;\n"
+    "}\n";
 
 /**
- * @brief Initialize shaders, compile them, and create the required
- * texture for the buffer shader.
+ * @brief Initialize the shaders of the active passes of the render
+ * graph, compile them, and create the render targets.
+ *
+ * Native passes load their kernel instead, and start the thread pool
+ * running them. The images read by the passes start decoding in the
+ * background, and the data streams start reading their records.
  *
- * @param state The target renderer state.
- * @param shader_file The file name of the screen shader.
- * @param buffer_file The file name of the buffer shader, or NULL if no buffer
- * shader.
- * @param texture_width The width of the texture for the buffer shader.
- * @param texture_height The height of the texture for the buffer shader.
+ * @param state The target renderer state, with a built render graph.
+ * @param texture_width The width of the render targets.
+ * @param texture_height The height of the render targets.
  * @return 0 on success, 1 on error.
  */
-int initialize_shaders(struct renderer_state *state, const char *shader_file,
-                       const char *buffer_file, int texture_width,
+int initialize_shaders(struct renderer_state *state, int texture_width,
                        int texture_height) {
-  state->screen_shader.filename = shader_file;
-  log_info("Screen shader file: %s", state->screen_shader.filename);
-
-  if (state->inotify_fd != -1) {
-    state->screen_shader.wd = inotify_add_watch(
-        state->inotify_fd, state->screen_shader.filename, IN_MODIFY);
-    if (state->screen_shader.wd == -1) {
-      log_warn("[inotify] Cannot watch file %s", state->screen_shader.filename);
-      perror("inotify_add_watch");
-    } else {
-      log_debug("[inotify] Watching file %s", state->screen_shader.filename);
-    }
-  }
-
-  if (buffer_file) {
-    state->buffer_shader.filename = buffer_file;
-    log_info("Buffer shader file: %s", state->buffer_shader.filename);
-
-    if (state->inotify_fd != -1) {
-      state->buffer_shader.wd = inotify_add_watch(
-          state->inotify_fd, state->buffer_shader.filename, IN_MODIFY);
-      if (state->buffer_shader.wd == -1) {
-        log_warn("[inotify] Cannot watch file %s",
-                 state->buffer_shader.filename);
-        perror("inotify_add_watch");
-      } else {
-        log_debug("[inotify] Watching file %s", state->buffer_shader.filename);
+  struct render_graph *graph = &state->graph;
+  state->globals_ubo = initialize_globals();
+
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    parallel_compile = true;
+    log_debug("Shaders are compiled in the background by the driver");
+  }
+
+  bool native = false;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    struct render_pass *pass = &graph->passes[graph->order[k]];
+    struct shader_state *shader = &pass->shader;
+    log_info("Pass %s: %s", pass->name, shader->filename);
+
+    if (pass->native) {
+      if (kernel_load(&pass->kernel, pass->filename)) {
+        return 1;
       }
+      native = true;
+      continue;
+    }
+    shader->program = glCreateProgram();
+    if (!shader->program) {
+      log_error("Could not create shader program of pass %s", pass->name);
+      return 1;
     }
+    uniform_cache_clear(&shader->uniforms);
+    gpu_timer_init(&shader->timer);
+    shader->defines = variants_defines(&state->variants);
+    shader->keep_variants = variants_count(&state->variants) > 1;
+    compile_shaders(shader);
   }
-
-  state->screen_shader.program = glCreateProgram();
-  if (!state->screen_shader.program) {
-    log_error("Could not create screen shader program");
+  if (native && pool_init(&state->pool, 0)) {
     return 1;
   }
-  compile_shaders(&state->screen_shader.program, state->screen_shader.filename);
-  glUseProgram(state->screen_shader.program);
-  glUniform1i(glGetUniformLocation(state->screen_shader.program, "u_texture"),
-              0);
 
-  if (state->buffer_shader.filename) {
-    state->buffer_shader.program = glCreateProgram();
-    if (!state->buffer_shader.program) {
-      log_error("Could not create buffer shader program");
+  if (graph->num_textures &&
+      texture_loader_init(&state->loader, graph->num_textures)) {
+    return 1;
+  }
+  for (size_t i = 0; i < graph->num_textures; ++i) {
+    if (graph->textures[i].active) {
+      texture_init(&graph->textures[i]);
+      texture_load(&state->loader, graph->textures, i);
+    }
+  }
+  for (size_t i = 0; i < graph->num_streams; ++i) {
+    struct data_stream *stream = &graph->streams[i];
+    /* Wake up the window when static shaders wait for events */
+    stream->notify = state->window ? glfwPostEmptyEvent : NULL;
+    if (stream->active && stream_open(stream)) {
       return 1;
     }
-    compile_shaders(&state->buffer_shader.program,
-                    state->buffer_shader.filename);
-    glUseProgram(state->buffer_shader.program);
-    glUniform1i(glGetUniformLocation(state->buffer_shader.program, "u_texture"),
-                0);
+  }
 
-    if (initialize_framebuffer(&state->framebuffer,
-                               &state->texture_color_buffer, texture_width,
-                               texture_height)) {
-      return 1;
+  return graph_initialize_targets(graph, texture_width, texture_height);
+}
+
+/**
+ * @brief Insert code after the `#version` line of a shader source.
+ *
+ * A `#line` directive follows the inserted code, so that errors are
+ * reported at the lines of the original source.
+ *
+ * @param source The source of the shader.
+ * @param defines The `#define` lines to insert first, or NULL.
+ * @param prelude The code to insert next, ending with a newline, or
+ * NULL.
+ * @return The new source, to be freed by the caller, or NULL on error.
+ */
+static char *insert_prelude(const char *source, const char *defines,
+                            const char *prelude) {
+  defines = defines ? defines : "";
+  prelude = prelude ? prelude : "";
+  /* The #version directive must come first, skip it if present */
+  size_t offset = 0;
+  size_t line = 1;
+  const char *version = strstr(source, "#version");
+  if (version) {
+    const char *end = strchr(version, '\n');
+    offset = end ? (size_t)(end + 1 - source) : strlen(source);
+    for (const char *c = source; c < source + offset; ++c) {
+      line += *c == '\n';
     }
   }
+  size_t size = strlen(source) + strlen(defines) + strlen(prelude) + 32;
+  char *result = malloc(size);
+  if (result == NULL) {
+    return NULL;
+  }
+  snprintf(result, size, "%.*s%s%s#line %zu\n%s", (int)offset, source,
+           defines, prelude, line, source + offset);
+  return result;
+}
 
-  return 0;
+/**
+ * @brief Stop using the current program of a shader.
+ *
+ * When the shader has several variants, the program is kept with the
+ * sources it was compiled from, replacing the program unused for the
+ * longest time if all the slots are taken. Otherwise it is deleted.
+ *
+ * @param shader The shader.
+ */
+static void retire_program(struct shader_state *shader) {
+  if (!shader->keep_variants || !shader->source_hash) {
+    glDeleteProgram(shader->program);
+    return;
+  }
+  struct program_variant *slot = &shader->variants[0];
+  for (size_t i = 0; i < MAX_VARIANTS; ++i) {
+    if (!shader->variants[i].program) {
+      slot = &shader->variants[i];
+      break;
+    }
+    if (shader->variants[i].retired < slot->retired) {
+      slot = &shader->variants[i];
+    }
+  }
+  if (slot->program) {
+    glDeleteProgram(slot->program);
+  }
+  slot->program = shader->program;
+  slot->source_hash = shader->source_hash;
+  slot->retired = timing_now();
+}
+
+/**
+ * @brief Use a program kept by retire_program(), if one was compiled
+ * from the given sources.
+ *
+ * The current program is retired in its place, so that switching
+ * between variants never compiles once each was used.
+ *
+ * @param shader The shader.
+ * @param key The hash of the sources.
+ * @return `true` if the program was found and is now in use.
+ */
+static bool restore_program(struct shader_state *shader, uint64_t key) {
+  for (size_t i = 0; i < MAX_VARIANTS; ++i) {
+    struct program_variant *slot = &shader->variants[i];
+    if (slot->program && slot->source_hash == key) {
+      unsigned int program = slot->program;
+      slot->program = 0;
+      retire_program(shader);
+      shader->program = program;
+      shader->source_hash = key;
+      uniform_cache_build(&shader->uniforms, shader->program);
+      return true;
+    }
+  }
+  return false;
 }
 
 /**
- * @brief Compile shaders from source files.
+ * @brief Start compiling shaders from source files.
  *
  * This function reads the source files of the vertex and fragment
- * shaders, compiles them, and links them together in a shader
- * program.
+ * shaders, expanding the `#include` directives of the fragment shader
+ * with preprocess_shader(), and submits their compilation and linking
+ * in a new program, without checking the results. With
+ * `GL_KHR_parallel_shader_compile`, the driver compiles in background
+ * threads and poll_compile() can check for completion without
+ * blocking. The current program keeps rendering in the meantime.
  *
- * @param shader_program Pointer to the ID of the shader program
- * where the shaders will be stored.
- * @param fragment_shader_file File name of the fragment shader.
+ * Sources identical to those of the current program are skipped,
+ * programs of other variants kept in memory are reused immediately,
+ * and programs found in the binary cache are loaded instead of
+ * compiled. The defines of the variant in use and the prelude of the
+ * shader, if any, are inserted in the fragment shader.
+ *
+ * @param shader The shader to recompile.
  * @return 0 on success, 1 on error.
  */
-int compile_shaders(unsigned int *shader_program,
-                    const char *const fragment_shader_file) {
+int begin_compile(struct shader_state *shader) {
+  const char *const fragment_shader_file = shader->filename;
+  discard_compile(shader);
+
+  const char *fragment_shader_source =
+      preprocess_shader(fragment_shader_file, &shader->sources);
+  if (fragment_shader_source == NULL) {
+    log_error("Could not load fragment shader from file %s",
+              fragment_shader_file);
+    return 1;
+  }
+  if (shader->defines || shader->prelude) {
+    char *source = insert_prelude(fragment_shader_source, shader->defines,
+                                  shader->prelude);
+    free((void *)fragment_shader_source);
+    if (source == NULL) {
+      log_error("Failed to allocate memory for shader %s",
+                fragment_shader_file);
+      return 1;
+    }
+    fragment_shader_source = source;
+  }
+
+  const char *const sources[] = {vertex_shader_source,
+                                 fragment_shader_source};
+  uint64_t key = program_cache_key(sources, 2);
+  if (shader->program && shader->source_hash == key) {
+    log_debug("%s is unchanged, skipping", fragment_shader_file);
+    free((void *)fragment_shader_source);
+    return 0;
+  }
+  if (restore_program(shader, key)) {
+    log_debug("%s was compiled before, reusing its program",
+              fragment_shader_file);
+    free((void *)fragment_shader_source);
+    return 0;
+  }
+  shader->pending_hash = key;
+
+  shader->pending_program = glCreateProgram();
+  if (program_cache_load(key, shader->pending_program)) {
+    free((void *)fragment_shader_source);
+    return 0;
+  }
   log_debug("Compiling %s", fragment_shader_file);
+
   /* Compile vertex shader */
-  const char *const vertex_shader_source =
-      "#version 330 core\n"
-      "layout (location = 0) in vec3 aPos;\n"
-      "layout (location = 1) in vec2 aTexCoord;\n"
-      "out vec2 TexCoord;\n"
-      "void main()\n"
-      "{\n"
-      "  gl_Position = vec4(aPos, 1.0);\n"
-      "  TexCoord = aTexCoord;\n"
-      "}\n";
-
-  unsigned int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-  glCompileShader(vertex_shader);
+  shader->pending_vertex = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(shader->pending_vertex, 1, &vertex_shader_source, NULL);
+  glCompileShader(shader->pending_vertex);
+
+  /* Compile fragment shader */
+  shader->pending_fragment = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(shader->pending_fragment, 1, &fragment_shader_source, NULL);
+  glCompileShader(shader->pending_fragment);
+  free((void *)fragment_shader_source);
+
+  /* Link shaders, errors are reported when the link completes */
+  glAttachShader(shader->pending_program, shader->pending_vertex);
+  glAttachShader(shader->pending_program, shader->pending_fragment);
+  glProgramParameteri(shader->pending_program,
+                      GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(shader->pending_program);
+
+  return 0;
+}
+
+/**
+ * @brief Check whether the pending compilation of a shader is done.
+ *
+ * @param shader The shader being compiled.
+ * @param wait Wait for the compilation to complete.
+ * @return `COMPILE_NONE` if nothing is being compiled,
+ * `COMPILE_PENDING` if the driver is still working, and
+ * `COMPILE_DONE` or `COMPILE_FAILED` when the program is linked.
+ */
+enum compile_status poll_compile(struct shader_state *shader, bool wait) {
+  if (!shader->pending_program) {
+    return COMPILE_NONE;
+  }
+  if (!shader->pending_vertex) {
+    /* Loaded from the binary cache, already linked */
+    return COMPILE_DONE;
+  }
   int success = 0;
+  if (!wait && parallel_compile) {
+    glGetProgramiv(shader->pending_program, GL_COMPLETION_STATUS_KHR,
+                   &success);
+    if (!success) {
+      return COMPILE_PENDING;
+    }
+  }
+
   char info_log[512];
-  glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(shader->pending_vertex, GL_COMPILE_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(vertex_shader, 512, NULL, info_log);
+    glGetShaderInfoLog(shader->pending_vertex, 512, NULL, info_log);
     log_error("Vertex shader compilation failed: %s", info_log);
+    discard_compile(shader);
+    return COMPILE_FAILED;
   }
-
-  /* Compile fragment shader */
-  const char *const fragment_shader_source = read_file(fragment_shader_file);
-  if (fragment_shader_source == NULL) {
-    log_error("Could not load fragment shader from file %s",
-              fragment_shader_file);
-    return 1;
-  }
-  unsigned int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-  glCompileShader(fragment_shader);
-  glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(shader->pending_fragment, GL_COMPILE_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(fragment_shader, 512, NULL, info_log);
+    glGetShaderInfoLog(shader->pending_fragment, 512, NULL, info_log);
     log_error("Fragment shader compilation failed: %s", info_log);
-    return 1;
+    shader_sources_log(&shader->sources);
+    discard_compile(shader);
+    return COMPILE_FAILED;
   }
-
-  /* Link shaders */
-  unsigned int new_shader_program = glCreateProgram();
-  glAttachShader(new_shader_program, vertex_shader);
-  glAttachShader(new_shader_program, fragment_shader);
-  glLinkProgram(new_shader_program);
-  glGetShaderiv(new_shader_program, GL_LINK_STATUS, &success);
+  glGetProgramiv(shader->pending_program, GL_LINK_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(new_shader_program, 512, NULL, info_log);
+    glGetProgramInfoLog(shader->pending_program, 512, NULL, info_log);
     log_error("Shader program linking failed: %s", info_log);
-    return 1;
+    discard_compile(shader);
+    return COMPILE_FAILED;
   }
+  return COMPILE_DONE;
+}
 
-  glDeleteProgram(*shader_program);
-  *shader_program = new_shader_program;
+/**
+ * @brief Replace the current program of a shader with its
+ * successfully linked pending program.
+ *
+ * The registry of active uniforms is rebuilt for the new program. The
+ * previous program is retired with retire_program().
+ *
+ * @param shader The shader whose pending compilation is done.
+ */
+void commit_compile(struct shader_state *shader) {
+  if (shader->pending_vertex) {
+    program_cache_store(shader->pending_hash, shader->pending_program);
+    glDeleteShader(shader->pending_vertex);
+    glDeleteShader(shader->pending_fragment);
+  }
+  retire_program(shader);
+  shader->program = shader->pending_program;
+  shader->pending_program = 0;
+  shader->pending_vertex = 0;
+  shader->pending_fragment = 0;
+  shader->source_hash = shader->pending_hash;
 
-  free((void *)fragment_shader_source);
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
+  /* Refresh the uniform registry for the new program, samplers are
+     bound before its first use */
+  uniform_cache_build(&shader->uniforms, shader->program);
 
   log_debug("Shaders compiled successfully");
+}
 
-  return 0;
+/**
+ * @brief Abandon the pending compilation of a shader, if any.
+ *
+ * @param shader The shader being compiled.
+ */
+void discard_compile(struct shader_state *shader) {
+  if (shader->pending_program) {
+    glDeleteProgram(shader->pending_program);
+  }
+  if (shader->pending_vertex) {
+    glDeleteShader(shader->pending_vertex);
+  }
+  if (shader->pending_fragment) {
+    glDeleteShader(shader->pending_fragment);
+  }
+  shader->pending_program = 0;
+  shader->pending_vertex = 0;
+  shader->pending_fragment = 0;
+}
+
+/**
+ * @brief Compile shaders from source files, and wait for the result.
+ *
+ * On success, the previous program is replaced and the registry of
+ * active uniforms is rebuilt. On failure, the previous program and
+ * its registry are kept.
+ *
+ * @param shader The shader whose program will be replaced.
+ * @return 0 on success, 1 on error.
+ */
+int compile_shaders(struct shader_state *shader) {
+  if (begin_compile(shader)) {
+    return 1;
+  }
+  enum compile_status status = poll_compile(shader, true);
+  if (status == COMPILE_DONE) {
+    commit_compile(shader);
+  }
+  return status == COMPILE_FAILED;
+}
+
+/**
+ * @brief Check that every shader has a successfully linked program.
+ *
+ * Interactive sessions keep running with broken shaders, waiting for
+ * a fix, but non-interactive modes use this to fail early.
+ *
+ * @param state The renderer state.
+ * @return true if all the programs are ready to render.
+ */
+bool shaders_ready(const struct renderer_state *state) {
+  const struct render_graph *graph = &state->graph;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    const struct render_pass *pass = &graph->passes[graph->order[k]];
+    if (pass->native ? !pass->kernel.run : !pass->shader.source_hash) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < graph->num_textures; ++i) {
+    if (graph->textures[i].active && graph->textures[i].width == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Check whether the frame only changes when the shaders do.
+ *
+ * This is the case when no pass reads the time, the frame number or
+ * the mouse position, or its own output of the previous frame, and no
+ * pass is a native kernel, which may read all of them. The
+ * render loop can then wait for events instead of redrawing.
+ *
+ * @param state The renderer state.
+ * @return `true` if rendering again would give the same image.
+ */
+bool shaders_static(const struct renderer_state *state) {
+  const struct render_graph *graph = &state->graph;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    const struct render_pass *pass = &graph->passes[graph->order[k]];
+    if (pass->native || pass->feedback ||
+        pass->shader.uniforms.time_varying) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Check whether some shaders are being compiled in the
+ * background.
+ *
+ * @param state The renderer state.
+ * @return `true` if a compilation is pending.
+ */
+bool shaders_compiling(const struct renderer_state *state) {
+  const struct render_graph *graph = &state->graph;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    if (graph->passes[graph->order[k]].shader.pending_program) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Start recompiling shaders in the background.
+ *
+ * The kernels of native passes are loaded again right away. When all
+ * the files are read again, the images are decoded again in the
+ * background too.
+ *
+ * @param state The renderer state.
+ * @param changed The passes to recompile, indexed like the passes of
+ * the graph, or NULL to read all the files again from disk and
+ * recompile all the passes.
+ * @return `true` if at least one shader changed and is being
+ * recompiled.
+ */
+bool reload_shaders(struct renderer_state *state, const bool *changed) {
+  struct render_graph *graph = &state->graph;
+  bool pending = false;
+  if (changed == NULL) {
+    source_cache_invalidate_all();
+    for (size_t i = 0; i < graph->num_textures; ++i) {
+      if (graph->textures[i].active) {
+        texture_load(&state->loader, graph->textures, i);
+      }
+    }
+  }
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    if (changed && !changed[graph->order[k]]) {
+      continue;
+    }
+    struct render_pass *pass = &graph->passes[graph->order[k]];
+    if (pass->native) {
+      kernel_load(&pass->kernel, pass->filename);
+      continue;
+    }
+    begin_compile(&pass->shader);
+    pending |= pass->shader.pending_program != 0;
+  }
+  return pending;
+}
+
+/**
+ * @brief Switch all the passes to the next variant.
+ *
+ * Variants used before switch immediately, others are compiled in the
+ * background like reloaded shaders.
+ *
+ * @param state The renderer state.
+ * @return `true` if at least one pass is being compiled for the new
+ * variant.
+ */
+bool switch_variant(struct renderer_state *state) {
+  struct shader_variants *variants = &state->variants;
+  if (variants_count(variants) < 2) {
+    log_info("No other variant to switch to, add some with --variant");
+    return false;
+  }
+  variants_select(variants, (variants->current + 1) % variants->count);
+  log_info("Variant %zu/%zu: %s", variants->current + 1, variants->count,
+           variants_name(variants));
+
+  struct render_graph *graph = &state->graph;
+  bool pending = false;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    struct render_pass *pass = &graph->passes[graph->order[k]];
+    if (pass->native) {
+      continue;
+    }
+    pass->shader.defines = variants_defines(variants);
+    begin_compile(&pass->shader);
+    pending |= pass->shader.pending_program != 0;
+  }
+  return pending;
+}
+
+/**
+ * @brief Check the shaders being recompiled, and swap in the new
+ * programs once they are all linked.
+ *
+ * The new programs replace the current ones in the same frame, so
+ * that all the passes change at once. Shaders that failed to compile
+ * keep their current program.
+ *
+ * @param state The renderer state.
+ * @return `true` if at least one program was replaced.
+ */
+bool poll_shader_reload(struct renderer_state *state) {
+  struct render_graph *graph = &state->graph;
+
+  bool done = false;
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    struct shader_state *shader = &graph->passes[graph->order[k]].shader;
+    enum compile_status status = poll_compile(shader, false);
+    if (status == COMPILE_PENDING) {
+      return false;
+    }
+    done |= status == COMPILE_DONE;
+  }
+
+  for (size_t k = 0; k < graph->num_active; ++k) {
+    struct shader_state *shader = &graph->passes[graph->order[k]].shader;
+    if (shader->pending_program) {
+      commit_compile(shader);
+    }
+  }
+  return done;
 }
 
 /**
@@ -3,11 +3,29 @@
 
 #include "renderer.h"
 
-int initialize_shaders(struct renderer_state *state, const char *shader_file,
-                       const char *buffer_file, int window_width,
-                       int window_height);
-int compile_shaders(unsigned int *shader_program,
-                    const char *const fragment_shader_file);
+/**
+ * Status of the background compilation of a shader.
+ */
+enum compile_status {
+  COMPILE_NONE,    /**< No compilation in progress. */
+  COMPILE_PENDING, /**< The driver is still compiling. */
+  COMPILE_DONE,    /**< The new program is linked and ready. */
+  COMPILE_FAILED,  /**< Compilation or linking failed. */
+};
+
+int initialize_shaders(struct renderer_state *state, int texture_width,
+                       int texture_height);
+int compile_shaders(struct shader_state *shader);
+bool shaders_ready(const struct renderer_state *state);
+bool shaders_static(const struct renderer_state *state);
+bool shaders_compiling(const struct renderer_state *state);
+int begin_compile(struct shader_state *shader);
+enum compile_status poll_compile(struct shader_state *shader, bool wait);
+void commit_compile(struct shader_state *shader);
+void discard_compile(struct shader_state *shader);
+bool reload_shaders(struct renderer_state *state, const bool *changed);
+bool switch_variant(struct renderer_state *state);
+bool poll_shader_reload(struct renderer_state *state);
 char *read_file(const char *const filename);
 
 #endif /* SHADERS_H */
@@ -0,0 +1,398 @@
+#include <GL/glew.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "stream.h"
+
+#define STREAM_POLL_MS 100   /**< Milliseconds between checks for exit
+                                while waiting for data. */
+#define STREAM_RETRY_MS 500  /**< Milliseconds between connection attempts
+                                to a socket without a producer. */
+
+/**
+ * @brief Check whether a pass file is a FIFO or a Unix socket, which
+ * feeds a data texture rather than a shader.
+ *
+ * @param filename The file of the pass.
+ * @return `true` if the file is a FIFO or a socket.
+ */
+bool stream_is_source(const char *filename) {
+  struct stat st;
+  return stat(filename, &st) == 0 &&
+         (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+}
+
+/**
+ * @brief Open the FIFO or connect to the Unix socket of a stream.
+ *
+ * A FIFO is opened without waiting for a writer: it only becomes
+ * readable once a producer opens it.
+ *
+ * @param stream The stream.
+ * @return A non-blocking file descriptor, or -1 on failure.
+ */
+static int open_source(const struct data_stream *stream) {
+  struct stat st;
+  if (stat(stream->filename, &st) == -1) {
+    return -1;
+  }
+  if (S_ISFIFO(st.st_mode)) {
+    return open(stream->filename, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  }
+
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(stream->filename) >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  strcpy(address.sun_path, stream->filename);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+      fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+    close(fd);
+    return -1;
+  }
+  log_info("Stream %s connected", stream->filename);
+  return fd;
+}
+
+/**
+ * @brief Take a slot of the ring to read the next record into.
+ *
+ * A free slot is preferred, otherwise the record waiting to be
+ * uploaded is dropped in favour of the next one. Blocks while the GPU
+ * is still copying all the other records.
+ *
+ * @param stream The stream.
+ * @return The slot, or STREAM_SLOTS if the reader must exit.
+ */
+static size_t acquire_slot(struct data_stream *stream) {
+  pthread_mutex_lock(&stream->lock);
+  size_t slot = STREAM_SLOTS;
+  while (!stream->stop && slot == STREAM_SLOTS) {
+    for (size_t i = 0; i < STREAM_SLOTS && slot == STREAM_SLOTS; ++i) {
+      if (stream->slots[i] == SLOT_FREE) {
+        slot = i;
+      }
+    }
+    if (slot == STREAM_SLOTS && stream->ready != STREAM_SLOTS) {
+      slot = stream->ready;
+      stream->ready = STREAM_SLOTS;
+    }
+    if (slot == STREAM_SLOTS) {
+      pthread_cond_wait(&stream->freed, &stream->lock);
+    }
+  }
+  if (slot != STREAM_SLOTS) {
+    stream->slots[slot] = SLOT_WRITING;
+  }
+  pthread_mutex_unlock(&stream->lock);
+  return slot;
+}
+
+/**
+ * @brief Make a complete record the next one to upload, replacing the
+ * previous one if it was not uploaded yet.
+ *
+ * @param stream The stream.
+ * @param slot The slot of the record.
+ */
+static void publish_slot(struct data_stream *stream, size_t slot) {
+  pthread_mutex_lock(&stream->lock);
+  if (stream->ready != STREAM_SLOTS) {
+    stream->slots[stream->ready] = SLOT_FREE;
+  }
+  stream->slots[slot] = SLOT_READY;
+  stream->ready = slot;
+  stream->received++;
+  pthread_mutex_unlock(&stream->lock);
+  if (stream->notify) {
+    stream->notify();
+  }
+}
+
+/**
+ * @brief Check whether the reader thread of a stream must exit.
+ *
+ * @param stream The stream.
+ * @return `true` if the stream is being closed.
+ */
+static bool reader_stopping(struct data_stream *stream) {
+  pthread_mutex_lock(&stream->lock);
+  bool stop = stream->stop;
+  pthread_mutex_unlock(&stream->lock);
+  return stop;
+}
+
+/**
+ * @brief Reader thread: read records into the ring until the stream is
+ * closed.
+ *
+ * When the producer goes away, the partial record is dropped and the
+ * source is opened again, waiting for the next producer.
+ *
+ * @param arg The stream.
+ * @return `NULL`.
+ */
+static void *reader_thread(void *arg) {
+  struct data_stream *stream = arg;
+  int fd = -1;
+  size_t slot = STREAM_SLOTS;
+  size_t filled = 0;
+  while (!reader_stopping(stream)) {
+    if (fd == -1 && (fd = open_source(stream)) == -1) {
+      poll(NULL, 0, STREAM_RETRY_MS);
+      continue;
+    }
+    if (slot == STREAM_SLOTS) {
+      slot = acquire_slot(stream);
+      filled = 0;
+      if (slot == STREAM_SLOTS) {
+        break;
+      }
+    }
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, STREAM_POLL_MS) <= 0) {
+      continue;
+    }
+    /* Straight into the pixel buffer, without an intermediate copy */
+    unsigned char *record = stream->ring + slot * stream->record_size;
+    ssize_t n = read(fd, record + filled, stream->record_size - filled);
+    if (n > 0) {
+      filled += n;
+      if (filled == stream->record_size) {
+        publish_slot(stream, slot);
+        slot = STREAM_SLOTS;
+      }
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      log_info("Stream %s closed by the producer", stream->filename);
+      close(fd);
+      fd = -1;
+      filled = 0;
+    }
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Copy a record of the ring to the texture of a stream.
+ *
+ * @param stream The stream.
+ * @param slot The slot of the record.
+ */
+static void upload_slot(struct data_stream *stream, size_t slot) {
+  size_t offset = slot * stream->record_size;
+  glBindTexture(GL_TEXTURE_2D, stream->texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (stream->buffer) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->buffer);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, stream->width, stream->height,
+                    stream->format, stream->type, (void *)offset);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    /* The reader must not overwrite the record before the copy */
+    stream->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, stream->width, stream->height,
+                    stream->format, stream->type, stream->ring + offset);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * @brief Allocate the ring of a stream, in a persistently mapped pixel
+ * buffer if the driver supports `GL_ARB_buffer_storage`, or in client
+ * memory otherwise.
+ *
+ * @param stream The stream.
+ * @return 0 on success, 1 on failure.
+ */
+static int allocate_ring(struct data_stream *stream) {
+  size_t size = STREAM_SLOTS * stream->record_size;
+  if (GLEW_ARB_buffer_storage) {
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &stream->buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+    stream->ring = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (stream->ring) {
+      return 0;
+    }
+    log_warn("Failed to map a pixel buffer for stream %s, reading into "
+             "client memory",
+             stream->filename);
+    glDeleteBuffers(1, &stream->buffer);
+    stream->buffer = 0;
+  }
+  stream->ring = malloc(size);
+  return stream->ring == NULL;
+}
+
+/**
+ * @brief Delete the texture and the ring of a stream.
+ *
+ * @param stream The stream, whose reader thread is not running.
+ */
+static void free_stream(struct data_stream *stream) {
+  for (size_t i = 0; i < STREAM_SLOTS; ++i) {
+    if (stream->fences[i]) {
+      glDeleteSync(stream->fences[i]);
+      stream->fences[i] = NULL;
+    }
+  }
+  if (stream->buffer) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &stream->buffer);
+    stream->buffer = 0;
+  } else {
+    free(stream->ring);
+  }
+  stream->ring = NULL;
+  if (stream->texture) {
+    glDeleteTextures(1, &stream->texture);
+    stream->texture = 0;
+  }
+}
+
+/**
+ * @brief Create the texture of a stream, initially zero, and start
+ * reading records.
+ *
+ * @param stream The stream, with its file, size and format set.
+ * @return 0 on success, 1 on failure.
+ */
+int stream_open(struct data_stream *stream) {
+  for (size_t i = 0; i < STREAM_SLOTS; ++i) {
+    stream->slots[i] = SLOT_FREE;
+    stream->fences[i] = NULL;
+  }
+  if (allocate_ring(stream)) {
+    log_error("Failed to allocate the records of stream %s",
+              stream->filename);
+    return 1;
+  }
+  memset(stream->ring, 0, STREAM_SLOTS * stream->record_size);
+  stream->ready = STREAM_SLOTS;
+  stream->received = 0;
+  stream->uploaded = 0;
+  stream->stop = false;
+
+  int filter = stream->nearest ? GL_NEAREST : GL_LINEAR;
+  glGenTextures(1, &stream->texture);
+  glBindTexture(GL_TEXTURE_2D, stream->texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, stream->internal_format, stream->width,
+               stream->height, 0, stream->format, stream->type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  upload_slot(stream, 0);
+  if (stream->buffer) {
+    stream->slots[0] = SLOT_UPLOADING;
+  }
+
+  pthread_mutex_init(&stream->lock, NULL);
+  pthread_cond_init(&stream->freed, NULL);
+  if (pthread_create(&stream->reader, NULL, reader_thread, stream)) {
+    log_error("Failed to start the reader thread of stream %s",
+              stream->filename);
+    pthread_cond_destroy(&stream->freed);
+    pthread_mutex_destroy(&stream->lock);
+    free_stream(stream);
+    return 1;
+  }
+  stream->running = true;
+  log_debug("Streaming %s into a %dx%d texture (%zu bytes per record%s)",
+            stream->filename, stream->width, stream->height,
+            stream->record_size,
+            stream->buffer ? ", persistently mapped" : "");
+  return 0;
+}
+
+/**
+ * @brief Upload the latest record of each stream, and recycle the
+ * records whose upload is complete.
+ *
+ * Never waits for the producers or for the GPU.
+ *
+ * @param streams The streams of the graph.
+ * @param count The number of streams.
+ * @return `true` if a texture changed.
+ */
+bool stream_poll(struct data_stream *streams, size_t count) {
+  bool changed = false;
+  for (size_t i = 0; i < count; ++i) {
+    struct data_stream *stream = &streams[i];
+    if (!stream->running) {
+      continue;
+    }
+    pthread_mutex_lock(&stream->lock);
+    for (size_t j = 0; j < STREAM_SLOTS; ++j) {
+      if (stream->slots[j] == SLOT_UPLOADING &&
+          glClientWaitSync(stream->fences[j], 0, 0) != GL_TIMEOUT_EXPIRED) {
+        glDeleteSync(stream->fences[j]);
+        stream->fences[j] = NULL;
+        stream->slots[j] = SLOT_FREE;
+        pthread_cond_signal(&stream->freed);
+      }
+    }
+    size_t slot = stream->ready;
+    if (slot != STREAM_SLOTS) {
+      stream->slots[slot] = stream->buffer ? SLOT_UPLOADING : SLOT_FREE;
+      stream->ready = STREAM_SLOTS;
+      stream->uploaded++;
+      /* Without a pixel buffer, the upload copies the record right away,
+         the reader waits for the lock until it is done */
+      upload_slot(stream, slot);
+      changed = true;
+    }
+    pthread_mutex_unlock(&stream->lock);
+  }
+  return changed;
+}
+
+/**
+ * @brief Stop the reader threads, and delete the textures and rings of
+ * the streams.
+ *
+ * @param streams The streams of the graph.
+ * @param count The number of streams.
+ */
+void stream_close(struct data_stream *streams, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    struct data_stream *stream = &streams[i];
+    if (!stream->running) {
+      continue;
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->stop = true;
+    pthread_cond_signal(&stream->freed);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->reader, NULL);
+    pthread_cond_destroy(&stream->freed);
+    pthread_mutex_destroy(&stream->lock);
+    stream->running = false;
+    log_debug("Stream %s: %llu records received, %llu uploaded",
+              stream->filename, (unsigned long long)stream->received,
+              (unsigned long long)stream->uploaded);
+    free_stream(stream);
+  }
+}
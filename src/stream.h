@@ -0,0 +1,67 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <GL/glew.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STREAM_SLOTS 4 /**< Records in the upload ring of a stream. */
+
+/**
+ * State of a record slot in the upload ring of a stream.
+ */
+enum stream_slot {
+  SLOT_FREE,      /**< Available to the reader thread. */
+  SLOT_WRITING,   /**< Being filled by the reader thread. */
+  SLOT_READY,     /**< Complete record waiting to be uploaded. */
+  SLOT_UPLOADING, /**< Being copied to the texture by the GPU. */
+};
+
+/**
+ * Texture fed by another process through a FIFO or a Unix socket.
+ *
+ * The producer writes fixed-size records, each of which is the full
+ * contents of the texture. A reader thread reads them straight into
+ * the slots of a ring of pixel buffers, persistently mapped when the
+ * driver supports it, and each frame uploads the latest complete
+ * record, so that the render loop never waits for the producer.
+ * Records arriving faster than the frames are dropped.
+ */
+struct data_stream {
+  char filename[PATH_MAX]; /**< FIFO or Unix socket. */
+  int width;  /**< Width of the texture. */
+  int height; /**< Height of the texture. */
+  unsigned int internal_format; /**< Sized internal format of the texture. */
+  unsigned int format;          /**< Pixel format of the records. */
+  unsigned int type;            /**< Pixel type of the records. */
+  size_t record_size;           /**< Size of a record in bytes. */
+  bool nearest; /**< Sampled with nearest filtering. */
+  bool active;  /**< The texture is read by an active pass. */
+  void (*notify)(void); /**< Called by the reader thread when a record
+                           is complete, to wake up the render loop, or
+                           NULL. */
+  unsigned int texture; /**< Texture object. */
+  unsigned int buffer;  /**< Pixel buffer of the ring, or 0 when the
+                           ring is in client memory. */
+  unsigned char *ring;  /**< Mapping of the ring, STREAM_SLOTS records. */
+  GLsync fences[STREAM_SLOTS]; /**< Fences of the uploads in progress. */
+  enum stream_slot slots[STREAM_SLOTS]; /**< State of each record. */
+  size_t ready;     /**< Slot of the latest record, or STREAM_SLOTS. */
+  uint64_t received; /**< Number of records read. */
+  uint64_t uploaded; /**< Number of records uploaded. */
+  pthread_t reader;  /**< Reader thread. */
+  pthread_mutex_t lock; /**< Protects the slots and the counters. */
+  pthread_cond_t freed; /**< Signaled when a slot becomes free. */
+  bool stop;    /**< The reader thread must exit. */
+  bool running; /**< The reader thread is running. */
+};
+
+bool stream_is_source(const char *filename);
+int stream_open(struct data_stream *stream);
+bool stream_poll(struct data_stream *streams, size_t count);
+void stream_close(struct data_stream *streams, size_t count);
+
+#endif /* STREAM_H */
@@ -0,0 +1,429 @@
+#include <FreeImage.h>
+#include <GL/glew.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "log.h"
+#include "queue.h"
+#include "texture.h"
+#include "timing.h"
+
+/**
+ * Image decoded by a loader thread, waiting to be uploaded.
+ */
+struct texture_job {
+  size_t index;            /**< Index of the texture. */
+  char filename[PATH_MAX]; /**< Image file. */
+  const unsigned char *pixels; /**< BGRA pixels, bottom row first, or NULL
+                                  if the image could not be read. */
+  unsigned char *decoded;  /**< Decoded pixels, or NULL if the image was
+                              mapped from the cache. */
+  struct texture_cache_entry cached; /**< Image mapped from the cache. */
+  int width;               /**< Width of the image. */
+  int height;              /**< Height of the image. */
+};
+
+/**
+ * @brief Check whether a pass file is an image rather than a shader.
+ *
+ * @param filename The file of the pass.
+ * @return `true` if FreeImage can read files with this extension.
+ */
+bool texture_is_image(const char *filename) {
+  FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(filename);
+  return format != FIF_UNKNOWN && FreeImage_FIFSupportsReading(format);
+}
+
+/**
+ * @brief Free a decoded image.
+ *
+ * @param job The image to free.
+ */
+static void free_job(struct texture_job *job) {
+  free(job->decoded);
+  texture_cache_release(&job->cached);
+  free(job);
+}
+
+/**
+ * @brief Decode an image file to 8-bit BGRA pixels.
+ *
+ * The pixels are left NULL on error.
+ *
+ * @param job The image to decode.
+ */
+static void decode_image(struct texture_job *job) {
+  FREE_IMAGE_FORMAT format = FreeImage_GetFileType(job->filename, 0);
+  if (format == FIF_UNKNOWN) {
+    format = FreeImage_GetFIFFromFilename(job->filename);
+  }
+  FIBITMAP *image = format != FIF_UNKNOWN &&
+                            FreeImage_FIFSupportsReading(format)
+                        ? FreeImage_Load(format, job->filename, 0)
+                        : NULL;
+  if (image == NULL) {
+    log_error("Could not read image %s", job->filename);
+    return;
+  }
+  FIBITMAP *bgra = FreeImage_ConvertTo32Bits(image);
+  FreeImage_Unload(image);
+  if (bgra == NULL) {
+    log_error("Could not convert image %s to 8-bit RGBA", job->filename);
+    return;
+  }
+  job->width = FreeImage_GetWidth(bgra);
+  job->height = FreeImage_GetHeight(bgra);
+  job->decoded = malloc((size_t)job->width * job->height * 4);
+  if (job->decoded == NULL) {
+    log_error("Failed to allocate image %s", job->filename);
+  } else {
+    /* Bottom row first, as OpenGL expects */
+    FreeImage_ConvertToRawBits(job->decoded, bgra, job->width * 4, 32,
+                               FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK,
+                               FI_RGBA_BLUE_MASK, false);
+    job->pixels = job->decoded;
+  }
+  FreeImage_Unload(bgra);
+}
+
+/**
+ * @brief Read an image, mapped from the cache of decoded images if
+ * the file did not change since it was cached, or decoded and added
+ * to the cache otherwise.
+ *
+ * @param job The image to read.
+ */
+static void read_image(struct texture_job *job) {
+  double start = timing_now();
+  uint64_t key = texture_cache_key(job->filename);
+  if (texture_cache_load(key, &job->cached)) {
+    job->pixels = job->cached.pixels;
+    job->width = job->cached.width;
+    job->height = job->cached.height;
+    log_debug("Image %s mapped from the cache in %.1f ms", job->filename,
+              timing_now() - start);
+    return;
+  }
+  decode_image(job);
+  if (job->pixels) {
+    log_debug("Image %s decoded in %.1f ms", job->filename,
+              timing_now() - start);
+    texture_cache_store(key, job->pixels, job->width, job->height);
+  }
+}
+
+/**
+ * @brief Decoder thread: decode images until the queue is closed.
+ *
+ * @param arg The texture loader.
+ * @return `NULL`.
+ */
+static void *decoder_thread(void *arg) {
+  struct texture_loader *loader = arg;
+  struct texture_job *job = NULL;
+  while ((job = queue_pop(&loader->jobs))) {
+    read_image(job);
+    if (!queue_push(&loader->done, job)) {
+      free_job(job);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Start the decoder threads.
+ *
+ * @param loader The loader to initialize.
+ * @param capacity The number of textures, each of which has at most
+ * one image being decoded.
+ * @return 0 on success, 1 on failure.
+ */
+int texture_loader_init(struct texture_loader *loader, size_t capacity) {
+  memset(loader, 0, sizeof(*loader));
+  if (queue_init(&loader->jobs, capacity)) {
+    return 1;
+  }
+  if (queue_init(&loader->done, capacity)) {
+    queue_destroy(&loader->jobs);
+    return 1;
+  }
+  for (size_t i = 0; i < TEXTURE_DECODERS; ++i) {
+    if (pthread_create(&loader->decoders[i], NULL, decoder_thread, loader)) {
+      log_warn("Could only start %zu image decoder threads", i);
+      break;
+    }
+    loader->num_decoders++;
+  }
+  loader->initialized = true;
+  if (loader->num_decoders == 0) {
+    log_error("Failed to start the image decoder threads");
+    texture_loader_finish(loader, NULL, 0);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Drop the image being uploaded to a texture, if any.
+ *
+ * @param texture The texture.
+ */
+static void cancel_upload(struct image_texture *texture) {
+  if (texture->pbo) {
+    if (texture->mapped) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture->pbo);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &texture->pbo);
+    texture->pbo = 0;
+    texture->mapped = NULL;
+  }
+  if (texture->pending) {
+    free_job(texture->pending);
+    texture->pending = NULL;
+  }
+  texture->uploaded = 0;
+}
+
+/**
+ * @brief Stop the decoder threads, and drop the images not uploaded
+ * yet.
+ *
+ * @param loader The loader, which may not have been initialized.
+ * @param textures The textures of the graph.
+ * @param count The number of textures.
+ */
+void texture_loader_finish(struct texture_loader *loader,
+                           struct image_texture *textures, size_t count) {
+  if (!loader->initialized) {
+    return;
+  }
+  queue_close(&loader->jobs);
+  for (size_t i = 0; i < loader->num_decoders; ++i) {
+    pthread_join(loader->decoders[i], NULL);
+  }
+  struct texture_job *job = NULL;
+  while ((job = queue_try_pop(&loader->jobs))) {
+    free_job(job);
+  }
+  while ((job = queue_try_pop(&loader->done))) {
+    free_job(job);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    cancel_upload(&textures[i]);
+    textures[i].loading = false;
+  }
+  queue_destroy(&loader->done);
+  queue_destroy(&loader->jobs);
+  loader->initialized = false;
+}
+
+/**
+ * @brief Create the texture object of an image, holding a single black
+ * texel until the image is uploaded.
+ *
+ * @param texture The texture.
+ */
+void texture_init(struct image_texture *texture) {
+  const unsigned char black[4] = {0, 0, 0, 255};
+  glGenTextures(1, &texture->texture);
+  glBindTexture(GL_TEXTURE_2D, texture->texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, black);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * @brief Start decoding the image of a texture in the background.
+ *
+ * If the image is already being decoded, it will be decoded again
+ * once done, since the file may have changed in the meantime.
+ *
+ * @param loader The loader.
+ * @param textures The textures of the graph.
+ * @param index The index of the texture to load.
+ */
+void texture_load(struct texture_loader *loader,
+                  struct image_texture *textures, size_t index) {
+  struct image_texture *texture = &textures[index];
+  if (texture->loading) {
+    texture->stale = true;
+    return;
+  }
+  struct texture_job *job = calloc(1, sizeof(struct texture_job));
+  if (job == NULL) {
+    log_error("Failed to allocate the image of %s", texture->filename);
+    return;
+  }
+  job->index = index;
+  snprintf(job->filename, sizeof(job->filename), "%s", texture->filename);
+  /* The queue holds one image per texture, so it is never full */
+  if (!queue_push(&loader->jobs, job)) {
+    free(job);
+    return;
+  }
+  texture->loading = true;
+  texture->stale = false;
+}
+
+/**
+ * @brief Copy part of the pending image of a texture to its pixel
+ * buffer, and upload the texture once the whole image is copied.
+ *
+ * The copy goes to a mapped pixel buffer, so the texture upload
+ * itself only queues a transfer on the GPU, followed by the
+ * generation of the mipmaps. Images from the cache are copied straight
+ * from the mapping of their file.
+ *
+ * @param texture The texture, with a pending image.
+ * @param budget The maximum number of bytes to copy.
+ * @return The number of bytes copied.
+ */
+static size_t stream_upload(struct image_texture *texture, size_t budget) {
+  const struct texture_job *job = texture->pending;
+  size_t size = (size_t)job->width * job->height * 4;
+  if (!texture->pbo) {
+    glGenBuffers(1, &texture->pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    texture->mapped = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (texture->mapped == NULL) {
+      log_error("Failed to map a pixel buffer for %s", job->filename);
+      cancel_upload(texture);
+      return 0;
+    }
+  }
+  size_t chunk = size - texture->uploaded;
+  chunk = chunk < budget ? chunk : budget;
+  memcpy(texture->mapped + texture->uploaded, job->pixels + texture->uploaded,
+         chunk);
+  texture->uploaded += chunk;
+  if (texture->uploaded < size) {
+    return chunk;
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture->pbo);
+  bool unmapped = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  texture->mapped = NULL;
+  if (unmapped) {
+    glBindTexture(GL_TEXTURE_2D, texture->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, job->width, job->height, 0,
+                 GL_BGRA, GL_UNSIGNED_BYTE, 0);
+    if (texture->nearest) {
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    } else {
+      glGenerateMipmap(GL_TEXTURE_2D);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                      GL_LINEAR_MIPMAP_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    int wrap = texture->clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    texture->width = job->width;
+    texture->height = job->height;
+    log_info("Image %s loaded (%dx%d)", job->filename, job->width,
+             job->height);
+  } else {
+    /* The driver lost the contents of the buffer */
+    log_error("Failed to upload image %s", job->filename);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  cancel_upload(texture);
+  return chunk;
+}
+
+/**
+ * @brief Check whether some images are being decoded.
+ *
+ * @param textures The textures of the graph.
+ * @param count The number of textures.
+ * @return `true` if a decode is in progress.
+ */
+static bool textures_decoding(const struct image_texture *textures,
+                              size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (textures[i].loading) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Check whether some images are being decoded or uploaded.
+ *
+ * @param textures The textures of the graph.
+ * @param count The number of textures.
+ * @return `true` if a texture is not up to date yet.
+ */
+bool texture_loader_busy(const struct image_texture *textures,
+                         size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (textures[i].loading || textures[i].pending) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Take the decoded images, and stream them to the textures.
+ *
+ * Without waiting, at most TEXTURE_UPLOAD_BUDGET bytes are copied to
+ * the pixel buffers, and the uploads continue at the next call.
+ *
+ * @param loader The loader.
+ * @param textures The textures of the graph.
+ * @param count The number of textures.
+ * @param wait Wait for all the images to be decoded and uploaded,
+ * when the frames must not depend on the loading time.
+ * @return `true` if a texture changed.
+ */
+bool texture_loader_poll(struct texture_loader *loader,
+                         struct image_texture *textures, size_t count,
+                         bool wait) {
+  if (!loader->initialized) {
+    return false;
+  }
+  struct texture_job *job = NULL;
+  while ((job = wait && textures_decoding(textures, count)
+                    ? queue_pop(&loader->done)
+                    : queue_try_pop(&loader->done))) {
+    struct image_texture *texture = &textures[job->index];
+    texture->loading = false;
+    if (texture->stale || job->pixels == NULL) {
+      /* Decode the new file, or keep the previous image on error */
+      if (texture->stale) {
+        texture_load(loader, textures, job->index);
+      }
+      free_job(job);
+      continue;
+    }
+    cancel_upload(texture);
+    texture->pending = job;
+  }
+
+  size_t budget = wait ? SIZE_MAX : TEXTURE_UPLOAD_BUDGET;
+  bool changed = false;
+  for (size_t i = 0; i < count && budget > 0; ++i) {
+    if (textures[i].pending) {
+      budget -= stream_upload(&textures[i], budget);
+      changed |= textures[i].pending == NULL;
+    }
+  }
+  return changed;
+}
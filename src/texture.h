@@ -0,0 +1,70 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+#define TEXTURE_DECODERS 2 /**< Number of threads decoding images. */
+#define TEXTURE_UPLOAD_BUDGET (4 << 20) /**< Bytes copied to pixel buffers
+                                           per frame. */
+
+struct texture_job;
+
+/**
+ * Image file sampled by the passes as a texture, like the channels of
+ * Shadertoy.
+ *
+ * Images are decoded by background threads, or mapped from the cache
+ * of decoded images when they did not change, then copied to a pixel
+ * buffer object over as many frames as needed to stay within the
+ * upload budget, so that large images never stall the render loop.
+ * Until the first upload completes, the texture is a single black
+ * texel, and when the image is reloaded, the previous one is sampled
+ * until the new one is ready.
+ */
+struct image_texture {
+  char filename[PATH_MAX]; /**< Image file. */
+  bool nearest;  /**< Sampled with nearest filtering and no mipmaps. */
+  bool clamp;    /**< Clamped to the edges instead of repeated. */
+  bool active;   /**< The texture is read by an active pass. */
+  unsigned int texture; /**< Texture object. */
+  int width;     /**< Width of the uploaded image, 0 before the first. */
+  int height;    /**< Height of the uploaded image, 0 before the first. */
+  bool loading;  /**< An image is being decoded. */
+  bool stale;    /**< The file must be decoded again once the current
+                    decode finishes. */
+  struct texture_job *pending; /**< Decoded image being uploaded, or
+                                  NULL. */
+  unsigned int pbo;       /**< Pixel buffer of the pending image, or 0. */
+  unsigned char *mapped;  /**< Mapping of the pixel buffer. */
+  size_t uploaded;        /**< Bytes of the pending image copied so far. */
+};
+
+/**
+ * Threads decoding image files for the textures.
+ */
+struct texture_loader {
+  struct queue jobs;  /**< Images waiting to be decoded. */
+  struct queue done;  /**< Decoded images waiting to be uploaded. */
+  pthread_t decoders[TEXTURE_DECODERS]; /**< Decoder threads. */
+  size_t num_decoders; /**< Number of running decoder threads. */
+  bool initialized;    /**< The decoder threads are running. */
+};
+
+bool texture_is_image(const char *filename);
+int texture_loader_init(struct texture_loader *loader, size_t capacity);
+void texture_loader_finish(struct texture_loader *loader,
+                           struct image_texture *textures, size_t count);
+void texture_init(struct image_texture *texture);
+void texture_load(struct texture_loader *loader,
+                  struct image_texture *textures, size_t index);
+bool texture_loader_poll(struct texture_loader *loader,
+                         struct image_texture *textures, size_t count,
+                         bool wait);
+bool texture_loader_busy(const struct image_texture *textures, size_t count);
+
+#endif /* TEXTURE_H */
@@ -0,0 +1,128 @@
+#include <GL/glew.h>
+#include <string.h>
+#include <time.h>
+
+#include "timing.h"
+
+/**
+ * @brief Current time of a monotonic clock.
+ *
+ * @return The time in milliseconds.
+ */
+double timing_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Record a duration.
+ *
+ * @param stats The statistics to update.
+ * @param ms The duration in milliseconds.
+ */
+void timing_stats_add(struct timing_stats *stats, double ms) {
+  stats->interval_ms += ms;
+  stats->interval_count++;
+  stats->total_ms += ms;
+  stats->total_count++;
+  stats->last_ms = ms;
+}
+
+/**
+ * @brief Forget all the recorded durations.
+ *
+ * @param stats The statistics to reset.
+ */
+void timing_stats_reset(struct timing_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+/**
+ * @brief Average duration over the current interval, and start a new
+ * interval.
+ *
+ * @param stats The statistics.
+ * @return The average duration in milliseconds, or 0 if no duration
+ * was recorded during the interval.
+ */
+double timing_stats_interval(struct timing_stats *stats) {
+  double mean = stats->interval_count
+                    ? stats->interval_ms / stats->interval_count
+                    : 0;
+  stats->interval_ms = 0;
+  stats->interval_count = 0;
+  return mean;
+}
+
+/**
+ * @brief Average duration over the whole run.
+ *
+ * @param stats The statistics.
+ * @return The average duration in milliseconds, or 0 if no duration
+ * was recorded.
+ */
+double timing_stats_mean(const struct timing_stats *stats) {
+  return stats->total_count ? stats->total_ms / stats->total_count : 0;
+}
+
+/**
+ * @brief Create the query objects of a GPU timer.
+ *
+ * @param timer The timer to initialize.
+ */
+void gpu_timer_init(struct gpu_timer *timer) {
+  memset(timer, 0, sizeof(*timer));
+  glGenQueries(GPU_TIMER_QUERIES, timer->queries);
+}
+
+/**
+ * @brief Start timing the GPU commands of a pass.
+ *
+ * If the result of the query about to be reused is still not
+ * available, the measurement is dropped rather than waited for.
+ *
+ * @param timer The timer of the pass.
+ */
+void gpu_timer_begin(struct gpu_timer *timer) {
+  gpu_timer_collect(timer);
+  timer->pending[timer->next] = false;
+  glBeginQuery(GL_TIME_ELAPSED, timer->queries[timer->next]);
+}
+
+/**
+ * @brief Stop timing the GPU commands of a pass.
+ *
+ * @param timer The timer of the pass.
+ */
+void gpu_timer_end(struct gpu_timer *timer) {
+  glEndQuery(GL_TIME_ELAPSED);
+  timer->pending[timer->next] = true;
+  timer->next = (timer->next + 1) % GPU_TIMER_QUERIES;
+}
+
+/**
+ * @brief Record the results of the queries that completed, without
+ * waiting for the others.
+ *
+ * @param timer The timer of the pass.
+ */
+void gpu_timer_collect(struct gpu_timer *timer) {
+  /* Queries complete in order, starting from the oldest one */
+  for (size_t i = 0; i < GPU_TIMER_QUERIES; ++i) {
+    size_t index = (timer->next + i) % GPU_TIMER_QUERIES;
+    if (!timer->pending[index]) {
+      continue;
+    }
+    int available = 0;
+    glGetQueryObjectiv(timer->queries[index], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+    if (!available) {
+      break;
+    }
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(timer->queries[index], GL_QUERY_RESULT, &elapsed);
+    timer->pending[index] = false;
+    timing_stats_add(&timer->stats, elapsed / 1e6);
+  }
+}
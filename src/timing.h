@@ -0,0 +1,46 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define GPU_TIMER_QUERIES 4 /**< Frames of latency of the GPU timers. */
+
+/**
+ * Running averages of a duration, over the current reporting interval
+ * and over the whole run.
+ */
+struct timing_stats {
+  double interval_ms;    /**< Sum of the durations of the interval. */
+  size_t interval_count; /**< Number of durations in the interval. */
+  double total_ms;       /**< Sum of all the durations. */
+  size_t total_count;    /**< Number of durations. */
+  double last_ms;        /**< Last duration. */
+};
+
+/**
+ * GPU timer of a render pass.
+ *
+ * Each frame uses the next `GL_TIME_ELAPSED` query of a ring, and
+ * results are only read once the driver reports them available, a few
+ * frames later, so that timing never stalls the pipeline.
+ */
+struct gpu_timer {
+  unsigned int queries[GPU_TIMER_QUERIES]; /**< Ring of query objects. */
+  bool pending[GPU_TIMER_QUERIES]; /**< The query awaits its result. */
+  size_t next;                     /**< Index of the next query to use. */
+  struct timing_stats stats;       /**< Measured GPU durations. */
+};
+
+double timing_now(void);
+void timing_stats_add(struct timing_stats *stats, double ms);
+void timing_stats_reset(struct timing_stats *stats);
+double timing_stats_interval(struct timing_stats *stats);
+double timing_stats_mean(const struct timing_stats *stats);
+
+void gpu_timer_init(struct gpu_timer *timer);
+void gpu_timer_begin(struct gpu_timer *timer);
+void gpu_timer_end(struct gpu_timer *timer);
+void gpu_timer_collect(struct gpu_timer *timer);
+
+#endif /* TIMING_H */
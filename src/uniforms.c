@@ -0,0 +1,162 @@
+#include <GL/glew.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "uniforms.h"
+
+/**
+ * @brief Fill the uniform registry of a linked program.
+ *
+ * Queries the list of active uniforms once, so that the render loop
+ * never has to look up uniform locations by name. If the program
+ * declares the shared uniform block, it is bound to the shared
+ * binding point.
+ *
+ * @param cache The registry to fill. Its previous content is freed.
+ * @param program The linked program.
+ * @return 0 on success, 1 on failure.
+ */
+int uniform_cache_build(struct uniform_cache *cache, unsigned int program) {
+  uniform_cache_clear(cache);
+
+  int num_uniforms = 0;
+  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &num_uniforms);
+  if (num_uniforms > 0) {
+    cache->uniforms = calloc(num_uniforms, sizeof(struct uniform_info));
+    if (cache->uniforms == NULL) {
+      log_error("Failed to allocate the uniform registry");
+      return 1;
+    }
+  }
+
+  for (int i = 0; i < num_uniforms; ++i) {
+    struct uniform_info *info = &cache->uniforms[cache->count];
+    int length = 0;
+    glGetActiveUniform(program, i, UNIFORM_NAME_SIZE, &length, &info->size,
+                       &info->type, info->name);
+    info->location = glGetUniformLocation(program, info->name);
+    if (info->location == -1) {
+      /* Member of a uniform block */
+      continue;
+    }
+    /* Arrays are reported as "name[0]" */
+    char *bracket = strchr(info->name, '[');
+    if (bracket) {
+      *bracket = '\0';
+    }
+    cache->count++;
+  }
+
+  cache->time = uniform_cache_location(cache, "u_time");
+  cache->frame = uniform_cache_location(cache, "u_frame");
+  cache->resolution = uniform_cache_location(cache, "u_resolution");
+  cache->mouse = uniform_cache_location(cache, "u_mouse");
+  cache->texture = uniform_cache_location(cache, "u_texture");
+
+  unsigned int block = glGetUniformBlockIndex(program, GLOBALS_BLOCK_NAME);
+  cache->uses_globals = block != GL_INVALID_INDEX;
+  if (cache->uses_globals) {
+    glUniformBlockBinding(program, block, GLOBALS_BINDING);
+  }
+
+  /* All the members of a std140 block are active, so a program
+     declaring the shared block may read any of them */
+  cache->time_varying = cache->time != -1 || cache->frame != -1 ||
+                        cache->mouse != -1 || cache->uses_globals;
+
+  log_debug("Found %zu active uniforms%s", cache->count,
+            cache->uses_globals ? " and the " GLOBALS_BLOCK_NAME " block"
+                                : "");
+  return 0;
+}
+
+/**
+ * @brief Empty a uniform registry.
+ *
+ * @param cache The registry to empty.
+ */
+void uniform_cache_clear(struct uniform_cache *cache) {
+  free(cache->uniforms);
+  cache->uniforms = NULL;
+  cache->count = 0;
+  cache->time = -1;
+  cache->frame = -1;
+  cache->resolution = -1;
+  cache->mouse = -1;
+  cache->texture = -1;
+  cache->uses_globals = false;
+  cache->time_varying = false;
+}
+
+/**
+ * @brief Look up the location of a uniform in the registry.
+ *
+ * @param cache The registry.
+ * @param name The name of the uniform.
+ * @return The location of the uniform, or -1 if it is not active.
+ */
+int uniform_cache_location(const struct uniform_cache *cache,
+                           const char *name) {
+  for (size_t i = 0; i < cache->count; ++i) {
+    if (!strcmp(cache->uniforms[i].name, name)) {
+      return cache->uniforms[i].location;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Create the uniform buffer holding the standard uniforms,
+ * shared by all the programs.
+ *
+ * @return The uniform buffer object ID.
+ */
+unsigned int initialize_globals(void) {
+  unsigned int ubo = 0;
+  glGenBuffers(1, &ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(struct frame_globals), NULL,
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, GLOBALS_BINDING, ubo);
+  log_debug("Uniform buffer for %s initialized", GLOBALS_BLOCK_NAME);
+  return ubo;
+}
+
+/**
+ * @brief Upload the standard uniforms of the frame, once for all the
+ * programs using the shared uniform block.
+ *
+ * @param ubo The shared uniform buffer object.
+ * @param globals The standard uniforms of the frame.
+ */
+void update_globals(unsigned int ubo, const struct frame_globals *globals) {
+  glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(struct frame_globals),
+                  globals);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/**
+ * @brief Set the standard uniforms declared outside the shared block
+ * in the current program, using the cached locations.
+ *
+ * @param cache The registry of the current program.
+ * @param globals The standard uniforms of the frame.
+ */
+void apply_globals(const struct uniform_cache *cache,
+                   const struct frame_globals *globals) {
+  if (cache->frame != -1) {
+    glUniform1ui(cache->frame, globals->frame);
+  }
+  if (cache->time != -1) {
+    glUniform1f(cache->time, globals->time);
+  }
+  if (cache->resolution != -1) {
+    glUniform2fv(cache->resolution, 1, globals->resolution);
+  }
+  if (cache->mouse != -1) {
+    glUniform2fv(cache->mouse, 1, globals->mouse);
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+#include <GL/glew.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define UNIFORM_NAME_SIZE 64   /**< Maximum length of a uniform name. */
+#define GLOBALS_BLOCK_NAME "ShaderToolGlobals" /**< Shared uniform block. */
+#define GLOBALS_BINDING 0      /**< Binding point of the shared block. */
+
+/**
+ * Active uniform of a linked program.
+ */
+struct uniform_info {
+  char name[UNIFORM_NAME_SIZE]; /**< Name of the uniform. */
+  int location;                 /**< Location in the program. */
+  GLenum type;                  /**< Type of the uniform. */
+  int size;                     /**< Number of array elements. */
+};
+
+/**
+ * Registry of the active uniforms of a program, filled once after
+ * each successful link.
+ */
+struct uniform_cache {
+  struct uniform_info *uniforms; /**< Active uniforms outside blocks. */
+  size_t count;                  /**< Number of active uniforms. */
+  int time;       /**< Location of u_time, or -1. */
+  int frame;      /**< Location of u_frame, or -1. */
+  int resolution; /**< Location of u_resolution, or -1. */
+  int mouse;      /**< Location of u_mouse, or -1. */
+  int texture;    /**< Location of u_texture, or -1. */
+  bool uses_globals; /**< The program declares the shared uniform block. */
+  bool time_varying; /**< The program reads u_time, u_frame or u_mouse,
+                        so its output changes from frame to frame. */
+};
+
+/**
+ * Standard uniforms of a frame, with the std140 layout of the shared
+ * uniform block:
+ *
+ *     layout(std140) uniform ShaderToolGlobals {
+ *       float u_time;
+ *       uint u_frame;
+ *       vec2 u_resolution;
+ *       vec2 u_mouse;
+ *     };
+ */
+struct frame_globals {
+  float time;          /**< u_time */
+  uint32_t frame;      /**< u_frame */
+  float resolution[2]; /**< u_resolution */
+  float mouse[2];      /**< u_mouse */
+  float padding[2];    /**< Pads the block to a multiple of 16 bytes. */
+};
+
+int uniform_cache_build(struct uniform_cache *cache, unsigned int program);
+void uniform_cache_clear(struct uniform_cache *cache);
+int uniform_cache_location(const struct uniform_cache *cache,
+                           const char *name);
+unsigned int initialize_globals(void);
+void update_globals(unsigned int ubo, const struct frame_globals *globals);
+void apply_globals(const struct uniform_cache *cache,
+                   const struct frame_globals *globals);
+
+#endif /* UNIFORMS_H */
@@ -0,0 +1,144 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "variants.h"
+
+/**
+ * @brief Append a definition, `NAME` or `NAME=VALUE`, as `#define`
+ * lines.
+ *
+ * @param code The `#define` lines to append to.
+ * @param definition The definition.
+ * @param length The length of the definition.
+ * @param redefine Undefine the name first, so that the definition
+ * replaces a common one.
+ * @return 0 on success, 1 if the definition is invalid or too long.
+ */
+static int append_definition(char code[VARIANT_CODE_SIZE],
+                             const char *definition, size_t length,
+                             bool redefine) {
+  size_t name = 0;
+  while (name < length && (isalnum((unsigned char)definition[name]) ||
+                           definition[name] == '_')) {
+    name++;
+  }
+  if (name == 0 || isdigit((unsigned char)definition[0]) ||
+      (name < length && definition[name] != '=') ||
+      memchr(definition, '\n', length)) {
+    return 1;
+  }
+  const char *value = name < length ? definition + name + 1 : "";
+  int value_length = name < length ? (int)(length - name - 1) : 0;
+
+  size_t used = strlen(code);
+  int written = 0;
+  if (redefine) {
+    written = snprintf(code + used, VARIANT_CODE_SIZE - used,
+                       "#undef %.*s\n#define %.*s %.*s\n", (int)name,
+                       definition, (int)name, definition, value_length,
+                       value);
+  } else {
+    written = snprintf(code + used, VARIANT_CODE_SIZE - used,
+                       "#define %.*s %.*s\n", (int)name, definition,
+                       value_length, value);
+  }
+  if (written < 0 || (size_t)written >= VARIANT_CODE_SIZE - used) {
+    code[used] = '\0';
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Add a definition common to all the variants, as given to
+ * `-D`.
+ *
+ * @param variants The variants.
+ * @param definition `NAME` or `NAME=VALUE`.
+ * @return 0 on success, 1 if the definition is invalid or too long.
+ */
+int variants_define(struct shader_variants *variants,
+                    const char *definition) {
+  if (append_definition(variants->common, definition, strlen(definition),
+                        false)) {
+    return 1;
+  }
+  variants_select(variants, variants->current);
+  return 0;
+}
+
+/**
+ * @brief Add a variant, as given to `--variant`.
+ *
+ * @param variants The variants.
+ * @param spec Comma-separated definitions, `NAME` or `NAME=VALUE`, or
+ * an empty string for the common definitions alone.
+ * @return 0 on success, 1 if there are too many variants or a
+ * definition is invalid.
+ */
+int variants_add(struct shader_variants *variants, const char *spec) {
+  if (variants->count >= MAX_VARIANTS) {
+    return 1;
+  }
+  char *code = variants->own[variants->count];
+  code[0] = '\0';
+  const char *definition = spec;
+  while (*definition) {
+    const char *end = strchr(definition, ',');
+    size_t length = end ? (size_t)(end - definition) : strlen(definition);
+    if (append_definition(code, definition, length, true)) {
+      return 1;
+    }
+    definition += length + (end != NULL);
+  }
+  variants->names[variants->count++] = spec;
+  variants_select(variants, variants->current);
+  return 0;
+}
+
+/**
+ * @brief Number of variants that can be selected.
+ *
+ * @param variants The variants.
+ * @return The number of variants, at least 1.
+ */
+size_t variants_count(const struct shader_variants *variants) {
+  return variants->count ? variants->count : 1;
+}
+
+/**
+ * @brief Use a variant.
+ *
+ * @param variants The variants.
+ * @param index The variant, less than variants_count().
+ */
+void variants_select(struct shader_variants *variants, size_t index) {
+  variants->current = index;
+  snprintf(variants->code, sizeof(variants->code), "%s%s", variants->common,
+           variants->count ? variants->own[index] : "");
+}
+
+/**
+ * @brief Definitions of the variant in use.
+ *
+ * @param variants The variants.
+ * @return The `#define` lines to insert in the shaders, or NULL if
+ * there are none.
+ */
+const char *variants_defines(const struct shader_variants *variants) {
+  return variants->code[0] ? variants->code : NULL;
+}
+
+/**
+ * @brief Name of the variant in use, for logs.
+ *
+ * @param variants The variants.
+ * @return The specification of the variant.
+ */
+const char *variants_name(const struct shader_variants *variants) {
+  if (variants->count == 0 || !variants->names[variants->current][0]) {
+    return "default";
+  }
+  return variants->names[variants->current];
+}
@@ -0,0 +1,39 @@
+#ifndef VARIANTS_H
+#define VARIANTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_VARIANTS 8         /**< Maximum number of shader variants. */
+#define VARIANT_CODE_SIZE 1024 /**< Maximum length of the `#define` lines
+                                  of a variant. */
+
+/**
+ * Sets of preprocessor definitions inserted in the fragment shaders.
+ *
+ * Constants defined at compile time, such as loop bounds, let the
+ * compiler unroll and optimize where a uniform would not. The common
+ * definitions apply to all the variants, and each variant adds its
+ * own, redefining common ones if needed. Only one variant is used at
+ * a time, for all the passes.
+ */
+struct shader_variants {
+  char common[VARIANT_CODE_SIZE]; /**< Definitions of all the variants. */
+  char own[MAX_VARIANTS][VARIANT_CODE_SIZE]; /**< Definitions of each
+                                                variant. */
+  const char *names[MAX_VARIANTS]; /**< Specification of each variant. */
+  size_t count;   /**< Number of variants, 0 for the common definitions
+                     alone. */
+  size_t current; /**< Variant in use. */
+  char code[2 * VARIANT_CODE_SIZE]; /**< Definitions of the variant in
+                                       use. */
+};
+
+int variants_define(struct shader_variants *variants, const char *definition);
+int variants_add(struct shader_variants *variants, const char *spec);
+size_t variants_count(const struct shader_variants *variants);
+void variants_select(struct shader_variants *variants, size_t index);
+const char *variants_defines(const struct shader_variants *variants);
+const char *variants_name(const struct shader_variants *variants);
+
+#endif /* VARIANTS_H */
@@ -0,0 +1,164 @@
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "preprocess.h"
+#include "timing.h"
+#include "watch.h"
+
+/** Events of a file written, or moved in place, in a directory. */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+/**
+ * @brief Create the inotify instance of the watcher.
+ *
+ * @param watcher The watcher to initialize.
+ * @return 0 on success, 1 on failure, in which case files are not
+ * watched.
+ */
+int watch_init(struct file_watcher *watcher) {
+  memset(watcher, 0, sizeof(*watcher));
+  watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watcher->fd == -1) {
+    log_warn("[inotify] Cannot initialize inotify: %s", strerror(errno));
+    return 1;
+  }
+  log_debug("[inotify] Initialized successfully");
+  return 0;
+}
+
+/**
+ * @brief Watch the directories of the source files read since the last
+ * call, shaders and included files alike.
+ *
+ * Watching the same directory for several files returns the same
+ * watch descriptor, stored in each file.
+ *
+ * @param watcher The watcher.
+ */
+static void watch_sources(struct file_watcher *watcher) {
+  for (size_t i = 0; i < source_cache_size(); ++i) {
+    struct source_file *file = source_cache_file(i);
+    if (file->watched) {
+      continue;
+    }
+    file->watched = true;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", file->path);
+    const char *directory = dirname(path);
+    file->wd =
+        inotify_add_watch(watcher->fd, directory, WATCH_EVENTS | IN_ONLYDIR);
+    if (file->wd == -1) {
+      log_warn("[inotify] Cannot watch directory %s: %s", directory,
+               strerror(errno));
+      continue;
+    }
+    log_debug("[inotify] Watching file %s", file->path);
+  }
+}
+
+/**
+ * @brief Mark the passes depending on the file named by an event.
+ *
+ * The cached contents of the file are dropped, so that the passes
+ * read it again, while the other files they include are reused.
+ *
+ * @param watcher The watcher.
+ * @param graph The render graph.
+ * @param event An event of a watched directory, with a file name.
+ */
+static void match_event(struct file_watcher *watcher,
+                        const struct render_graph *graph,
+                        const struct inotify_event *event) {
+  for (size_t i = 0; i < source_cache_size(); ++i) {
+    struct source_file *file = source_cache_file(i);
+    const char *slash = strrchr(file->path, '/');
+    const char *name = slash ? slash + 1 : file->path;
+    if (file->wd != event->wd || strcmp(name, event->name)) {
+      continue;
+    }
+    log_debug("[inotify] %s changed", file->path);
+    source_cache_invalidate(i);
+    for (size_t j = 0; j < graph->num_passes; ++j) {
+      if (shader_sources_contain(&graph->passes[j].shader.sources, i)) {
+        watcher->changed[j] = true;
+        watcher->last_event = timing_now();
+      }
+    }
+  }
+}
+
+/**
+ * @brief Read the pending events, and report the changed files once
+ * no event arrived for the debounce time.
+ *
+ * Files read by the preprocessor since the last call are watched
+ * first, so that files newly included by a pass are followed. If
+ * events were lost because the inotify queue overflowed, all the
+ * passes are reported as changed.
+ *
+ * @param watcher The watcher.
+ * @param graph The render graph.
+ * @param changed Set for each pass whose file, or one of its included
+ * files, changed, indexed like the passes of the graph.
+ * @return `true` if some files changed and their passes should be
+ * reloaded.
+ */
+bool watch_poll(struct file_watcher *watcher, struct render_graph *graph,
+                bool changed[MAX_PASSES]) {
+  if (watcher->fd == -1) {
+    return false;
+  }
+  watch_sources(watcher);
+
+  _Alignas(struct inotify_event) char buf[4096];
+  ssize_t length = 0;
+  while ((length = read(watcher->fd, buf, sizeof(buf))) > 0) {
+    const struct inotify_event *event = NULL;
+    for (char *ptr = buf; ptr < buf + length;
+         ptr += sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event *)ptr;
+      if (event->mask & IN_Q_OVERFLOW) {
+        log_warn("[inotify] Events were lost, reloading all the shaders");
+        source_cache_invalidate_all();
+        for (size_t i = 0; i < graph->num_passes; ++i) {
+          watcher->changed[i] = true;
+        }
+        watcher->last_event = timing_now();
+      } else if (event->mask & IN_IGNORED) {
+        log_warn("[inotify] A watched directory was removed");
+      } else if (event->len > 0) {
+        match_event(watcher, graph, event);
+      }
+    }
+  }
+  if (length == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    log_error("[inotify] Could not read events: %s", strerror(errno));
+  }
+
+  if (watcher->last_event == 0 ||
+      timing_now() - watcher->last_event < WATCH_DEBOUNCE_MS) {
+    return false;
+  }
+  memcpy(changed, watcher->changed, sizeof(watcher->changed));
+  memset(watcher->changed, 0, sizeof(watcher->changed));
+  watcher->last_event = 0;
+  return true;
+}
+
+/**
+ * @brief Stop watching files.
+ *
+ * @param watcher The watcher.
+ */
+void watch_close(struct file_watcher *watcher) {
+  if (watcher->fd != -1) {
+    close(watcher->fd);
+    watcher->fd = -1;
+  }
+}
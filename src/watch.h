@@ -0,0 +1,34 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+#include "graph.h"
+
+#define WATCH_DEBOUNCE_MS 100 /**< Quiet time after the last event before
+                                 reloading. */
+
+/**
+ * Watcher of the source files of the passes and of the files they
+ * include.
+ *
+ * The directories containing the files are watched rather than the
+ * files themselves, so that files replaced by a rename, as many
+ * editors do when saving, are still followed. Events are matched to
+ * the files by name, then to the passes including them, and
+ * accumulated until no event arrived for a short time, since a single
+ * save often produces several events.
+ */
+struct file_watcher {
+  int fd;                    /**< inotify file descriptor, or -1. */
+  bool changed[MAX_PASSES];  /**< Passes whose file changed. */
+  double last_event;         /**< Time of the last matching event in
+                                milliseconds, or 0 if none is pending. */
+};
+
+int watch_init(struct file_watcher *watcher);
+bool watch_poll(struct file_watcher *watcher, struct render_graph *graph,
+                bool changed[MAX_PASSES]);
+void watch_close(struct file_watcher *watcher);
+
+#endif /* WATCH_H */